@@ -20,12 +20,21 @@
 #include "comprlib.hpp"
 #include "compress2.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
 #include <list>
 #include <map>
 
 namespace Ep128Compress {
 
   Compressor_M2::CompressionParameters::CompressionParameters()
+    : decodeSpeedWeight(0),
+      splitCandidateLimit(0),
+      longMatchFrameSize(0),
+      longMatchMemoryLimit(0x01000000),
+      matchTableMemoryLimit(0)
   {
     setCompressionLevel(5);
   }
@@ -40,6 +49,30 @@ namespace Ep128Compress {
     blockSize = 0;
   }
 
+  Compressor_M2::BlockStatistics::BlockStatistics()
+  {
+    clear();
+  }
+
+  void Compressor_M2::BlockStatistics::clear()
+  {
+    startPos = 0;
+    nBytes = 0;
+    nSymbols = 0;
+    optimizeIterations = 0;
+    isCompressed = false;
+    headerBits = 0;
+    literalBits = 0;
+    lengthBits = 0;
+    offs1Bits = 0;
+    offs2Bits = 0;
+    offs3Bits = 0;
+    lengthSlots.clear();
+    offs1Slots.clear();
+    offs2Slots.clear();
+    offs3Slots.clear();
+  }
+
   void Compressor_M2::progressMessage(const char *msg)
   {
     if (msg != (char *) 0 && msg[0] != '\0')
@@ -59,11 +92,48 @@ namespace Ep128Compress {
     return true;
   }
 
+  inline double Compressor_M2::getWallClockTime()
+  {
+    return std::chrono::duration< double >(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
   void Compressor_M2::setCompressionLevel(int n)
   {
     config.setCompressionLevel(n);
   }
 
+  void Compressor_M2::setDecodeSpeedWeight(int n)
+  {
+    config.decodeSpeedWeight = size_t(n > 0 ? (n < 1000 ? n : 1000) : 0);
+  }
+
+  void Compressor_M2::setSplitCandidateLimit(int n)
+  {
+    config.splitCandidateLimit = size_t(n > 0 ? n : 0);
+  }
+
+  void Compressor_M2::setLongMatchSearch(int frameSize, size_t memoryLimit)
+  {
+    config.longMatchFrameSize = size_t(frameSize > 0 ? frameSize : 0);
+    config.longMatchMemoryLimit = memoryLimit;
+  }
+
+  void Compressor_M2::setMatchTableMemoryLimit(size_t nBytes)
+  {
+    config.matchTableMemoryLimit = nBytes;
+  }
+
+  void Compressor_M2::setMaxOffset(size_t nBytes)
+  {
+    config.maxOffset = (nBytes > 0 && nBytes < 65536 ? nBytes : 65536);
+  }
+
+  void Compressor_M2::setTimeBudget(double seconds)
+  {
+    endTime = (seconds > 0.0 ? (getWallClockTime() + seconds) : 0.0);
+  }
+
   // --------------------------------------------------------------------------
 
   const size_t Compressor_M2::lengthPrefixSizeTable[lengthNumSlots] = {
@@ -111,6 +181,31 @@ namespace Ep128Compress {
     }
   }
 
+  inline size_t Compressor_M2::getLengthUnencodedCost(size_t n) const
+  {
+    long    unencodedCost = long(n) * 9L - 1L;
+    unencodedCost -= (n > 1 ? long(offs2PrefixSize) : long(offs1PrefixSize));
+    return size_t(unencodedCost > 0L ? unencodedCost : 0L);
+  }
+
+  inline unsigned int Compressor_M2::getOffsUnencodedCost(
+      const LZMatchParameters& m) const
+  {
+    if (m.d < 1)
+      return 0xFFFFFFFFU;
+    size_t  nBits = lengthEncodeTable.getSymbolSize(m.len - minRepeatLen);
+    if (nBits > 64)
+      return 0xFFFFFFFFU;
+    long    unencodedCost = long(m.len) * 9L - 1L - long(nBits);
+    return (unsigned int) (unencodedCost > 0L ? unencodedCost : 0L);
+  }
+
+  inline EncodeTable& Compressor_M2::getOffsEncodeTable(size_t n)
+  {
+    return (n > 2 ? offs3EncodeTable :
+            (n > 1 ? offs2EncodeTable : offs1EncodeTable));
+  }
+
   inline size_t Compressor_M2::getRepeatCodeLength(size_t d, size_t n) const
   {
     n = n - minRepeatLen;
@@ -125,6 +220,89 @@ namespace Ep128Compress {
     return nBits;
   }
 
+  // Z80 cycle counts below are for the non-size optimized version of the
+  // decompressor in decompress_m2_new.s; reading bits from the shift register
+  // is assumed to take 2 extra cycles per bit on average for loading new bytes
+
+  inline size_t Compressor_M2::getReadBitsCycles(size_t nBits)
+  {
+    // readBits16 (with the call and table lookup in readEncodedValue)
+    return (nBits > 0 ? (nBits * 51 + 37) : 19);
+  }
+
+  size_t Compressor_M2::getLengthDecodeCycles(size_t n) const
+  {
+    // returns the cycles used by a match of 'n' bytes, excluding the offset
+    n = n - minRepeatLen;
+    if (n >= lengthEncodeTable.getSymbolsEncoded())
+      return 0;
+    size_t  nBits = lengthEncodeTable.getSymbolSize((unsigned int) n);
+    size_t  slotNum = lengthEncodeTable.getSymbolSlotIndex((unsigned int) n);
+    n = n + minRepeatLen;
+    size_t  nCycles = 327 + (slotNum * 43) + ((nBits + 1) * 2)
+                      + getReadBitsCycles(nBits - (slotNum + 1)) + (n * 21);
+    if (n < 3)
+      nCycles += (n < 2 ? 48 : 70);
+    else
+      nCycles += (n < 256 ? 83 : 58);
+    return nCycles;
+  }
+
+  inline size_t Compressor_M2::getOffsetDecodeCycles(size_t prefixSize,
+                                                     size_t nBits)
+  {
+    return ((prefixSize * 34) + (nBits * 2)
+            + getReadBitsCycles(nBits - prefixSize));
+  }
+
+  inline size_t Compressor_M2::getRepeatCodeCycles(size_t d, size_t n) const
+  {
+    d = d - minRepeatDist;
+    if (n > 2) {
+      return (getLengthDecodeCycles(n)
+              + getOffsetDecodeCycles(offs3PrefixSize,
+                                      offs3EncodeTable.getSymbolSize(d)));
+    }
+    if (n > 1) {
+      return (getLengthDecodeCycles(n)
+              + getOffsetDecodeCycles(offs2PrefixSize,
+                                      offs2EncodeTable.getSymbolSize(d)));
+    }
+    return (getLengthDecodeCycles(n)
+            + getOffsetDecodeCycles(offs1PrefixSize,
+                                    offs1EncodeTable.getSymbolSize(d)));
+  }
+
+  inline size_t Compressor_M2::cyclesToBits(size_t nCycles) const
+  {
+    return ((nCycles * config.decodeSpeedWeight + 512) >> 10);
+  }
+
+  void Compressor_M2::updateDecodeCostTables()
+  {
+    // convert the estimated decode time of match codes to bits
+    // using the current encode tables
+    lengthDecodeCostTable.resize(maxRepeatLen + 1);
+    for (size_t i = 0; i <= maxRepeatLen; i++) {
+      if (!config.decodeSpeedWeight || i < minRepeatLen)
+        lengthDecodeCostTable[i] = 0;
+      else
+        lengthDecodeCostTable[i] = cyclesToBits(getLengthDecodeCycles(i));
+    }
+    for (size_t i = 0; i < 3; i++) {
+      size_t  prefixSize =
+          (i == 0 ? offs1PrefixSize : (i == 1 ? offs2PrefixSize
+                                               : offs3PrefixSize));
+      for (size_t j = 0; j < 32; j++) {
+        if (!config.decodeSpeedWeight || j < prefixSize)
+          offsDecodeCostTable[i][j] = 0;
+        else
+          offsDecodeCostTable[i][j] =
+              cyclesToBits(getOffsetDecodeCycles(prefixSize, j));
+      }
+    }
+  }
+
   void Compressor_M2::optimizeMatches_noStats(LZMatchParameters *matchTable,
                                               size_t *bitCountTable,
                                               size_t offs, size_t nBytes)
@@ -270,6 +448,11 @@ namespace Ep128Compress {
     size_t  maxOffsNonMonotonic =
         findNonMonotonicEncoding(offs1EncodeTable, offs2EncodeTable,
                                  offs3EncodeTable);
+    // if decompression speed is also optimized, the estimated decode time
+    // is added to the size of each code (these are all zero by default)
+    updateDecodeCostTables();
+    const size_t  *lengthCostTable = &(lengthDecodeCostTable.front());
+    size_t  literalCost = cyclesToBits(literalCycles);
     for (size_t i = nBytes; i-- > 0; ) {
       size_t  bestSize = 0x7FFFFFFF;
       size_t  bestLen = 1;
@@ -286,6 +469,8 @@ namespace Ep128Compress {
           bestLen = len;
           bestSize = getRepeatCodeLength(bestOffs, len)
                      + bitCountTable[i + len];
+          if (config.decodeSpeedWeight)
+            bestSize += cyclesToBits(getRepeatCodeCycles(bestOffs, len));
           bestOffsSum = offsSumTable[i + len] + bestOffs;
           len = maxRepeatLen;
         }
@@ -295,6 +480,8 @@ namespace Ep128Compress {
           matchTable[i].len = (unsigned int) len;
           bitCountTable[i] = bitCountTable[i + len]
                              + getRepeatCodeLength(1, len);
+          if (config.decodeSpeedWeight)
+            bitCountTable[i] += cyclesToBits(getRepeatCodeCycles(1, len));
           offsSumTable[i] = offsSumTable[i + len] + 1UL;
           continue;
         }
@@ -313,6 +500,10 @@ namespace Ep128Compress {
             len = (len < maxLen ? len : maxLen);
             maxLen = (len < maxRepeatLen ? len : maxRepeatLen);
             d_offs = d_offs + (*matchPtr >> 10);
+            if (d_offs > (offs + i)) {
+              len = 0;                  // match is in the dictionary
+              break;
+            }
             matchPtr = searchTable->getMatches(offs + i - d_offs);
             len = *(matchPtr++);
           }
@@ -333,11 +524,14 @@ namespace Ep128Compress {
           if (len >= 3) {
             // flag bit + offset bits
             size_t  nBitsBase = offs3EncodeTable.getSymbolSize(
-                                    d - (unsigned int) minRepeatDist) + 1;
+                                    d - (unsigned int) minRepeatDist);
+            nBitsBase = nBitsBase + 1
+                        + offsDecodeCostTable[2][nBitsBase < 32 ? nBitsBase : 0];
             do {
               size_t  nBits = lengthEncodeTable.getSymbolSize(
                                   (unsigned int) (len - minRepeatLen))
-                              + nBitsBase + bitCountTable[i + len];
+                              + nBitsBase + bitCountTable[i + len]
+                              + lengthCostTable[len];
               if (nBits < bestSize ||
                   (nBits == bestSize &&
                    (offsSumTable[i + len] + d) <= bestOffsSum)) {
@@ -351,9 +545,12 @@ namespace Ep128Compress {
           // check short match lengths:
           if (len == 2) {                                       // 2 bytes
             if (d <= offs2EncodeTable.getSymbolsEncoded()) {
-              size_t  nBits = len2BitsP1 + offs2EncodeTable.getSymbolSize(
-                                               d - (unsigned int) minRepeatDist)
-                              + bitCountTable[i + 2];
+              size_t  offsBits = offs2EncodeTable.getSymbolSize(
+                                     d - (unsigned int) minRepeatDist);
+              size_t  nBits = len2BitsP1 + offsBits + bitCountTable[i + 2]
+                              + lengthCostTable[2]
+                              + offsDecodeCostTable[1][offsBits < 32 ?
+                                                       offsBits : 0];
               if (nBits < bestSize ||
                   (nBits == bestSize &&
                    (offsSumTable[i + 2] + d) <= bestOffsSum)) {
@@ -365,9 +562,12 @@ namespace Ep128Compress {
             }
           }
           if (d <= offs1EncodeTable.getSymbolsEncoded()) {      // 1 byte
-            size_t  nBits = len1BitsP1 + offs1EncodeTable.getSymbolSize(
-                                             d - (unsigned int) minRepeatDist)
-                            + bitCountTable[i + 1];
+            size_t  offsBits = offs1EncodeTable.getSymbolSize(
+                                   d - (unsigned int) minRepeatDist);
+            size_t  nBits = len1BitsP1 + offsBits + bitCountTable[i + 1]
+                            + lengthCostTable[1]
+                            + offsDecodeCostTable[0][offsBits < 32 ?
+                                                     offsBits : 0];
             if (nBits < bestSize ||
                 (nBits == bestSize &&
                  (offsSumTable[i + 1] + d) <= bestOffsSum)) {
@@ -379,9 +579,9 @@ namespace Ep128Compress {
           }
         }
       }
-      if (bestSize >= (bitCountTable[i + 1] + 8)) {
+      if (bestSize >= (bitCountTable[i + 1] + 8 + literalCost)) {
         // literal byte,
-        size_t  nBits = bitCountTable[i + 1] + 9;
+        size_t  nBits = bitCountTable[i + 1] + 9 + literalCost;
         if (nBits < bestSize ||
             (nBits == bestSize && offsSumTable[i + 1] <= bestOffsSum)) {
           bestSize = nBits;
@@ -397,6 +597,10 @@ namespace Ep128Compress {
                k++) {
             // and all possible literal sequence lengths
             nBits = bitCountTable[i + k] + (k * 8 + literalSequenceMinLength);
+            if (config.decodeSpeedWeight) {
+              nBits += cyclesToBits(literalSequenceCycles
+                                    + (k * literalSequenceByteCycles));
+            }
             if (nBits > bestSize) {
               if (nBits > (bestSize + literalSequenceMinLength))
                 break;  // quit the loop earlier if the data can be compressed
@@ -420,6 +624,105 @@ namespace Ep128Compress {
     }
   }
 
+  void Compressor_M2::createSplitHistograms(
+      std::vector< unsigned int >& histTable,
+      const std::vector< size_t >& blockStartTable, size_t nBytes)
+  {
+    // parse all input data once with the simplified optimizer, and store
+    // the symbol counts as prefix sums at each initial block boundary
+    size_t  nBlocks = blockStartTable.size() - 1;
+    histTable.clear();
+    histTable.resize((nBlocks + 1) * splitHistSize, 0U);
+    std::vector< LZMatchParameters >  matchTable(nBytes);
+    {
+      std::vector< size_t > bitCountTable(nBytes + 1, 0);
+      optimizeMatches_noStats(&(matchTable.front()), &(bitCountTable.front()),
+                              0, nBytes);
+    }
+    size_t  blockNum = 0;
+    for (size_t i = 0; i < nBytes; ) {
+      while (i >= blockStartTable[blockNum + 1])
+        blockNum++;
+      unsigned int  *h = &(histTable.front()) + ((blockNum + 1) * splitHistSize);
+      const LZMatchParameters&  tmp = matchTable[i];
+      if (tmp.d == 0) {
+        h[splitHistLiteral] += tmp.len;
+      }
+      else {
+        size_t  nBits = 0;
+        while (nBits < 15 && (size_t(tmp.len - 1U) >> nBits) != 0)
+          nBits++;
+        h[splitHistLength + nBits]++;
+        nBits = 0;
+        while ((size_t(tmp.d - 1U) >> nBits) != 0)
+          nBits++;
+        if (tmp.len > 2)
+          h[splitHistOffs3 + nBits]++;
+        else if (tmp.len > 1)
+          h[splitHistOffs2 + nBits]++;
+        else
+          h[splitHistOffs1 + nBits]++;
+      }
+      i += size_t(tmp.len);
+    }
+    for (size_t i = splitHistSize; i < histTable.size(); i++)
+      histTable[i] += histTable[i - splitHistSize];
+  }
+
+  double Compressor_M2::estimateSymbolsCost(const unsigned int *cntTable1,
+                                            const unsigned int *cntTable2,
+                                            size_t n)
+  {
+    // entropy of the symbol classes, plus the extra bits in each class
+    double  totalCnt = 0.0;
+    for (size_t i = 0; i < n; i++)
+      totalCnt += double(int(cntTable1[i] - cntTable2[i]));
+    double  nBits = 0.0;
+    for (size_t i = 0; i < n; i++) {
+      unsigned int  c = cntTable1[i] - cntTable2[i];
+      if (c) {
+        nBits += (double(int(c))
+                  * ((std::log(totalCnt / double(int(c))) * 1.4426950409)
+                     + double(int(i > 1 ? (i - 1) : 0))));
+      }
+    }
+    return nBits;
+  }
+
+  size_t Compressor_M2::estimateBlockCost(
+      const std::vector< unsigned int >& histTable,
+      const std::vector< size_t >& blockStartTable,
+      size_t startPos, size_t endPos) const
+  {
+    const unsigned int  *h1 =
+        &(histTable.front()) + (size_t(std::lower_bound(blockStartTable.begin(),
+                                                        blockStartTable.end(),
+                                                        startPos)
+                                       - blockStartTable.begin())
+                                * splitHistSize);
+    const unsigned int  *h2 =
+        &(histTable.front()) + (size_t(std::lower_bound(blockStartTable.begin(),
+                                                        blockStartTable.end(),
+                                                        endPos)
+                                       - blockStartTable.begin())
+                                * splitHistSize);
+    // block header and encode tables
+    double  nBits = double(int(20 + ((lengthNumSlots + offs1NumSlots
+                                      + offs2NumSlots + 16) * 4)));
+    nBits += double(int(h2[splitHistLiteral] - h1[splitHistLiteral])) * 9.0;
+    for (size_t i = splitHistLength; i < splitHistOffs1; i++)
+      nBits += double(int(h2[i] - h1[i]));      // flag bit for each match
+    nBits += estimateSymbolsCost(h2 + splitHistLength, h1 + splitHistLength,
+                                 splitHistOffs1 - splitHistLength);
+    nBits += estimateSymbolsCost(h2 + splitHistOffs1, h1 + splitHistOffs1,
+                                 splitHistOffs2 - splitHistOffs1);
+    nBits += estimateSymbolsCost(h2 + splitHistOffs2, h1 + splitHistOffs2,
+                                 splitHistOffs3 - splitHistOffs2);
+    nBits += estimateSymbolsCost(h2 + splitHistOffs3, h1 + splitHistOffs3,
+                                 splitHistSize - splitHistOffs3);
+    return size_t(nBits + 0.5);
+  }
+
   size_t Compressor_M2::compressData_(std::vector< unsigned int >& tmpOutBuf,
                                       const std::vector< unsigned char >& inBuf,
                                       size_t offs, size_t nBytes,
@@ -428,11 +731,21 @@ namespace Ep128Compress {
     size_t  endPos = offs + nBytes;
     size_t  nSymbols = 0;
     tmpOutBuf.clear();
+    encodeTablesChanged = true;
     if (!firstPass) {
       // generate optimal encode tables for offset values
-      offs1EncodeTable.updateTables(false);
-      offs2EncodeTable.updateTables(false);
-      offs3EncodeTable.updateTables(fastMode);
+      encodeTablesChanged = lengthEncodeTableChanged;
+      if (offs1EncodeTable.updateTables(false, true))
+        encodeTablesChanged = true;
+      if (offs2EncodeTable.updateTables(false, true))
+        encodeTablesChanged = true;
+      if (offs3EncodeTable.updateTables(fastMode, true))
+        encodeTablesChanged = true;
+      if (!encodeTablesChanged) {
+        // all tables are the same as in the previous pass, so the result
+        // would be the same as well
+        return 0;
+      }
       offs3NumSlots = offs3EncodeTable.getSlotCnt();
       offs3PrefixSize = offs3EncodeTable.getSlotPrefixSize(0);
     }
@@ -454,65 +767,112 @@ namespace Ep128Compress {
       }
     }
     lengthEncodeTable.setUnencodedSymbolSize(8192);
+    // the symbol statistics are only updated with the differences between
+    // the parse of the previous pass and the new one, and encode tables with
+    // unchanged statistics are not recalculated
+    LZMatchParameters *prvMatchPtr = &(prvMatchTable.front()) - offs;
+    unsigned int  *prvOffsCostPtr = &(prvOffsCostTable.front()) - offs;
     // generate optimal encode table for length values
-    for (size_t i = offs; i < endPos; ) {
-      LZMatchParameters&  tmp = matchTable[i - offs];
-      if (tmp.d > 0) {
-        long    unencodedCost = long(tmp.len) * 9L - 1L;
-        unencodedCost -=
-            (tmp.len > 1 ? long(offs2PrefixSize) : long(offs1PrefixSize));
-        unencodedCost = (unencodedCost > 0L ? unencodedCost : 0L);
-        lengthEncodeTable.addSymbol(tmp.len - minRepeatLen,
-                                    size_t(unencodedCost));
+    for (size_t i = offs, j = offs; i < endPos || j < endPos; ) {
+      // i: position in the new parse, j: position in the previous parse
+      if (i <= j) {
+        const LZMatchParameters&  tmp = matchTable[i - offs];
+        if (i == j) {
+          const LZMatchParameters&  prv = prvMatchPtr[j];
+          j += size_t(prv.len);
+          if (tmp.d == prv.d && tmp.len == prv.len) {
+            i += size_t(tmp.len);
+            continue;
+          }
+          if (prv.d > 0) {
+            lengthEncodeTable.removeSymbol(prv.len - minRepeatLen,
+                                           getLengthUnencodedCost(prv.len));
+          }
+        }
+        if (tmp.d > 0) {
+          lengthEncodeTable.addSymbol(tmp.len - minRepeatLen,
+                                      getLengthUnencodedCost(tmp.len));
+        }
+        i += size_t(tmp.len);
+      }
+      else {
+        const LZMatchParameters&  prv = prvMatchPtr[j];
+        if (prv.d > 0) {
+          lengthEncodeTable.removeSymbol(prv.len - minRepeatLen,
+                                         getLengthUnencodedCost(prv.len));
+        }
+        j += size_t(prv.len);
       }
-      i += size_t(tmp.len);
     }
-    lengthEncodeTable.updateTables(false);
-    // update LZ77 offset statistics for calculating encode tables later
-    for (size_t i = offs; i < endPos; ) {
-      LZMatchParameters&  tmp = matchTable[i - offs];
-      if (tmp.d > 0) {
-        if (lengthEncodeTable.getSymbolSize(tmp.len - minRepeatLen) <= 64) {
-          long    unencodedCost = long(tmp.len) * 9L - 1L;
-          unencodedCost -=
-              long(lengthEncodeTable.getSymbolSize(tmp.len - minRepeatLen));
-          unencodedCost = (unencodedCost > 0L ? unencodedCost : 0L);
-          if (tmp.len > 2) {
-            offs3EncodeTable.addSymbol(tmp.d - minRepeatDist,
-                                       size_t(unencodedCost));
-          }
-          else if (tmp.len > 1) {
-            offs2EncodeTable.addSymbol(tmp.d - minRepeatDist,
-                                       size_t(unencodedCost));
+    lengthEncodeTableChanged = lengthEncodeTable.updateTables(false, true);
+    // update LZ77 offset statistics for calculating encode tables later,
+    // and store the new parse
+    for (size_t i = offs, j = offs; i < endPos || j < endPos; ) {
+      if (i <= j) {
+        const LZMatchParameters&  tmp = matchTable[i - offs];
+        unsigned int  unencodedCost = getOffsUnencodedCost(tmp);
+        if (i == j) {
+          const LZMatchParameters&  prv = prvMatchPtr[j];
+          j += size_t(prv.len);
+          if (tmp.d == prv.d && tmp.len == prv.len &&
+              unencodedCost == prvOffsCostPtr[i]) {
+            i += size_t(tmp.len);
+            continue;
           }
-          else {
-            offs1EncodeTable.addSymbol(tmp.d - minRepeatDist,
-                                       size_t(unencodedCost));
+          if (prvOffsCostPtr[i] != 0xFFFFFFFFU) {
+            getOffsEncodeTable(prv.len).removeSymbol(
+                prv.d - minRepeatDist, prvOffsCostPtr[i]);
           }
         }
+        if (unencodedCost != 0xFFFFFFFFU) {
+          getOffsEncodeTable(tmp.len).addSymbol(tmp.d - minRepeatDist,
+                                                unencodedCost);
+        }
+        // the previous parse is not used any more before position j
+        prvMatchPtr[i] = tmp;
+        prvOffsCostPtr[i] = unencodedCost;
+        i += size_t(tmp.len);
+      }
+      else {
+        const LZMatchParameters&  prv = prvMatchPtr[j];
+        if (prvOffsCostPtr[j] != 0xFFFFFFFFU) {
+          getOffsEncodeTable(prv.len).removeSymbol(
+              prv.d - minRepeatDist, prvOffsCostPtr[j]);
+        }
+        j += size_t(prv.len);
       }
-      i += size_t(tmp.len);
     }
     // first pass: there are no offset encode tables yet, so no data is written
     if (firstPass)
       return 0;
+    blockDecodeCycles = blockHeaderCycles
+                        + ((lengthNumSlots + offs1NumSlots + offs2NumSlots
+                            + offs3NumSlots) * blockTableEntryCycles);
+    BlockStatistics&  st = tmpBlockStatistics;
+    st.clear();
+    st.headerBits = 2 + ((lengthNumSlots + offs1NumSlots + offs2NumSlots
+                          + offs3NumSlots) * 4);
     // write encode tables
     tmpOutBuf.push_back(0x02000000U | (unsigned int) (offs3PrefixSize - 2));
     for (size_t i = 0; i < lengthNumSlots; i++) {
       unsigned int  c = (unsigned int) lengthEncodeTable.getSlotSize(i);
       tmpOutBuf.push_back(0x04000000U | c);
+      st.lengthSlots.push_back((unsigned char) c);
     }
     for (size_t i = 0; i < offs1NumSlots; i++) {
       unsigned int  c = (unsigned int) offs1EncodeTable.getSlotSize(i);
       tmpOutBuf.push_back(0x04000000U | c);
+      st.offs1Slots.push_back((unsigned char) c);
     }
     for (size_t i = 0; i < offs2NumSlots; i++) {
       unsigned int  c = (unsigned int) offs2EncodeTable.getSlotSize(i);
       tmpOutBuf.push_back(0x04000000U | c);
+      st.offs2Slots.push_back((unsigned char) c);
     }
     for (size_t i = 0; i < offs3NumSlots; i++) {
       unsigned int  c = (unsigned int) offs3EncodeTable.getSlotSize(i);
       tmpOutBuf.push_back(0x04000000U | c);
+      st.offs3Slots.push_back((unsigned char) c);
     }
     // write compressed data
     for (size_t i = offs; i < endPos; ) {
@@ -533,6 +893,19 @@ namespace Ep128Compress {
       if (tmp.d > 0) {
         // write LZ77 match
         writeRepeatCode(tmpOutBuf, tmp.d, tmp.len);
+        blockDecodeCycles += getRepeatCodeCycles(tmp.d, tmp.len);
+        {
+          size_t  lenBits = lengthEncodeTable.getSymbolSize(
+                                tmp.len - (unsigned int) minRepeatLen) + 1;
+          size_t  nBits = getRepeatCodeLength(tmp.d, tmp.len) - lenBits;
+          st.lengthBits += lenBits;
+          if (tmp.len > 2)
+            st.offs3Bits += nBits;
+          else if (tmp.len > 1)
+            st.offs2Bits += nBits;
+          else
+            st.offs1Bits += nBits;
+        }
         i = i + tmp.len;
         nSymbols++;
       }
@@ -552,6 +925,9 @@ namespace Ep128Compress {
             tmpOutBuf.push_back(0x88000000U | (unsigned int) inBuf[i]);
             i++;
           }
+          blockDecodeCycles += (literalSequenceCycles
+                                + (len * literalSequenceByteCycles));
+          st.literalBits += (lengthNumSlots + 9 + (len * 8));
           nSymbols++;
           tmp.len -= (unsigned int) len;
         }
@@ -559,6 +935,8 @@ namespace Ep128Compress {
           // write literal byte(s)
           tmpOutBuf.push_back(0x01000000U);
           tmpOutBuf.push_back(0x88000000U | (unsigned int) inBuf[i]);
+          blockDecodeCycles += literalCycles;
+          st.literalBits += 9;
           i++;
           nSymbols++;
           tmp.len--;
@@ -584,12 +962,21 @@ namespace Ep128Compress {
     offs1EncodeTable.clear();
     offs2EncodeTable.clear();
     offs3EncodeTable.clear();
+    // there is no previous parse yet, all symbols are added in the first pass
+    prvMatchTable.clear();
+    prvMatchTable.resize(nBytes);
+    prvOffsCostTable.clear();
+    prvOffsCostTable.resize(nBytes, 0xFFFFFFFFU);
+    lengthEncodeTableChanged = true;
     std::vector< uint64_t >     hashTable;
     std::vector< unsigned int > bestBuf;
     std::vector< unsigned int > tmpBuf;
     const size_t  headerSize = (startAddr < 0x80000000U ? 34 : 18);
     size_t  bestSize = 0x7FFFFFFF;
+    size_t  bestCycles = 0;
     size_t  nSymbols = 0;
+    size_t  nIterations = 0;
+    BlockStatistics bestStatistics;
     bool    doneFlag = false;
     for (size_t i = 0; i < config.optimizeIterations; i++) {
       if (progressDisplayEnabled) {
@@ -599,9 +986,19 @@ namespace Ep128Compress {
       }
       if (doneFlag)     // if the compression cannot be optimized further,
         continue;       // quit the loop earlier
+      if (i >= 2 && passEndTime > 0.0 && getWallClockTime() >= passEndTime) {
+        // out of time, keep the best result of the passes already done
+        doneFlag = true;
+        continue;
+      }
       tmpBuf.clear();
       size_t  tmp =
           compressData_(tmpBuf, inBuf, offs, nBytes, (i == 0), fastMode);
+      if (!encodeTablesChanged) {
+        doneFlag = true;
+        continue;
+      }
+      nIterations++;
       if (i == 0)       // the first optimization pass writes no data
         continue;
       // calculate compressed size and hash value
@@ -618,6 +1015,9 @@ namespace Ep128Compress {
         // found a better compression, so save it
         nSymbols = tmp;
         bestSize = compressedSize;
+        bestCycles = blockDecodeCycles;
+        if (!fastMode)
+          bestStatistics = tmpBlockStatistics;
         bestBuf.resize(tmpBuf.size());
         std::memcpy(&(bestBuf.front()), &(tmpBuf.front()),
                     tmpBuf.size() * sizeof(unsigned int));
@@ -643,8 +1043,12 @@ namespace Ep128Compress {
       tmpOutBuf.push_back(0x01000000U);
       for (size_t i = offs; i < endPos; i++)
         tmpOutBuf.push_back(0x88000000U | (unsigned int) inBuf[i]);
+      bestCycles = blockHeaderCycles + (nBytes * literalSequenceByteCycles);
+      bestStatistics.clear();
+      bestStatistics.literalBits = nBytes * 8;
     }
     else {
+      bestStatistics.isCompressed = true;
       tmpOutBuf.push_back(0x10000000U | (unsigned int) (nSymbols - 1));
       tmpOutBuf.push_back(0x01000000U | (unsigned int) isLastBlock);
       tmpOutBuf.push_back(0x01000001U);
@@ -652,13 +1056,54 @@ namespace Ep128Compress {
       for (size_t i = 0; i < bestBuf.size(); i++)
         tmpOutBuf.push_back(bestBuf[i]);
     }
+    // the decode time and statistics are only stored for the blocks
+    // actually written
+    if (!fastMode) {
+      decodeCycles += uint64_t(bestCycles);
+      bestStatistics.startPos = offs;
+      bestStatistics.nBytes = nBytes;
+      bestStatistics.nSymbols =
+          (bestStatistics.isCompressed ? nSymbols : nBytes);
+      bestStatistics.optimizeIterations = nIterations;
+      bestStatistics.headerBits += headerSize;
+      blockStatistics.push_back(bestStatistics);
+    }
     return true;
   }
 
+  inline void Compressor_M2::flushOutputShiftReg()
+  {
+    // write all complete bytes from the shift register, the first one is
+    // stored at the saved position if any literal bytes were inserted
+    if (outputBitCnt < 8)
+      return;
+    outputBitCnt = outputBitCnt - 8;
+    unsigned char b =
+        (unsigned char) ((outputShiftReg >> outputBitCnt) & 0xFFU);
+    if (savedOutBufPos >= outBuf.size()) {
+      outBuf.push_back(b);
+    }
+    else {
+      outBuf[savedOutBufPos] = b;
+      savedOutBufPos = 0x7FFFFFFF;
+    }
+    while (outputBitCnt >= 8) {
+      outputBitCnt = outputBitCnt - 8;
+      outBuf.push_back((unsigned char) ((outputShiftReg >> outputBitCnt)
+                                        & 0xFFU));
+    }
+  }
+
   // --------------------------------------------------------------------------
 
   Compressor_M2::Compressor_M2(std::vector< unsigned char >& outBuf_)
     : outBuf(outBuf_),
+      decodeCycles(0UL),
+      searchTime(0.0),
+      splitOptimizationTime(0.0),
+      encodeTime(0.0),
+      endTime(0.0),
+      passEndTime(0.0),
       lengthEncodeTable(lengthNumSlots, lengthMaxValue,
                         &(lengthPrefixSizeTable[0])),
       offs1EncodeTable(offs1NumSlots, offs1MaxValue, (size_t *) 0,
@@ -670,8 +1115,11 @@ namespace Ep128Compress {
       offs3NumSlots(4),
       offs3PrefixSize(2),
       searchTable((LZSearchTable *) 0),
+      blockDecodeCycles(0),
+      lengthEncodeTableChanged(true),
+      encodeTablesChanged(true),
       savedOutBufPos(0x7FFFFFFF),
-      outputShiftReg(0x00),
+      outputShiftReg(0U),
       outputBitCnt(0)
   {
   }
@@ -682,6 +1130,15 @@ namespace Ep128Compress {
       delete searchTable;
   }
 
+  void Compressor_M2::setDictionary(const unsigned char *buf, size_t nBytes)
+  {
+    if (nBytes > maxRepeatDist)
+      throw Ep128Emu::Exception("Compressor_M2: dictionary is too large");
+    dictionaryBuf.clear();
+    if (buf && nBytes > 0)
+      dictionaryBuf.insert(dictionaryBuf.end(), buf, buf + nBytes);
+  }
+
   bool Compressor_M2::compressData(const std::vector< unsigned char >& inBuf,
                                    unsigned int startAddr, bool isLastBlock,
                                    bool enableProgressDisplay)
@@ -691,6 +1148,8 @@ namespace Ep128Compress {
     if (inBuf.size() < 1)
       return true;
     progressDisplayEnabled = enableProgressDisplay;
+    passEndTime = 0.0;
+    double  t0 = getWallClockTime();
     try {
       if (enableProgressDisplay) {
         progressMessage("Compressing data");
@@ -701,15 +1160,33 @@ namespace Ep128Compress {
         searchTable = (LZSearchTable *) 0;
       }
       {
-        size_t  maxOffs = inBuf.size() - 1;
+        size_t  maxOffs = dictionaryBuf.size() + inBuf.size() - 1;
         maxOffs = (maxOffs > 1 ?
                    (maxOffs < config.maxOffset ? maxOffs : config.maxOffset)
                    : 1);
         searchTable =
             new LZSearchTable(config.minLength, maxRepeatLen, lengthMaxValue,
                               offs1MaxValue, offs2MaxValue, maxOffs);
+        searchTable->setMemoryLimit(config.matchTableMemoryLimit);
+        if (config.longMatchFrameSize > 0 && config.maxOffset >= 65536) {
+          searchTable->setLongMatchParameters(config.longMatchFrameSize,
+                                              maxRepeatDist,
+                                              config.longMatchMemoryLimit);
+        }
+      }
+      if (dictionaryBuf.size() < 1) {
+        searchTable->findMatches(&(inBuf.front()), 0, inBuf.size());
       }
-      searchTable->findMatches(&(inBuf.front()), 0, inBuf.size());
+      else {
+        // search the dictionary as if it was the data already decompressed
+        std::vector< unsigned char >  tmpBuf(dictionaryBuf);
+        tmpBuf.insert(tmpBuf.end(), inBuf.begin(), inBuf.end());
+        searchTable->findMatches(&(tmpBuf.front()), dictionaryBuf.size(),
+                                 inBuf.size());
+      }
+      double  t1 = getWallClockTime();
+      searchTime += (t1 - t0);
+      t0 = t1;
       // split large files to improve statistical compression
       std::list< SplitOptimizationBlock >   splitPositions;
       std::map< uint64_t, size_t >          splitOptimizationCache;
@@ -747,22 +1224,96 @@ namespace Ep128Compress {
           splitPositions.push_back(tmpBlock);
         }
       }
-      while (config.blockSize < 1) {
+      // symbol statistics for estimating the size of merged blocks
+      std::vector< unsigned int > splitHistTable;
+      std::vector< size_t >       splitStartTable;
+      std::vector< size_t >       splitCandidates;
+      // these are also used to finish the split optimization quickly if
+      // the time limit is reached
+      if (config.blockSize < 1 &&
+          (config.splitCandidateLimit > 0 || endTime > 0.0) &&
+          splitPositions.size() > 2) {
+        std::list< SplitOptimizationBlock >::iterator i_ =
+            splitPositions.begin();
+        for ( ; i_ != splitPositions.end(); i_++)
+          splitStartTable.push_back((*i_).startPos);
+        splitStartTable.push_back(inBuf.size());
+        createSplitHistograms(splitHistTable, splitStartTable, inBuf.size());
+      }
+      bool    screeningFailed = false;
+      bool    timeLimitReached = false;
+      if (endTime > 0.0) {
+        // use at most half of the remaining time for split optimization
+        double  t = getWallClockTime();
+        passEndTime = (endTime > t ? (t + ((endTime - t) * 0.5)) : t);
+      }
+      while (config.blockSize < 1 && !timeLimitReached) {
         size_t  bestMergePos = 0;
         long    bestMergeBits = 0x7FFFFFFFL;
+        bool    screeningEnabled =
+            (config.splitCandidateLimit > 0 && splitHistTable.size() > 0 &&
+             !screeningFailed);
         // find the pair of blocks that reduce the total compressed size
         // the most when merged
         std::list< SplitOptimizationBlock >::iterator curBlock =
             splitPositions.begin();
+        if (screeningEnabled) {
+          // if the number of candidates is limited, select the pairs with
+          // the best estimated size change
+          std::vector< std::pair< long, size_t > >  tmpBuf;
+          while (curBlock != splitPositions.end()) {
+            std::list< SplitOptimizationBlock >::iterator nxtBlock = curBlock;
+            nxtBlock++;
+            if (nxtBlock == splitPositions.end())
+              break;
+            size_t  startPos = (*curBlock).startPos;
+            size_t  midPos = startPos + (*curBlock).nBytes;
+            size_t  endPos = midPos + (*nxtBlock).nBytes;
+            if ((endPos - startPos) <= 65536) {
+              long    sizeDiff =
+                  long(estimateBlockCost(splitHistTable, splitStartTable,
+                                         startPos, endPos))
+                  - long(estimateBlockCost(splitHistTable, splitStartTable,
+                                           startPos, midPos))
+                  - long(estimateBlockCost(splitHistTable, splitStartTable,
+                                           midPos, endPos));
+              tmpBuf.push_back(std::pair< long, size_t >(sizeDiff, startPos));
+            }
+            curBlock++;
+          }
+          if (tmpBuf.size() > config.splitCandidateLimit) {
+            std::nth_element(tmpBuf.begin(),
+                             tmpBuf.begin() + config.splitCandidateLimit,
+                             tmpBuf.end());
+            tmpBuf.resize(config.splitCandidateLimit);
+          }
+          splitCandidates.clear();
+          for (size_t i = 0; i < tmpBuf.size(); i++)
+            splitCandidates.push_back(tmpBuf[i].second);
+          std::sort(splitCandidates.begin(), splitCandidates.end());
+          curBlock = splitPositions.begin();
+        }
         while (curBlock != splitPositions.end()) {
           std::list< SplitOptimizationBlock >::iterator nxtBlock = curBlock;
           nxtBlock++;
           if (nxtBlock == splitPositions.end())
             break;
+          if (passEndTime > 0.0 && getWallClockTime() >= passEndTime) {
+            // out of time, only the pairs already compressed are considered
+            timeLimitReached = true;
+            break;
+          }
           if (((*curBlock).nBytes + (*nxtBlock).nBytes) > 65536) {
             curBlock++;
             continue;                   // limit block size to <= 64K
           }
+          if (screeningEnabled &&
+              !std::binary_search(splitCandidates.begin(),
+                                  splitCandidates.end(),
+                                  (*curBlock).startPos)) {
+            curBlock++;
+            continue;                   // not selected by the size estimate
+          }
           size_t  nBitsSplit = 0;
           size_t  nBitsMerged = 0;
           for (size_t i = 0; i < 3; i++) {
@@ -821,8 +1372,16 @@ namespace Ep128Compress {
           }
           curBlock++;
         }
-        if (bestMergeBits > 0L)         // no more blocks can be merged
-          break;
+        if (bestMergeBits > 0L) {
+          // if none of the selected candidates could be merged, try all
+          // pairs of blocks before stopping
+          if (screeningEnabled && !timeLimitReached) {
+            screeningFailed = true;
+            continue;
+          }
+          break;                        // no more blocks can be merged
+        }
+        screeningFailed = false;
         // merge the best pair of blocks and continue
         curBlock = splitPositions.begin();
         while ((*curBlock).startPos != bestMergePos)
@@ -832,6 +1391,49 @@ namespace Ep128Compress {
         (*curBlock).nBytes = (*curBlock).nBytes + (*nxtBlock).nBytes;
         splitPositions.erase(nxtBlock);
       }
+      while (timeLimitReached && splitHistTable.size() > 0) {
+        // out of time: continue merging blocks using only the size estimate,
+        // which is much faster than compressing them
+        std::list< SplitOptimizationBlock >::iterator bestBlock =
+            splitPositions.end();
+        long    bestMergeBits = 0L;
+        std::list< SplitOptimizationBlock >::iterator curBlock =
+            splitPositions.begin();
+        while (curBlock != splitPositions.end()) {
+          std::list< SplitOptimizationBlock >::iterator nxtBlock = curBlock;
+          nxtBlock++;
+          if (nxtBlock == splitPositions.end())
+            break;
+          size_t  startPos = (*curBlock).startPos;
+          size_t  midPos = startPos + (*curBlock).nBytes;
+          size_t  endPos = midPos + (*nxtBlock).nBytes;
+          if ((endPos - startPos) <= 65536) {
+            long    sizeDiff =
+                long(estimateBlockCost(splitHistTable, splitStartTable,
+                                       startPos, endPos))
+                - long(estimateBlockCost(splitHistTable, splitStartTable,
+                                         startPos, midPos))
+                - long(estimateBlockCost(splitHistTable, splitStartTable,
+                                         midPos, endPos));
+            if (sizeDiff < bestMergeBits) {
+              bestBlock = curBlock;
+              bestMergeBits = sizeDiff;
+            }
+          }
+          curBlock++;
+        }
+        if (bestBlock == splitPositions.end())
+          break;
+        std::list< SplitOptimizationBlock >::iterator nxtBlock = bestBlock;
+        nxtBlock++;
+        (*bestBlock).nBytes = (*bestBlock).nBytes + (*nxtBlock).nBytes;
+        splitPositions.erase(nxtBlock);
+      }
+      {
+        double  t1 = getWallClockTime();
+        splitOptimizationTime += (t1 - t0);
+        t0 = t1;
+      }
       // compress all blocks again with full optimization
       {
         size_t  progressPercentage = 0;
@@ -847,6 +1449,15 @@ namespace Ep128Compress {
       std::vector< unsigned int >   outBufTmp;
       std::list< SplitOptimizationBlock >::iterator i_ = splitPositions.begin();
       while (i_ != splitPositions.end()) {
+        if (endTime > 0.0) {
+          // share the remaining time between the blocks by size
+          double  t = getWallClockTime();
+          passEndTime = t;
+          if (endTime > t) {
+            passEndTime += ((endTime - t) * double(long((*i_).nBytes))
+                            / double(long(inBuf.size() - (*i_).startPos)));
+          }
+        }
         std::vector< unsigned int > tmpBuf;
         if (!compressData(tmpBuf, inBuf, startAddr,
                           (isLastBlock &&
@@ -862,19 +1473,30 @@ namespace Ep128Compress {
           outBufTmp.push_back(tmpBuf[i]);
         i_++;
       }
+      passEndTime = 0.0;
       delete searchTable;
       searchTable = (LZSearchTable *) 0;
       if (progressDisplayEnabled) {
         setProgressPercentage(100);
         progressMessage("");
       }
+      encodeTime += (getWallClockTime() - t0);
       // pack output data
       if (outBuf.size() == 0)
         outBuf.push_back((unsigned char) 0x00); // reserve space for checksum
+      {
+        // reserve output capacity: each byte of the shift register or
+        // literal data needs 8 bits, plus one partial byte at the end
+        size_t  nBits = size_t(outputBitCnt) + 8;
+        for (size_t i = 0; i < outBufTmp.size(); i++)
+          nBits += size_t((outBufTmp[i] & 0x7F000000U) >> 24);
+        outBuf.reserve(outBuf.size() + (nBits >> 3));
+      }
       for (size_t i = 0; i < outBufTmp.size(); i++) {
         unsigned int  c = outBufTmp[i];
         if (c >= 0x80000000U) {
           // special case for literal bytes, which are stored byte-aligned
+          flushOutputShiftReg();
           if (outputBitCnt > 0 && savedOutBufPos >= outBuf.size()) {
             // reserve space for the shift register to be stored later when
             // it is full, and save the write position
@@ -888,42 +1510,23 @@ namespace Ep128Compress {
           }
         }
         else {
+          // append up to 24 bits to the shift register, and store complete
+          // bytes only when at least 32 bits are buffered
           unsigned int  nBits = c >> 24;
-          c = c & 0x00FFFFFFU;
-          for (unsigned int j = nBits; j > 0U; ) {
-            j--;
-            unsigned int  b = (unsigned int) (bool(c & (1U << j)));
-            outputShiftReg = ((outputShiftReg & 0x7F) << 1) | (unsigned char) b;
-            if (++outputBitCnt >= 8) {
-              if (savedOutBufPos >= outBuf.size()) {
-                outBuf.push_back(outputShiftReg);
-              }
-              else {
-                // store at saved position if any literal bytes were inserted
-                outBuf[savedOutBufPos] = outputShiftReg;
-                savedOutBufPos = 0x7FFFFFFF;
-              }
-              outputShiftReg = 0x00;
-              outputBitCnt = 0;
-            }
-          }
+          c = c & ((1U << nBits) - 1U);
+          outputShiftReg = (outputShiftReg << nBits) | uint64_t(c);
+          outputBitCnt = outputBitCnt + int(nBits);
+          if (outputBitCnt >= 32)
+            flushOutputShiftReg();
         }
       }
+      flushOutputShiftReg();
       if (isLastBlock) {
-        while (outputBitCnt != 0) {
-          outputShiftReg = ((outputShiftReg & 0x7F) << 1);
-          if (++outputBitCnt >= 8) {
-            if (savedOutBufPos >= outBuf.size()) {
-              outBuf.push_back(outputShiftReg);
-            }
-            else {
-              // store at saved position if any literal bytes were inserted
-              outBuf[savedOutBufPos] = outputShiftReg;
-              savedOutBufPos = 0x7FFFFFFF;
-            }
-            outputShiftReg = 0x00;
-            outputBitCnt = 0;
-          }
+        if (outputBitCnt > 0) {
+          // pad the last byte with zero bits
+          outputShiftReg = outputShiftReg << (8 - outputBitCnt);
+          outputBitCnt = 8;
+          flushOutputShiftReg();
         }
         // calculate checksum
         unsigned char crcVal = 0xFF;
@@ -949,5 +1552,93 @@ namespace Ep128Compress {
     return true;
   }
 
+  // append printf style formatted text of any length to 's'
+
+  static void appendFormatted(std::string& s, const char *fmt, ...)
+  {
+    char    tmpBuf[256];
+    std::va_list  ap;
+    va_start(ap, fmt);
+    int     n = std::vsnprintf(&(tmpBuf[0]), sizeof(tmpBuf), fmt, ap);
+    va_end(ap);
+    if (n < 0)
+      throw Ep128Emu::Exception("error formatting compression statistics");
+    if (size_t(n) < sizeof(tmpBuf)) {
+      s += &(tmpBuf[0]);
+      return;
+    }
+    std::vector< char > tmpBuf2(size_t(n) + 1);
+    va_start(ap, fmt);
+    std::vsnprintf(&(tmpBuf2.front()), tmpBuf2.size(), fmt, ap);
+    va_end(ap);
+    s += &(tmpBuf2.front());
+  }
+
+  static void appendSlotTable(std::string& s,
+                              const std::vector< unsigned char >& t)
+  {
+    s += '[';
+    for (size_t i = 0; i < t.size(); i++)
+      appendFormatted(s, (i == 0 ? "%d" : ", %d"), int(t[i]));
+    s += ']';
+  }
+
+  void Compressor_M2::getStatisticsJSON(std::string& s, int indent) const
+  {
+    std::string indentStr(size_t(indent > 0 ? indent : 0), ' ');
+    appendFormatted(s,
+                    "{\n%s  \"search_time\": %.3f,\n"
+                    "%s  \"split_time\": %.3f,\n"
+                    "%s  \"encode_time\": %.3f,\n"
+                    "%s  \"decode_cycles\": %lu,\n"
+                    "%s  \"blocks\": [",
+                    indentStr.c_str(), searchTime,
+                    indentStr.c_str(), splitOptimizationTime,
+                    indentStr.c_str(), encodeTime,
+                    indentStr.c_str(), (unsigned long) decodeCycles,
+                    indentStr.c_str());
+    for (size_t i = 0; i < blockStatistics.size(); i++) {
+      const BlockStatistics&  st = blockStatistics[i];
+      appendFormatted(s,
+                      "%s\n%s    { \"start\": %lu, \"size\": %lu, "
+                      "\"compressed\": %s, \"symbols\": %lu, "
+                      "\"iterations\": %lu,\n"
+                      "%s      \"bits\": { \"header\": %lu, "
+                      "\"literals\": %lu, \"lengths\": %lu, "
+                      "\"offs1\": %lu, \"offs2\": %lu, \"offs3\": %lu }",
+                      (i == 0 ? "" : ","), indentStr.c_str(),
+                      (unsigned long) st.startPos, (unsigned long) st.nBytes,
+                      (st.isCompressed ? "true" : "false"),
+                      (unsigned long) st.nSymbols,
+                      (unsigned long) st.optimizeIterations,
+                      indentStr.c_str(),
+                      (unsigned long) st.headerBits,
+                      (unsigned long) st.literalBits,
+                      (unsigned long) st.lengthBits,
+                      (unsigned long) st.offs1Bits,
+                      (unsigned long) st.offs2Bits,
+                      (unsigned long) st.offs3Bits);
+      if (st.isCompressed) {
+        s += ",\n";
+        s += indentStr;
+        s += "      \"slots\": { \"length\": ";
+        appendSlotTable(s, st.lengthSlots);
+        s += ", \"offs1\": ";
+        appendSlotTable(s, st.offs1Slots);
+        s += ", \"offs2\": ";
+        appendSlotTable(s, st.offs2Slots);
+        s += ", \"offs3\": ";
+        appendSlotTable(s, st.offs3Slots);
+        s += " }";
+      }
+      s += " }";
+    }
+    s += '\n';
+    s += indentStr;
+    s += "  ]\n";
+    s += indentStr;
+    s += '}';
+  }
+
 }       // namespace Ep128Compress
 
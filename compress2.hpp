@@ -22,6 +22,7 @@
 #include "ep128emu.hpp"
 #include "comprlib.hpp"
 
+#include <string>
 #include <vector>
 
 namespace Ep128Compress {
@@ -34,9 +35,48 @@ namespace Ep128Compress {
       size_t  minLength;
       size_t  maxOffset;
       size_t  blockSize;
+      // decompression speed weight: the estimated decode time is added to
+      // the cost of each match or literal as N bits per 1024 Z80 cycles
+      // (0 = optimize for size only)
+      size_t  decodeSpeedWeight;
+      // if non-zero, the block pairs to be merged during split optimization
+      // are ranked by an estimate of the compressed size, and only this
+      // number of the best candidates are actually compressed
+      size_t  splitCandidateLimit;
+      // if non-zero, matches longer than maxOffset are also searched at
+      // positions that are multiples of this number of bytes, using a hash
+      // table of at most longMatchMemoryLimit bytes
+      size_t  longMatchFrameSize;
+      size_t  longMatchMemoryLimit;
+      // maximum memory used by the match table in bytes (0 = no limit),
+      // fewer match candidates are stored if there is not enough space
+      size_t  matchTableMemoryLimit;
       CompressionParameters();
       void setCompressionLevel(int n);
     };
+    struct BlockStatistics {
+      size_t  startPos;
+      size_t  nBytes;
+      size_t  nSymbols;
+      // number of optimization passes done before the early exit
+      size_t  optimizeIterations;
+      bool    isCompressed;
+      // size in bits of the block header and encode tables, literal bytes
+      // and sequences, match lengths, and offsets for length 1, 2, >= 3
+      size_t  headerBits;
+      size_t  literalBits;
+      size_t  lengthBits;
+      size_t  offs1Bits;
+      size_t  offs2Bits;
+      size_t  offs3Bits;
+      // encode table slot sizes
+      std::vector< unsigned char >  lengthSlots;
+      std::vector< unsigned char >  offs1Slots;
+      std::vector< unsigned char >  offs2Slots;
+      std::vector< unsigned char >  offs3Slots;
+      BlockStatistics();
+      void clear();
+    };
    protected:
     std::vector< unsigned char >& outBuf;
     size_t  progressCnt;
@@ -44,11 +84,38 @@ namespace Ep128Compress {
     bool    progressDisplayEnabled;
     int     prvProgressPercentage;
     CompressionParameters   config;
+    uint64_t  decodeCycles;
+    // statistics of all blocks written, and wall clock time spent (in
+    // seconds) on match search, split optimization and final compression
+    std::vector< BlockStatistics >  blockStatistics;
+    double    searchTime;
+    double    splitOptimizationTime;
+    double    encodeTime;
+    // wall clock time (in seconds) at which the compression should be
+    // finished, and the end of the current optimization phase or block
+    // (0.0 = no time limit)
+    double    endTime;
+    double    passEndTime;
     // --------
     void progressMessage(const char *msg);
     bool setProgressPercentage(int n);
+    static inline double getWallClockTime();
    public:
     virtual void setCompressionLevel(int n);
+    virtual void setDecodeSpeedWeight(int n);
+    virtual void setSplitCandidateLimit(int n);
+    virtual void setLongMatchSearch(int frameSize, size_t memoryLimit);
+    virtual void setMatchTableMemoryLimit(size_t nBytes);
+    // limit the match offset to 'nBytes' (0: no limit other than the
+    // default of 65536), so that the data can be decompressed to a ring
+    // buffer of this size; long match search is disabled if the limit is
+    // less than 65536, and setCompressionLevel() resets it
+    virtual void setMaxOffset(size_t nBytes);
+    // limit the wall clock time used by all subsequent calls to
+    // compressData() to 'seconds' from now (<= 0.0: no limit); when the
+    // time runs out, the best result found so far is written, but the match
+    // search and at least one encoding pass of each block are always done
+    virtual void setTimeBudget(double seconds);
    private:
     static const size_t minRepeatDist = 1;
     static const size_t maxRepeatDist = 524288;
@@ -66,6 +133,20 @@ namespace Ep128Compress {
     static const unsigned int offs3MaxValue = (unsigned int) maxRepeatDist;
     static const size_t offs3SlotCntTable[4];
     static const size_t literalSequenceMinLength = lengthNumSlots + 9;
+    // estimated decompression time in Z80 cycles (see decompress_m2_new.s)
+    static const size_t literalCycles = 89;
+    static const size_t literalSequenceCycles = 982;
+    static const size_t literalSequenceByteCycles = 21;
+    static const size_t blockHeaderCycles = 1100;
+    static const size_t blockTableEntryCycles = 350;
+    // split cost estimate histogram: literal bytes, match lengths (16),
+    // and offsets for length 1, 2, >= 3 (20 each) by the number of bits
+    static const size_t splitHistLiteral = 0;
+    static const size_t splitHistLength = 1;
+    static const size_t splitHistOffs1 = 17;
+    static const size_t splitHistOffs2 = 37;
+    static const size_t splitHistOffs3 = 57;
+    static const size_t splitHistSize = 77;
     // --------
     struct LZMatchParameters {
       unsigned int  d;
@@ -107,18 +188,57 @@ namespace Ep128Compress {
     size_t        offs3NumSlots;
     size_t        offs3PrefixSize;
     LZSearchTable *searchTable;
+    // data that precedes the decompressed data in memory, and can be
+    // referenced by matches (empty by default)
+    std::vector< unsigned char >  dictionaryBuf;
+    // decompression time cost in bits for each match length,
+    // and for each offset symbol size by offset table (length 1, 2, >= 3)
+    std::vector< size_t > lengthDecodeCostTable;
+    size_t        offsDecodeCostTable[3][32];
+    size_t        blockDecodeCycles;
+    BlockStatistics tmpBlockStatistics;
+    // parse of the previous optimization pass, and the unencoded cost of
+    // the offset symbols added to the statistics (0xFFFFFFFF: none)
+    std::vector< LZMatchParameters >  prvMatchTable;
+    std::vector< unsigned int >       prvOffsCostTable;
+    // true if the length encode table was recalculated in the last pass,
+    // and if compressData_() was called with any changed encode table
+    bool          lengthEncodeTableChanged;
+    bool          encodeTablesChanged;
     size_t        savedOutBufPos;
-    unsigned char outputShiftReg;
+    // bits not yet written to outBuf, the last 'outputBitCnt' bits are valid
+    uint64_t      outputShiftReg;
     int           outputBitCnt;
     // --------
+    inline void flushOutputShiftReg();
     void writeRepeatCode(std::vector< unsigned int >& buf, size_t d, size_t n);
+    inline size_t getLengthUnencodedCost(size_t n) const;
+    inline unsigned int getOffsUnencodedCost(
+        const LZMatchParameters& m) const;
+    inline EncodeTable& getOffsEncodeTable(size_t n);
     inline size_t getRepeatCodeLength(size_t d, size_t n) const;
+    static inline size_t getReadBitsCycles(size_t nBits);
+    size_t getLengthDecodeCycles(size_t n) const;
+    static inline size_t getOffsetDecodeCycles(size_t prefixSize,
+                                               size_t nBits);
+    inline size_t getRepeatCodeCycles(size_t d, size_t n) const;
+    inline size_t cyclesToBits(size_t nCycles) const;
+    void updateDecodeCostTables();
     void optimizeMatches_noStats(LZMatchParameters *matchTable,
                                  size_t *bitCountTable,
                                  size_t offs, size_t nBytes);
     void optimizeMatches(LZMatchParameters *matchTable,
                          size_t *bitCountTable, uint64_t *offsSumTable,
                          size_t offs, size_t nBytes);
+    void createSplitHistograms(std::vector< unsigned int >& histTable,
+                               const std::vector< size_t >& blockStartTable,
+                               size_t nBytes);
+    static double estimateSymbolsCost(const unsigned int *cntTable1,
+                                      const unsigned int *cntTable2,
+                                      size_t n);
+    size_t estimateBlockCost(const std::vector< unsigned int >& histTable,
+                             const std::vector< size_t >& blockStartTable,
+                             size_t startPos, size_t endPos) const;
     size_t compressData_(std::vector< unsigned int >& tmpOutBuf,
                          const std::vector< unsigned char >& inBuf,
                          size_t offs, size_t nBytes, bool firstPass,
@@ -135,6 +255,24 @@ namespace Ep128Compress {
     virtual bool compressData(const std::vector< unsigned char >& inBuf,
                               unsigned int startAddr, bool isLastBlock,
                               bool enableProgressDisplay = false);
+    // set shared dictionary data of 'nBytes' bytes, the decompressor
+    // expects to find this immediately before the start address of the
+    // decompressed data; the same dictionary is used in all subsequent calls
+    // to compressData(), 'nBytes' = 0 disables the use of a dictionary
+    virtual void setDictionary(const unsigned char *buf, size_t nBytes);
+    // returns the estimated time in Z80 cycles needed to decompress
+    // all data written so far
+    inline uint64_t getDecodeCycles() const
+    {
+      return decodeCycles;
+    }
+    inline const std::vector< BlockStatistics >& getBlockStatistics() const
+    {
+      return blockStatistics;
+    }
+    // appends the block statistics and timing information as a JSON object
+    // to 's', the lines are indented by 'indent' spaces
+    void getStatisticsJSON(std::string& s, int indent = 0) const;
   };
 
 }       // namespace Ep128Compress
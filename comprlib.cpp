@@ -19,6 +19,18 @@
 #include "ep128emu.hpp"
 #include "comprlib.hpp"
 
+#if defined(__GNUC__) && defined(__AVX2__)
+#  include <immintrin.h>
+#  define EPCOMPRESS_USE_AVX2   1
+#endif
+#if defined(__GNUC__) && (defined(__SSE2__) || defined(__AVX2__))
+#  include <emmintrin.h>
+#  define EPCOMPRESS_USE_SSE2   1
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && \
+      (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#  define EPCOMPRESS_USE_CTZ64  1
+#endif
+
 namespace Ep128Compress {
 
   class HuffmanNode {
@@ -291,7 +303,9 @@ namespace Ep128Compress {
       unusedSymbolSize(8192),
       minPrefixSize(minPrefixSize_),
       maxPrefixSize(maxPrefixSize_),
-      prefixOnlySymbolCnt(0)
+      prefixOnlySymbolCnt(0),
+      statisticsChanged(true),
+      prvFastMode(false)
   {
     if (nSymbols < 1)
       throw Ep128Emu::Exception("EncodeTable::EncodeTable(): nSymbols < 1");
@@ -834,9 +848,27 @@ namespace Ep128Compress {
     return size_t(encodedSizeBuffer[0]);
   }
 
-  void EncodeTable::updateTables(bool fastMode)
+  bool EncodeTable::updateTables(bool fastMode, bool keepStatistics)
   {
+    if (keepStatistics && !statisticsChanged && fastMode == prvFastMode)
+      return false;
     try {
+      // symbols may have been removed from the end of the range
+      while (nSymbolsUsed > 0 && symbolCntTable[nSymbolsUsed - 1] == 0U &&
+             unencodedSymbolCostTable[nSymbolsUsed - 1] == 0U) {
+        nSymbolsUsed--;
+      }
+      std::vector< unsigned int > savedSymbolCntTable;
+      std::vector< unsigned int > savedUnencodedSymbolCostTable;
+      if (keepStatistics) {
+        savedSymbolCntTable.insert(
+            savedSymbolCntTable.end(), symbolCntTable.begin(),
+            symbolCntTable.begin() + (nSymbolsUsed + 1));
+        savedUnencodedSymbolCostTable.insert(
+            savedUnencodedSymbolCostTable.end(),
+            unencodedSymbolCostTable.begin(),
+            unencodedSymbolCostTable.begin() + (nSymbolsUsed + 1));
+      }
       size_t  totalSymbolCnt = 0;
       size_t  totalUnencodedSymbolCost = 0;
       for (size_t i = 0; i < nSymbolsUsed; i++) {
@@ -899,18 +931,30 @@ namespace Ep128Compress {
           symbolSizeTable[j] = (unsigned char) symbolSize;
         }
       }
-      for (size_t i = 0; i <= nSymbolsUsed; i++) {
-        symbolCntTable[i] = 0U;
-        unencodedSymbolCostTable[i] = 0U;
-      }
-      nSymbolsUsed = 0;
       nSymbolsEncoded = baseSymbol;
-      prefixOnlySymbolCnt = 0;
+      if (keepStatistics) {
+        for (size_t i = 0; i <= nSymbolsUsed; i++) {
+          symbolCntTable[i] = savedSymbolCntTable[i];
+          unencodedSymbolCostTable[i] = savedUnencodedSymbolCostTable[i];
+        }
+        statisticsChanged = false;
+        prvFastMode = fastMode;
+      }
+      else {
+        for (size_t i = 0; i <= nSymbolsUsed; i++) {
+          symbolCntTable[i] = 0U;
+          unencodedSymbolCostTable[i] = 0U;
+        }
+        nSymbolsUsed = 0;
+        prefixOnlySymbolCnt = 0;
+        statisticsChanged = true;
+      }
     }
     catch (...) {
       this->clear();
       throw;
     }
+    return true;
   }
 
   void EncodeTable::clear()
@@ -930,6 +974,7 @@ namespace Ep128Compress {
     nSymbolsUsed = 0;
     nSymbolsEncoded = 0;
     prefixOnlySymbolCnt = 0;
+    statisticsChanged = true;
   }
 
   // ==========================================================================
@@ -952,11 +997,38 @@ namespace Ep128Compress {
       return 0U;
     if (l < 2 || p1[1] != p2[1])
       return 1U;
-    if (l >= 8) {
-      if (std::memcmp(p1 + 2, p2 + 2, l - 2) == 0)
-        return l;
-    }
     size_t  i = 2;
+    // compare 32, 16 or 8 bytes at a time, and find the position of the
+    // first difference from the lowest set bit of the mismatch mask
+#ifdef EPCOMPRESS_USE_AVX2
+    for ( ; (i + 32) <= l; i = i + 32) {
+      __m256i a = _mm256_loadu_si256((const __m256i *) (p1 + i));
+      __m256i b = _mm256_loadu_si256((const __m256i *) (p2 + i));
+      unsigned int  m =
+          ~((unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)));
+      if (m)
+        return (unsigned int) (i + size_t(__builtin_ctz(m)));
+    }
+#endif
+#ifdef EPCOMPRESS_USE_SSE2
+    for ( ; (i + 16) <= l; i = i + 16) {
+      __m128i a = _mm_loadu_si128((const __m128i *) (p1 + i));
+      __m128i b = _mm_loadu_si128((const __m128i *) (p2 + i));
+      unsigned int  m =
+          (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xFFFFU;
+      if (m)
+        return (unsigned int) (i + size_t(__builtin_ctz(m)));
+    }
+#endif
+#ifdef EPCOMPRESS_USE_CTZ64
+    for ( ; (i + 8) <= l; i = i + 8) {
+      uint64_t  a, b;
+      std::memcpy(&a, p1 + i, sizeof(uint64_t));
+      std::memcpy(&b, p2 + i, sizeof(uint64_t));
+      if (a != b)
+        return (unsigned int) (i + size_t(__builtin_ctzll(a ^ b) >> 3));
+    }
+#endif
     for ( ; (i + 4) <= l; i = i + 4) {
       if (((p1[i] ^ p2[i]) | (p1[i + 1] ^ p2[i + 1])
            | (p1[i + 2] ^ p2[i + 2]) | (p1[i + 3] ^ p2[i + 3])) != 0) {
@@ -1172,8 +1244,11 @@ namespace Ep128Compress {
           size_t  rl2 = rleLenTable[pos2];
           size_t  rleLen = (rl1 < rl2 ? rl1 : rl2);
           if (l > rleLen) {
-            c = std::memcmp(buf + (pos1 + rleLen), buf + (pos2 + rleLen),
-                            l - rleLen);
+            size_t  n = rleLen + RadixTree::compareStrings(
+                                     buf + (pos1 + rleLen), l - rleLen,
+                                     buf + (pos2 + rleLen), l - rleLen);
+            if (n < l)
+              c = int(buf[pos1 + n]) - int(buf[pos2 + n]);
           }
         }
         else {
@@ -1196,7 +1271,8 @@ namespace Ep128Compress {
     unsigned int  maxOffs = maxOffs_;
     unsigned int  prvDist = maxOffs;
     size_t  minLen = minLength_;
-    bool    firstMatch = true;
+    unsigned int  *matchBuf = &(tmpMatchBuf.front());
+    size_t  nMatches = 0;
     for (size_t k = maxLen; k >= minLen; k--) {
       unsigned int  d = offsTable[k];
       offsTable[k] = maxOffs;
@@ -1206,27 +1282,65 @@ namespace Ep128Compress {
           if (d >= (k == 1 ? maxOffs1_ : maxOffs2_))
             continue;
         }
-        if (EP128EMU_UNLIKELY((matchTableBuf.size() + 3)
-                              > matchTableBuf.capacity())) {
-          matchTableBuf.reserve(((matchTableBuf.size()
-                                  + (matchTableBuf.size() >> 1)) | 0x03FF) + 1);
-        }
-        unsigned int  l = (unsigned int) k;
-        if (EP128EMU_UNLIKELY(firstMatch)) {
-          firstMatch = false;
-          matchTable[bufPos] = matchTableBuf.size();
-          if (lengthMaxValue_ > 1023) {
-            matchTableBuf.push_back(l);
-            l = 0U;
-          }
-        }
-        matchTableBuf.push_back(l | ((d + 1U) << 10));
+        matchBuf[nMatches++] = (unsigned int) k | ((d + 1U) << 10);
         if (!d)
           break;
       }
     }
-    if (!firstMatch)
-      matchTableBuf.push_back(0U);
+    if (nMatches < 1)
+      return;
+    if (matchTableMaxSize > 0) {
+      // limit the number of matches so that the remaining space is shared
+      // evenly by the remaining positions (with 2 elements of overhead for
+      // the terminator and the length of the first match)
+      size_t  n = 0;
+      if (matchTableBuf.size() < matchTableMaxSize) {
+        n = (matchTableMaxSize - matchTableBuf.size())
+            / (matchTable.size() - bufPos);
+      }
+      n = (n > 3 ? (n - 2) : 1);
+      if (nMatches > n)
+        nMatches = reduceMatches(matchBuf, nMatches, n);
+    }
+    if (EP128EMU_UNLIKELY((matchTableBuf.size() + nMatches + 2)
+                          > matchTableBuf.capacity())) {
+      matchTableBuf.reserve(((matchTableBuf.size() + nMatches
+                              + (matchTableBuf.size() >> 1)) | 0x03FF) + 1);
+    }
+    matchTable[bufPos] = matchTableBuf.size();
+    if (lengthMaxValue_ > 1023) {
+      matchTableBuf.push_back(matchBuf[0] & 0x03FFU);
+      matchBuf[0] = matchBuf[0] & 0xFFFFFC00U;
+    }
+    for (size_t i = 0; i < nMatches; i++)
+      matchTableBuf.push_back(matchBuf[i]);
+    matchTableBuf.push_back(0U);
+  }
+
+  size_t LZSearchTable::reduceMatches(unsigned int *matchBuf, size_t nMatches,
+                                      size_t maxMatches)
+  {
+    // the matches are sorted by decreasing length and offset, keep only
+    // the longest one of the matches with the same number of offset bits
+    size_t  n = 1;
+    for (size_t i = 1; i < nMatches; i++) {
+      unsigned int  d0 = (matchBuf[n - 1] >> 10) - 1U;
+      unsigned int  d1 = (matchBuf[i] >> 10) - 1U;
+      while (d0 > 1U) {
+        d0 = d0 >> 1;
+        d1 = d1 >> 1;
+      }
+      if (d1 < d0)
+        matchBuf[n++] = matchBuf[i];
+    }
+    if (n > maxMatches) {
+      // if there are still too many, keep the longest and the shortest ones
+      size_t  nDiscarded = n - maxMatches;
+      for (size_t i = 1; i < maxMatches; i++)
+        matchBuf[i] = matchBuf[i + nDiscarded];
+      n = maxMatches;
+    }
+    return n;
   }
 
   // --------------------------------------------------------------------------
@@ -1240,7 +1354,12 @@ namespace Ep128Compress {
       lengthMaxValue_(uint32_t(lengthMaxValue)),
       maxOffs1_(uint32_t(maxOffs1)),
       maxOffs2_(uint32_t(maxOffs2)),
-      maxOffs_(uint32_t(maxOffs))
+      maxOffs_(uint32_t(maxOffs)),
+      longMatchFrameSize_(0U),
+      longMatchMaxOffs_(0U),
+      longMatchMemoryLimit_(0),
+      memoryLimit_(0),
+      matchTableMaxSize(0)
   {
     if (minLength < 1 || minLength > maxLength || maxLength > 1023 ||
         lengthMaxValue < maxLength || maxOffs < 1U || maxOffs > 0x003FFFFFU ||
@@ -1253,6 +1372,130 @@ namespace Ep128Compress {
         (maxOffs1_ > 1U ? (maxOffs1_ < maxOffs_ ? maxOffs1_ : maxOffs_) : 1U);
     maxOffs2_ =
         (maxOffs2_ > 1U ? (maxOffs2_ < maxOffs_ ? maxOffs2_ : maxOffs_) : 1U);
+    tmpMatchBuf.resize(maxLength + 1);
+  }
+
+  void LZSearchTable::setMemoryLimit(size_t nBytes)
+  {
+    memoryLimit_ = nBytes;
+  }
+
+  void LZSearchTable::setLongMatchParameters(size_t frameSize,
+                                             size_t maxOffs_,
+                                             size_t memoryLimit)
+  {
+    if (maxOffs_ > 0x003FFFFF) {
+      throw Ep128Emu::Exception("LZSearchTable::setLongMatchParameters(): "
+                                "invalid offset range");
+    }
+    longMatchFrameSize_ = uint32_t(frameSize);
+    longMatchMaxOffs_ = uint32_t(maxOffs_);
+    longMatchMemoryLimit_ = memoryLimit;
+  }
+
+  void LZSearchTable::addLongMatch(size_t bufPos, size_t len, unsigned int d)
+  {
+    // insert a match before the first one at 'bufPos' if it is longer
+    size_t  n = matchTable[bufPos];
+    size_t  len0 = 0;
+    unsigned int  d0 = 0U;
+    if (matchTableBuf[n]) {
+      if (lengthMaxValue_ > 1023) {
+        len0 = matchTableBuf[n];
+        d0 = matchTableBuf[n + 1] >> 10;
+        n = n + 2;
+      }
+      else {
+        len0 = matchTableBuf[n] & 0x03FFU;
+        d0 = matchTableBuf[n] >> 10;
+        n++;
+      }
+    }
+    if (len <= len0)
+      return;
+    if (matchTableMaxSize > 0 &&
+        (matchTableBuf.size() + (n - matchTable[bufPos]) + 3)
+        > matchTableMaxSize) {
+      return;
+    }
+    matchTable[bufPos] = (unsigned int) matchTableBuf.size();
+    if (lengthMaxValue_ > 1023) {
+      matchTableBuf.push_back((unsigned int) len);
+      matchTableBuf.push_back(d << 10);
+    }
+    else {
+      matchTableBuf.push_back((unsigned int) len | (d << 10));
+    }
+    if (len0 > 0) {
+      // the previous first match may be longer than 1023 bytes
+      len0 = (len0 < maxLength_ ? len0 : maxLength_);
+      matchTableBuf.push_back((unsigned int) len0 | (d0 << 10));
+      for ( ; matchTableBuf[n] != 0U; n++)
+        matchTableBuf.push_back(matchTableBuf[n]);
+    }
+    matchTableBuf.push_back(0U);
+  }
+
+  void LZSearchTable::findLongMatches(const unsigned char *buf,
+                                      size_t offs_, size_t nBytes_)
+  {
+    size_t  frameSize = longMatchFrameSize_;
+    size_t  bufSize = offs_ + nBytes_;
+    // minimum length of the sequences stored in the hash table
+    size_t  minLen = frameSize * 4;
+    minLen = (minLen > 32 ? (minLen < 1024 ? minLen : 1024) : 32);
+    if (frameSize < 1 || longMatchMaxOffs_ <= maxOffs_ ||
+        bufSize <= (size_t(maxOffs_) + minLen)) {
+      return;
+    }
+    size_t  hashBits = 10;
+    while (hashBits < 28 &&
+           (sizeof(unsigned int) << (hashBits + 1)) <= longMatchMemoryLimit_ &&
+           (size_t(1) << hashBits) < (bufSize / frameSize)) {
+      hashBits++;
+    }
+    std::vector< unsigned int > hashTable(size_t(1) << hashBits, 0xFFFFFFFFU);
+    // Rabin-Karp hash of the 'minLen' bytes starting at position 'i'
+    const uint32_t  hashMult = 0x9E3779B1U;
+    uint32_t  hashMultPow = 1U;
+    uint32_t  h = 0U;
+    for (size_t i = 0; i < minLen; i++) {
+      hashMultPow = hashMultPow * hashMult;
+      h = (h * hashMult) + uint32_t(buf[i]);
+    }
+    size_t  matchEnd = offs_;
+    for (size_t i = 0; (i + minLen) <= bufSize; i++) {
+      if (i > 0) {
+        h = (h * hashMult) + uint32_t(buf[i + minLen - 1])
+            - (hashMultPow * uint32_t(buf[i - 1]));
+      }
+      if ((i % frameSize) != 0)
+        continue;
+      size_t  hashPos = size_t((h * 0x2545F491U) >> (32 - hashBits));
+      size_t  prvPos = hashTable[hashPos];
+      hashTable[hashPos] = (unsigned int) i;
+      if (prvPos >= i || i < matchEnd)
+        continue;
+      size_t  d = i - prvPos;
+      if (d <= size_t(maxOffs_) || d > size_t(longMatchMaxOffs_))
+        continue;
+      size_t  maxLen = bufSize - i;
+      maxLen = (maxLen < lengthMaxValue_ ? maxLen : lengthMaxValue_);
+      size_t  len = RadixTree::compareStrings(buf + i, maxLen,
+                                              buf + prvPos, maxLen);
+      if (len < minLen)
+        continue;               // hash collision
+      // extend the match backwards, and store it at all positions
+      size_t  startPos = i;
+      while (startPos > matchEnd && startPos > d &&
+             (i + len - (startPos - 1)) <= lengthMaxValue_ &&
+             buf[startPos - 1] == buf[startPos - 1 - d]) {
+        startPos--;
+      }
+      matchEnd = i + len;
+      for (size_t j = startPos; j < matchEnd; j++)
+        addLongMatch(j - offs_, matchEnd - j, (unsigned int) d);
+    }
   }
 
   void LZSearchTable::findMatches(const unsigned char *buf,
@@ -1268,6 +1511,15 @@ namespace Ep128Compress {
       matchTableBuf.clear();
     }
     matchTable.resize(nBytes_, 0xFFFFFFFFU);
+    matchTableMaxSize = 0;
+    if (memoryLimit_ > 0) {
+      // at least one match is stored at each position
+      matchTableMaxSize = memoryLimit_ / sizeof(unsigned int);
+      matchTableMaxSize =
+          (matchTableMaxSize > (nBytes_ * 5) ? matchTableMaxSize : (nBytes_ * 5))
+          - nBytes_;
+      matchTableBuf.reserve(matchTableMaxSize);
+    }
     if (matchTableBuf.capacity() < 1024)
       matchTableBuf.reserve(1024);
     matchTableBuf.push_back(0U);
@@ -1428,20 +1680,25 @@ namespace Ep128Compress {
     }
     // find very long matches
     size_t  lengthMaxValue = lengthMaxValue_;
-    if (lengthMaxValue <= maxLength || nBytes_ < 2)
-      return;
-    unsigned int  lenMask = (lengthMaxValue < 1024 ? 0x03FFU : 0xFFFFFFFFU);
-    unsigned int  distOffs = (unsigned int) (lengthMaxValue >= 1024);
-    for (size_t i = nBytes_ - 1; i-- > 0; ) {
-      unsigned int  *m0 = &(matchTableBuf.front()) + size_t(matchTable[i]);
-      unsigned int  *m1 = &(matchTableBuf.front()) + size_t(matchTable[i + 1]);
-      if ((*m0 & lenMask) >= (unsigned int) maxLength &&
-          (*m1 & lenMask) >= (unsigned int) maxLength &&
-          ((m0[distOffs] ^ m1[distOffs]) & 0xFFFFFC00U) == 0U) {
-        *m0 = ((*m1 & lenMask) < (unsigned int) lengthMaxValue ?
-               (*m1 + 1U) : *m1);
+    if (lengthMaxValue > maxLength && nBytes_ >= 2) {
+      unsigned int  lenMask = (lengthMaxValue < 1024 ? 0x03FFU : 0xFFFFFFFFU);
+      unsigned int  distOffs = (unsigned int) (lengthMaxValue >= 1024);
+      for (size_t i = nBytes_ - 1; i-- > 0; ) {
+        unsigned int  *m0 =
+            &(matchTableBuf.front()) + size_t(matchTable[i]);
+        unsigned int  *m1 =
+            &(matchTableBuf.front()) + size_t(matchTable[i + 1]);
+        if ((*m0 & lenMask) >= (unsigned int) maxLength &&
+            (*m1 & lenMask) >= (unsigned int) maxLength &&
+            ((m0[distOffs] ^ m1[distOffs]) & 0xFFFFFC00U) == 0U) {
+          *m0 = ((*m1 & lenMask) < (unsigned int) lengthMaxValue ?
+                 (*m1 + 1U) : *m1);
+        }
       }
     }
+    // find matches beyond the normal search range
+    if (longMatchFrameSize_ > 0U)
+      findLongMatches(buf, offs_, nBytes_);
   }
 
   LZSearchTable::~LZSearchTable()
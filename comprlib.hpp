@@ -91,6 +91,10 @@ namespace Ep128Compress {
     size_t    minPrefixSize;
     size_t    maxPrefixSize;
     size_t    prefixOnlySymbolCnt;
+    // true if the symbol statistics may have changed since the last call
+    // to updateTables() with 'keepStatistics' set
+    bool      statisticsChanged;
+    bool      prvFastMode;
     std::vector< size_t >   prefixSlotCntTable;
     std::vector< size_t >   slotPrefixSizeTable;
     std::vector< size_t >   slotWeightTable;
@@ -137,12 +141,21 @@ namespace Ep128Compress {
       unencodedSymbolCostTable[n] += (unsigned int) unencodedCost;
       if (size_t(n) >= nSymbolsUsed)
         nSymbolsUsed = size_t(n) + 1;
+      statisticsChanged = true;
+    }
+    // undo a previous addSymbol() with the same parameters
+    inline void removeSymbol(unsigned int n, size_t unencodedCost = 16384)
+    {
+      symbolCntTable[n] -= 1U;
+      unencodedSymbolCostTable[n] -= (unsigned int) unencodedCost;
+      statisticsChanged = true;
     }
     // this function is for special symbols that use "reserved" slots
     // in the table (e.g. for repeating the previous match distance)
     inline void addPrefixOnlySymbol()
     {
       prefixOnlySymbolCnt++;
+      statisticsChanged = true;
     }
     inline void setUnencodedSymbolSize(size_t n)
     {
@@ -182,7 +195,12 @@ namespace Ep128Compress {
     {
       return slotBitsTable[n];
     }
-    void updateTables(bool fastMode = false);
+    // calculate the encode tables from the symbol statistics; if
+    // 'keepStatistics' is false, the statistics are cleared, otherwise they
+    // can be updated for the next call with addSymbol() and removeSymbol(),
+    // and the tables are not recalculated if there were no changes
+    // returns false if the tables were not recalculated
+    bool updateTables(bool fastMode = false, bool keepStatistics = false);
     void clear();
   };
 
@@ -241,12 +259,26 @@ namespace Ep128Compress {
     uint32_t    maxOffs1_;
     uint32_t    maxOffs2_;
     uint32_t    maxOffs_;
+    // long range search parameters (frame size 0: disabled)
+    uint32_t    longMatchFrameSize_;
+    uint32_t    longMatchMaxOffs_;
+    size_t      longMatchMemoryLimit_;
+    // maximum size of matchTable and matchTableBuf in bytes (0: no limit),
+    // and the maximum number of elements in matchTableBuf
+    size_t      memoryLimit_;
+    size_t      matchTableMaxSize;
+    std::vector< unsigned int > tmpMatchBuf;
     // --------
     static void sortFunc(unsigned int *startPtr, unsigned int *endPtr,
                          const unsigned char *buf, size_t bufSize,
                          unsigned int *tmpBuf, size_t maxLen,
                          const unsigned short *rleLenTable);
     void addMatches(size_t bufPos, unsigned int *offsTable, size_t maxLen);
+    static size_t reduceMatches(unsigned int *matchBuf, size_t nMatches,
+                                size_t maxMatches);
+    void addLongMatch(size_t bufPos, size_t len, unsigned int d);
+    void findLongMatches(const unsigned char *buf, size_t offs_,
+                         size_t nBytes_);
    public:
     // minLength:   minimum match length
     // maxLength:   maximum match length for optimal search (must be <= 1023)
@@ -257,6 +289,19 @@ namespace Ep128Compress {
     LZSearchTable(size_t minLength, size_t maxLength, size_t lengthMaxValue,
                   size_t maxOffs1, size_t maxOffs2, size_t maxOffs);
     virtual ~LZSearchTable();
+    // enable searching matches at distances greater than 'maxOffs' (up to
+    // 'maxOffs_' <= 0x003FFFFF) with a rolling hash of byte sequences
+    // starting at multiples of 'frameSize' bytes; 'memoryLimit' is the
+    // maximum size of the hash table in bytes
+    void setLongMatchParameters(size_t frameSize, size_t maxOffs_,
+                                size_t memoryLimit);
+    // limit the memory used by the match table to 'nBytes' (0: no limit);
+    // if there is not enough space, only the longest match for each offset
+    // size in bits, and then only the longest and the shortest ones are
+    // stored at each position. At least 20 bytes per input byte are always
+    // allowed, and the radix tree and other temporary buffers used during
+    // the search, which depend on the maximum offset, are not included
+    void setMemoryLimit(size_t nBytes);
     // buf:     input data to be searched
     // offs_:   start position in 'buf', this will be at bufPos == 0 in
     //          getMatches(), but up to 'maxOffs' bytes before 'offs_' are
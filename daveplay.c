@@ -8,10 +8,14 @@
 /* oct_table[n] =
  *     (unsigned int) (250000.0 / (440.0 * pow(2.0, (n / 64.0 - 71.0) / 12.0))
  *                     + 0.5)
+ * sin_table[n] = (int) (sin(n * PI * 0.5 / 255.0) * 181.02 + 0.5)
  */
+#if DAVE_INIT_TABLES
 static unsigned int   oct_table[768];
-/* sin_table[n] = (int) (sin(n * PI * 0.5 / 255.0) * 181.02 + 0.5) */
 static unsigned char  sin_table[256];
+#else
+#include "davetbl.h"
+#endif
 
 DaveChannel     dave_chn[DAVE_VIRT_CHNS];
 
@@ -27,15 +31,30 @@ typedef struct {
 
 static DaveRegisters  dave_regs;
 
+/* registers calculated on the first frame of a half rate envelope step
+ * (flagged by bit 7 of vol_r in the envelope data), played again on the
+ * second frame
+ */
+typedef struct {
+  unsigned char volume_l;
+  unsigned char volume_r;
+  unsigned int  chn_freq;
+} DaveChannelRegisters;
+
+static DaveChannelRegisters dave_chn_regs[DAVE_VIRT_CHNS];
+
+#if DAVE_INIT_TABLES
 /* freq_mult_table[n] =
  *     (unsigned int) (65536.0 * pow(0.5, 1.0 / (3.0 * (1 << n))) + 0.5)
  */
 static const unsigned int freq_mult_table[9] = {
   52016, 58386, 61858, 63670, 64596, 65065, 65300, 65418, 65477
 };
+#endif
 
 void dave_init(void)
 {
+#if DAVE_INIT_TABLES
   unsigned int  j, k, f;
   unsigned char s;
   oct_table[0] = 34323U;
@@ -62,6 +81,7 @@ void dave_init(void)
     j = j + k;
     k = k - (((j >> 6) * 41 + 8258) >> 14);
   }
+#endif
   dave_reset();
 }
 
@@ -80,6 +100,7 @@ void dave_reset(void)
     chn->vol_r = 128;
   }
   memset_fast(&dave_regs, 0x00, sizeof(DaveRegisters));
+  memset_fast(dave_chn_regs, 0x00, sizeof(dave_chn_regs));
   memset_fast(midi_dave_chn, 0, 16);
   dave_chn0_index = 0;
   dave_chn1_index = 1;
@@ -88,10 +109,12 @@ void dave_reset(void)
 void dave_channel_release(DaveChannel *chn) __z88dk_fastcall
 {
   if (chn->env_state & 0x10) {
-    /* release */
-    chn->env_state = 0x60;
-    if (*(chn->env_ptr) >= 0xC0)
+    /* release, a half rate envelope step is finished first, and the hold
+     * frame check is done when its second frame has been played
+     */
+    if (!(chn->env_state & 0x08) && *(chn->env_ptr) >= 0xC0)
       chn->env_ptr = chn->env_ptr + 4;
+    chn->env_state = (chn->env_state & 0x0C) | 0x60;
     chn->env_timer = 0;
   }
   else if ((unsigned char) chn != (unsigned char) &(dave_chn[3])) {
@@ -229,7 +252,11 @@ unsigned char dave_channel_on(unsigned char midi_chn, unsigned char pgm,
     if (c < 4)
       chn = dave_channel_ptr(c - 1);
     else
+#if DAVE_VIRT_CHNS > 4
       chn = find_best_channel(c & 1, c & 0xFD, c | 2);
+#else
+      chn = dave_channel_ptr(c & 1);
+#endif
   }
   else {
     c = (midi_chn & 1) << 1;
@@ -251,10 +278,29 @@ unsigned char dave_channel_on(unsigned char midi_chn, unsigned char pgm,
   return c;
 }
 
+/* p = envelope offset and flags (2 bytes), pitch (2 bytes), distortion,
+ *     velocity, pan, volume
+ */
+
+void dave_channel_start(unsigned char c, const unsigned char *p)
+{
+  DaveChannel   *chn = dave_channel_ptr(c);
+  unsigned int  pitch = ((const unsigned int *) p)[1];
+  unsigned char env_flags = p[1];
+  chn->env_state = env_flags & 0xB0;
+  set_channel_params(chn,
+                     envelope_data
+                     + ((*((const unsigned int *) p) & 0x0FFF) << 1),
+                     pitch, p[5], p + 4);
+  if (env_flags & 0x40)
+    pan_note(chn, pitch);
+}
+
 void dave_chn_distortion(unsigned char c, unsigned char value)
 {
   DaveChannel *chn = dave_channel_ptr(c);
   chn->dist = (unsigned char) (value << 2);
+  chn->env_state |= 0x04;
 }
 
 void dave_assign_channel(unsigned char midi_chn, unsigned char dave_chn)
@@ -397,6 +443,7 @@ void dave_channel_pitch(unsigned char c, unsigned char pb)
 {
   DaveChannel *chn = dave_channel_ptr(c);
   chn->pitch = (chn->pitch & 0xFF00U) | pb;
+  chn->env_state |= 0x04;
 }
 
 static unsigned int pitch_to_dave_freq(unsigned int p) __z88dk_fastcall
@@ -485,6 +532,7 @@ static void set_dave_registers(const DaveRegisters *r) __z88dk_fastcall __naked
   );
 }
 
+#if DAVE_VIRT_CHNS > 4
 static const unsigned char  chn_index_table[8] = {
   4, 5, 4, 5, 6, 7, 0, 1
 };
@@ -510,20 +558,42 @@ static void update_chn_01_index(void)
     } while (dave_channel_ptr(dave_chn1_index)->env_state >= 0x80);
   }
 }
+#else
+/* with 4 virtual channels, dave_chn0_index and dave_chn1_index are always
+ * 0 and 1
+ */
+#define update_chn_01_index()
+#endif
 
 void dave_play(void)
 {
   DaveChannel   *chn = dave_chn;
+  DaveChannelRegisters  *r = dave_chn_regs;
   unsigned char c;
   memset_fast(&dave_regs, 0x00, sizeof(DaveRegisters));
   midi_port_read();
-  for (c = 0; c < DAVE_VIRT_CHNS; c++, chn++) {
+  for (c = 0; c < DAVE_VIRT_CHNS; c++, chn++, r++) {
     if (chn->env_state < 0x80) {
       const unsigned char *p = chn->env_ptr;
       unsigned char vol_l = *p;
       unsigned char *vol;
       unsigned int  *freq;
-      if (vol_l & 0xC0) {
+      if (chn->env_state & 0x08) {
+        /* second frame of a half rate envelope step, the cached registers
+         * are played unless a parameter has changed since the first frame,
+         * or they were not calculated because the channel was not played
+         */
+        chn->env_state = chn->env_state & 0xF7;
+        if (!(chn->env_state & 0x04) &&
+            ((unsigned char *) chn)[13] != 0xFF) {      /* chn->vol_l */
+          p = (unsigned char *) 0;
+        }
+        else {
+          p = p - 4;
+          vol_l = *p;
+        }
+      }
+      else if (vol_l & 0xC0) {
         if (p[1] == 0xFF) {
           dave_channel_off(c);
           continue;
@@ -551,6 +621,9 @@ void dave_play(void)
       }
       else {
         chn->env_ptr = chn->env_ptr + 4;
+        /* bit 7 of vol_r is set on the first frame of a half rate step */
+        if (p[1] & 0x80)
+          chn->env_state = chn->env_state | 0x0C;
       }
       chn->env_timer++;
       if (c == 2) {
@@ -572,12 +645,19 @@ void dave_play(void)
       else {
         continue;
       }
-      if (((unsigned char *) chn)[13] == 0xFF)  /* chn->vol_l */
-        dave_ctrl_update(chn);
-      *vol = volume_mult(((unsigned int) chn->vol_l << 8) | vol_l);
-      vol[4] = volume_mult(((unsigned int) chn->vol_r << 8) | *(++p));
-      p++;
-      *freq = dave_chn_calc_freq(chn, *((const unsigned int *) p));
+      if (p) {
+        if (((unsigned char *) chn)[13] == 0xFF)        /* chn->vol_l */
+          dave_ctrl_update(chn);
+        chn->env_state = chn->env_state & 0xFB;
+        r->volume_l = volume_mult(((unsigned int) chn->vol_l << 8) | vol_l);
+        vol_l = *(++p) & 0x7F;
+        r->volume_r = volume_mult(((unsigned int) chn->vol_r << 8) | vol_l);
+        p++;
+        r->chn_freq = dave_chn_calc_freq(chn, *((const unsigned int *) p));
+      }
+      *vol = r->volume_l;
+      vol[4] = r->volume_r;
+      *freq = r->chn_freq;
     }
   }
   set_dave_registers(&dave_regs);
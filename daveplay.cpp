@@ -31,7 +31,11 @@ static const unsigned int freq_mult_table[9] = {
   52016, 58386, 61858, 63670, 64596, 65065, 65300, 65418, 65477
 };
 
-DavePlay::DavePlay()
+DavePlay::DavePlay(unsigned char nVirtChns_)
+  : nVirtChns(nVirtChns_ > 4 ? DAVE_VIRT_CHNS : 4),
+    voiceBuf((std::vector< unsigned char > *) 0),
+    voiceDelay(0U),
+    voiceEventsEnabled(false)
 {
   initTables();
   loadEnvelopes((unsigned char *) 0, 0);
@@ -76,6 +80,7 @@ void DavePlay::initTables()
 void DavePlay::daveReset()
 {
   std::memset(dave_chn, 0x00, sizeof(dave_chn));
+  std::memset(dave_chn_regs, 0x00, sizeof(dave_chn_regs));
   for (size_t c = 0; c < DAVE_VIRT_CHNS; c++) {
     dave_chn[c].env_state = 0xA0;
     dave_chn[c].pitch = 0x0080;
@@ -123,13 +128,36 @@ void DavePlay::loadEnvelopes(const unsigned char *buf, size_t nBytes)
   envelope_data[sizeof(envelope_data) - 2] = 0x80;
 }
 
+void DavePlay::writeVoiceEvent(unsigned char cmd,
+                               const unsigned char *buf, size_t nBytes)
+{
+  if (!voiceEventsEnabled)
+    return;
+  while (voiceDelay >= 0x4000U) {
+    voiceBuf->push_back(0xFF);          // delta time = 0x3FFF
+    voiceBuf->push_back(0x7F);
+    voiceBuf->push_back(0xFF);          // no operation
+    voiceDelay = voiceDelay - 0x3FFFU;
+  }
+  if (voiceDelay >= 0x80U)
+    voiceBuf->push_back((unsigned char) ((voiceDelay >> 7) | 0x80));
+  voiceBuf->push_back((unsigned char) (voiceDelay & 0x7F));
+  voiceDelay = 0U;
+  voiceBuf->push_back(cmd);
+  for (size_t i = 0; i < nBytes; i++)
+    voiceBuf->push_back(buf[i]);
+}
+
 void DavePlay::dave_channel_release(DaveChannel *chn)
 {
+  writeVoiceEvent(0x08 | (unsigned char) (chn - dave_chn));
   if (chn->env_state & 0x10) {
-    /* release */
-    chn->env_state = 0x60;
-    if (*(chn->env_ptr) >= 0xC0)
+    /* release, a half rate envelope step is finished first, and the hold
+     * frame check is done when its second frame has been played
+     */
+    if (!(chn->env_state & 0x08) && *(chn->env_ptr) >= 0xC0)
       chn->env_ptr = chn->env_ptr + 4;
+    chn->env_state = (chn->env_state & 0x0C) | 0x60;
     chn->env_timer = 0;
   }
   else if (chn != &(dave_chn[3])) {
@@ -140,6 +168,7 @@ void DavePlay::dave_channel_release(DaveChannel *chn)
 
 void DavePlay::dave_channel_off(unsigned char c)
 {
+  writeVoiceEvent(0x10 | c);
   dave_chn[c].env_state = 0xA0;
   dave_chn[c].env_timer = 0;
 }
@@ -206,6 +235,22 @@ void DavePlay::set_channel_params(DaveChannel *chn,
   chn->aftertouch = 0;
 }
 
+void DavePlay::writeVoiceStart(unsigned char c, unsigned int env_pos,
+                               unsigned int pitch, unsigned char veloc,
+                               const unsigned char *ctrls)
+{
+  unsigned char buf[8];
+  buf[0] = (unsigned char) (env_pos & 0xFF);
+  buf[1] = (unsigned char) (env_pos >> 8);
+  buf[2] = (unsigned char) (pitch & 0xFF);
+  buf[3] = (unsigned char) (pitch >> 8);
+  buf[4] = ctrls[0];
+  buf[5] = veloc;
+  buf[6] = ctrls[2];
+  buf[7] = ctrls[3];
+  writeVoiceEvent(0x00 | c, &(buf[0]), 8);
+}
+
 unsigned char DavePlay::dave_channel_on(unsigned char midi_chn,
                                         unsigned char pgm,
                                         unsigned int pitch, unsigned char veloc,
@@ -220,6 +265,7 @@ unsigned char DavePlay::dave_channel_on(unsigned char midi_chn,
   if (midi_chn == 9) {
     chn = &(dave_chn[3]);
     env_pos = drum_env_offsets[(pitch >> 8) & 0x7F];
+    writeVoiceStart(3, env_pos & 0xBFFFU, pitch, veloc, ctrls);
     dave_chn[3].env_state = (unsigned char) (env_pos >> 8) & 0xB0;
     set_channel_params(chn, envelope_data + ((env_pos & 0x0FFF) << 1),
                        pitch, veloc, ctrls);
@@ -229,6 +275,8 @@ unsigned char DavePlay::dave_channel_on(unsigned char midi_chn,
   if (c) {
     if (c < 4)
       chn = &(dave_chn[c - 1]);
+    else if (nVirtChns <= 4)
+      chn = &(dave_chn[c & 1]);
     else
       chn = find_best_channel(c & 1, c & 0xFD, c | 2);
   }
@@ -241,6 +289,8 @@ unsigned char DavePlay::dave_channel_on(unsigned char midi_chn,
 #endif
   }
   env_pos = pgm_env_offsets[pgm & 0x7F];
+  writeVoiceStart((unsigned char) (chn - dave_chn), env_pos, pitch, veloc,
+                  ctrls);
   env_flags = (unsigned char) (env_pos >> 8);
   chn->env_state = env_flags & 0xB0;
   set_channel_params(chn, envelope_data + ((env_pos & 0x0FFF) << 1),
@@ -253,7 +303,9 @@ unsigned char DavePlay::dave_channel_on(unsigned char midi_chn,
 
 void DavePlay::dave_chn_distortion(unsigned char c, unsigned char value)
 {
+  writeVoiceEvent(0x18 | c, &value, 1);
   dave_chn[c].dist = (value & 0x3F) << 2;
+  dave_chn[c].env_state |= 0x04;
 }
 
 void DavePlay::dave_assign_channel(unsigned char midi_chn, unsigned char value)
@@ -263,18 +315,21 @@ void DavePlay::dave_assign_channel(unsigned char midi_chn, unsigned char value)
 
 void DavePlay::dave_chn_set_pan(unsigned char c, unsigned char value)
 {
+  writeVoiceEvent(0x20 | c, &value, 1);
   dave_chn[c].pan = value;
   dave_chn[c].vol_l = 0xFF;
 }
 
 void DavePlay::dave_chn_set_volume(unsigned char c, unsigned char value)
 {
+  writeVoiceEvent(0x28 | c, &value, 1);
   dave_chn[c].vol = value;
   dave_chn[c].vol_l = 0xFF;
 }
 
 void DavePlay::dave_chn_aftertouch(unsigned char c, unsigned char value)
 {
+  writeVoiceEvent(0x30 | c, &value, 1);
   dave_chn[c].veloc += (value - dave_chn[c].aftertouch);
   dave_chn[c].aftertouch = value;
   dave_chn[c].vol_l = 0xFF;
@@ -292,7 +347,9 @@ void DavePlay::dave_ctrl_update(DaveChannel *chn)
 
 void DavePlay::dave_channel_pitch(unsigned char c, unsigned char pb)
 {
+  writeVoiceEvent(0x38 | c, &pb, 1);
   dave_chn[c].pitch = (dave_chn[c].pitch & 0xFF00U) | pb;
+  dave_chn[c].env_state |= 0x04;
 }
 
 unsigned int DavePlay::pitch_to_dave_freq(unsigned int p)
@@ -349,6 +406,8 @@ static const unsigned char  chn_index_table[8] = {
 
 void DavePlay::update_chn_01_index()
 {
+  if (nVirtChns <= 4)
+    return;
   if (dave_chn[0].env_state & dave_chn[4].env_state & dave_chn[6].env_state
       & 0x80) {
     dave_chn0_index = 0;
@@ -373,13 +432,28 @@ void DavePlay::update(unsigned char *dave_regs)
 {
   std::memset(dave_regs, 0x00, 16);
   DaveChannel   *chn = dave_chn;
-  for (unsigned char c = 0; c < DAVE_VIRT_CHNS; c++, chn++) {
+  for (unsigned char c = 0; c < nVirtChns; c++, chn++) {
     if (chn->env_state < 0x80) {
       const unsigned char *p = chn->env_ptr;
       unsigned char vol_l = *p;
       unsigned char *vol_ptr, *freq_ptr;
+      unsigned char *r = &(dave_chn_regs[c][0]);
       unsigned int  freq;
-      if (vol_l & 0xC0) {
+      if (chn->env_state & 0x08) {
+        /* second frame of a half rate envelope step, the cached registers
+         * are played unless a parameter has changed since the first frame,
+         * or they were not calculated because the channel was not played
+         */
+        chn->env_state = chn->env_state & 0xF7;
+        if (!(chn->env_state & 0x04) && chn->vol_l != 0xFF) {
+          p = (unsigned char *) 0;
+        }
+        else {
+          p = p - 4;
+          vol_l = *p;
+        }
+      }
+      else if (vol_l & 0xC0) {
         if (p[1] == 0xFF) {
           dave_channel_off(c);
           continue;
@@ -407,6 +481,9 @@ void DavePlay::update(unsigned char *dave_regs)
       }
       else {
         chn->env_ptr = chn->env_ptr + 4;
+        /* bit 7 of vol_r is set on the first frame of a half rate step */
+        if (p[1] & 0x80)
+          chn->env_state = chn->env_state | 0x0C;
       }
       chn->env_timer++;
       if (c == 2 || c == 3) {
@@ -420,22 +497,31 @@ void DavePlay::update(unsigned char *dave_regs)
       else {
         continue;
       }
-      if (chn->vol_l == 0xFF)
-        dave_ctrl_update(chn);
-      vol_ptr[0] = volume_mult(chn->vol_l, vol_l);
-      vol_ptr[4] = volume_mult(chn->vol_r, p[1]);
-      freq = (unsigned int) p[2] | ((unsigned int) p[3] << 8);
-      freq = dave_chn_calc_freq(chn, freq);
-      freq_ptr[0] = (unsigned char) (freq & 0xFF);
-      freq_ptr[1] = (unsigned char) (freq >> 8);
+      if (p) {
+        if (chn->vol_l == 0xFF)
+          dave_ctrl_update(chn);
+        chn->env_state = chn->env_state & 0xFB;
+        r[0] = volume_mult(chn->vol_l, vol_l);
+        r[1] = volume_mult(chn->vol_r, p[1] & 0x7F);
+        freq = (unsigned int) p[2] | ((unsigned int) p[3] << 8);
+        freq = dave_chn_calc_freq(chn, freq);
+        r[2] = (unsigned char) (freq & 0xFF);
+        r[3] = (unsigned char) (freq >> 8);
+      }
+      vol_ptr[0] = r[0];
+      vol_ptr[4] = r[1];
+      freq_ptr[0] = r[2];
+      freq_ptr[1] = r[3];
     }
   }
   update_chn_01_index();
+  if (voiceBuf)
+    voiceDelay++;
 }
 
 void DavePlay::midiReset()
 {
-  for (unsigned char i = 0; i < DAVE_VIRT_CHNS; i++) {
+  for (unsigned char i = 0; i < nVirtChns; i++) {
     dave_channel_off(i);
     dave_midi_chn[i] = 0xFF;
   }
@@ -535,7 +621,7 @@ void DavePlay::midi_chn_reset_ctrl(unsigned char chn)
   midi_ctrl_state[chn][2] = 64;
   midi_ctrl_state[chn][3] = 127;
   midi_chn_pitch[chn] = (midi_chn_pitch[chn] & 0xFF00U) | 0x80;
-  for (unsigned char c = 0; c < DAVE_VIRT_CHNS; c++) {
+  for (unsigned char c = 0; c < nVirtChns; c++) {
     if (dave_midi_chn[c] == chn) {
       dave_chn_distortion(c, 0x00);
       dave_chn_set_pan(c, 64);
@@ -548,7 +634,7 @@ void DavePlay::midi_chn_reset_ctrl(unsigned char chn)
 void DavePlay::midi_chn_notes_off(unsigned char chn)
 {
   DaveChannel *d = dave_chn;
-  for (unsigned char c = 0; c < DAVE_VIRT_CHNS; c++, d++) {
+  for (unsigned char c = 0; c < nVirtChns; c++, d++) {
     if (dave_midi_chn[c] == chn)
       dave_channel_release(d);
   }
@@ -560,14 +646,14 @@ void DavePlay::midi_control_change(unsigned char chn,
   switch (ctrl) {
   case 7:
     midi_ctrl_state[chn][3] = value;
-    for (unsigned char c = 0; c < DAVE_VIRT_CHNS; c++) {
+    for (unsigned char c = 0; c < nVirtChns; c++) {
       if (dave_midi_chn[c] == chn)
         dave_chn_set_volume(c, value);
     }
     break;
   case 10:
     midi_ctrl_state[chn][2] = value;
-    for (unsigned char c = 0; c < DAVE_VIRT_CHNS; c++) {
+    for (unsigned char c = 0; c < nVirtChns; c++) {
       if (dave_midi_chn[c] == chn)
         dave_chn_set_pan(c, value);
     }
@@ -580,7 +666,7 @@ void DavePlay::midi_control_change(unsigned char chn,
   case 71:
   case 76:
     midi_ctrl_state[chn][0] = value;
-    for (unsigned char c = 0; c < DAVE_VIRT_CHNS; c++) {
+    for (unsigned char c = 0; c < nVirtChns; c++) {
       if (dave_midi_chn[c] == chn)
         dave_chn_distortion(c, value);
     }
@@ -601,7 +687,7 @@ void DavePlay::midi_program_change(unsigned char chn, unsigned char pgm)
 
 void DavePlay::midi_channel_aft(unsigned char chn, unsigned char value)
 {
-  for (unsigned char c = 0; c < DAVE_VIRT_CHNS; c++) {
+  for (unsigned char c = 0; c < nVirtChns; c++) {
     if (dave_midi_chn[c] == chn)
       dave_chn_aftertouch(c, value);
   }
@@ -611,7 +697,7 @@ void DavePlay::midi_pitch_bend(unsigned char chn, unsigned int pbval)
 {
   unsigned char pb = (unsigned char) (pbval >> 6);
   midi_chn_pitch[chn] = (midi_chn_pitch[chn] & 0xFF00U) | pb;
-  for (unsigned char c = 0; c < DAVE_VIRT_CHNS; c++) {
+  for (unsigned char c = 0; c < nVirtChns; c++) {
     if (dave_midi_chn[c] == chn)
       dave_channel_pitch(c, pb);
   }
@@ -624,7 +710,7 @@ void DavePlay::midi_clock()
 void DavePlay::midi_all_notes_off()
 {
   DaveChannel *d = dave_chn;
-  for (unsigned char i = 0; i < DAVE_VIRT_CHNS; i++, d++) {
+  for (unsigned char i = 0; i < nVirtChns; i++, d++) {
     dave_midi_chn[i] = 0xFF;
     dave_channel_release(d);
   }
@@ -648,6 +734,9 @@ void DavePlay::midiEvent(unsigned char st, unsigned char d1, unsigned char d2)
 {
   if (st < 0x80)
     return;
+  // only the changes made by MIDI events are written to the voice stream,
+  // the player does the rest in the same way
+  voiceEventsEnabled = (voiceBuf != (std::vector< unsigned char > *) 0);
   if (st < 0xF0) {
     switch (st & 0xF0) {
     case 0x80:
@@ -692,5 +781,11 @@ void DavePlay::midiEvent(unsigned char st, unsigned char d1, unsigned char d2)
       break;
     }
   }
+  voiceEventsEnabled = false;
 }
 
+void DavePlay::setVoiceBuffer(std::vector< unsigned char > *buf)
+{
+  voiceBuf = buf;
+  voiceDelay = 0U;
+}
@@ -1,13 +1,29 @@
 #ifndef MIDIPLAY_DAVEPLAY_H
 #define MIDIPLAY_DAVEPLAY_H
 
+/* number of virtual channels (4 or 8), with 4 channels, DAVE channels 0 and 1
+ * are not shared by multiple notes, which reduces the polyphony, but also the
+ * CPU time used by dave_play()
+ */
+#ifndef DAVE_VIRT_CHNS
 #define DAVE_VIRT_CHNS  8
+#endif
+
+/* if non-zero, dave_init() calculates the note frequency and pan tables at
+ * run time, otherwise the tables in davetbl.h (generated by midiconv -tables)
+ * are used, which makes the program larger but starts up faster
+ */
+#ifndef DAVE_INIT_TABLES
+#define DAVE_INIT_TABLES        0
+#endif
 
 typedef struct {
   /* b7 = off
    * b6 = releasing
    * b5 = not looped
    * b4 = release enabled
+   * b3 = second frame of a half rate envelope step
+   * b2 = the cached registers need to be recalculated on the second frame
    */
   unsigned char env_state;
   const unsigned char *env_ptr;
@@ -43,6 +59,7 @@ void dave_channel_off(unsigned char c) __z88dk_fastcall;
 unsigned char dave_channel_on(unsigned char midi_chn, unsigned char pgm,
                               unsigned int pitch, unsigned char veloc,
                               const unsigned char *ctrls);
+void dave_channel_start(unsigned char c, const unsigned char *p);
 void dave_chn_distortion(unsigned char c, unsigned char value);
 void dave_assign_channel(unsigned char midi_chn, unsigned char dave_chn);
 void dave_chn_set_pan(unsigned char c, unsigned char value);
@@ -19,8 +19,12 @@
 #ifndef MIDICONV_DAVEPLAY_HPP
 #define MIDICONV_DAVEPLAY_HPP
 
+#include <vector>
+
 class DavePlay {
  protected:
+  // maximum number of virtual channels, the number actually used is set
+  // by the constructor
   static const size_t DAVE_VIRT_CHNS = 8;
   // --------
   struct DaveChannel {
@@ -28,6 +32,8 @@ class DavePlay {
     // b6 = releasing
     // b5 = not looped
     // b4 = release enabled
+    // b3 = second frame of a half rate envelope step
+    // b2 = the cached registers need to be recalculated on the second frame
     unsigned char env_state;
     const unsigned char *env_ptr;
     const unsigned char *env_loop_ptr;
@@ -54,6 +60,12 @@ class DavePlay {
   // sin_table[n] = (int) (sin(n * PI * 0.5 / 255.0) * 181.02 + 0.5)
   unsigned char sin_table[256];
   DaveChannel   dave_chn[DAVE_VIRT_CHNS];
+  // registers calculated on the first frame of a half rate envelope step
+  // (vol_l, vol_r, frequency LSB, MSB), played again on the second frame
+  unsigned char dave_chn_regs[DAVE_VIRT_CHNS][4];
+  // number of virtual channels used (4 or 8), with 4 channels, DAVE
+  // channels 0 and 1 are not shared by multiple notes
+  unsigned char nVirtChns;
   unsigned char midi_dave_chn[16];
   unsigned char dave_chn0_index;        // 0, 4, 6
   unsigned char dave_chn1_index;        // 1, 5, 7
@@ -67,8 +79,20 @@ class DavePlay {
   unsigned int  pgm_env_offsets[128];
   unsigned int  drum_env_offsets[128];
   unsigned char envelope_data[8192];
+  // if not NULL, the changes to the DAVE channels made by midiEvent() are
+  // written to this buffer in the voice stream format (see setVoiceBuffer()),
+  // voiceDelay is the number of frames since the last event written
+  std::vector< unsigned char > *voiceBuf;
+  unsigned int  voiceDelay;
+  bool          voiceEventsEnabled;
   // --------
   void initTables();
+  void writeVoiceEvent(unsigned char cmd,
+                       const unsigned char *buf = (unsigned char *) 0,
+                       size_t nBytes = 0);
+  void writeVoiceStart(unsigned char c, unsigned int env_pos,
+                       unsigned int pitch, unsigned char veloc,
+                       const unsigned char *ctrls);
   static inline unsigned char volume_mult(unsigned char v1, unsigned char v2)
   {
     unsigned int  v = ((unsigned int) v1 * (unsigned int) v2 + 64) >> 7;
@@ -114,13 +138,38 @@ class DavePlay {
   void midi_continue();
   void midi_stop();
  public:
-  DavePlay();
+  DavePlay(unsigned char nVirtChns_ = DAVE_VIRT_CHNS);
   virtual ~DavePlay();
   void daveReset();
   void loadEnvelopes(const unsigned char *buf, size_t nBytes);
   void update(unsigned char *dave_regs);
   void midiReset();
   void midiEvent(unsigned char st, unsigned char d1, unsigned char d2);
+  // write the events resolved to DAVE channels to 'buf' (NULL: disabled),
+  // each event is preceded by the number of update() calls since the
+  // previous one in the same delta time format as MIDI data:
+  //   0x00 | c: start note on channel c, followed by the envelope offset
+  //             and flags (2 bytes), pitch (2 bytes), distortion, velocity,
+  //             pan and volume; the player sets the pan from the pitch if
+  //             flag 0x4000 is set
+  //   0x08 | c: release
+  //   0x10 | c: off
+  //   0x18 | c: distortion, followed by the value
+  //   0x20 | c: pan, followed by the value
+  //   0x28 | c: volume, followed by the value
+  //   0x30 | c: aftertouch, followed by the value
+  //   0x38 | c: pitch bend, followed by the value
+  //   0xFF:     no operation, used for delays longer than 0x3FFF
+  void setVoiceBuffer(std::vector< unsigned char > *buf);
+  // tables calculated by initTables(), in the same format as in the players
+  inline const unsigned int *getOctTable() const
+  {
+    return oct_table;
+  }
+  inline const unsigned char *getSinTable() const
+  {
+    return sin_table;
+  }
 };
 
 #endif  // MIDICONV_DAVEPLAY_HPP
@@ -3,6 +3,25 @@ ENABLE_CHN1_ALLOC       equ     1
 ENABLE_VELOCITY         equ     1
 ;PANNED_NOTE_NEW        equ     1
 
+    if DAVE_INIT_TABLES == 0
+
+; copy the note frequency and pan tables generated by midiconv -tables,
+; the tables are not used directly because oct_table is also the file name
+; buffer and the decompression tables while loading files
+
+        assert  sin_table == (oct_table + 0600h)
+
+dave_init:
+        ld      hl, oct_table_data
+        ld      de, oct_table
+        ld      bc, 0700h
+        ldir
+        jp      dave_reset
+
+        include "davetbl.s"
+
+    else
+
 ; DE = round(DE * HL / 10000h)
 
 dave_oct_mult:
@@ -151,6 +170,8 @@ dave_init:
         inc     c
         jr      nz, .l6
 
+    endif
+
 dave_reset:
         ld      hl, dave_regs
         ld      de, dave_regs + 1
@@ -211,13 +232,18 @@ dave_reset:
 
 dave_channel_release:
         dave_channel_ptr  0
-.l1:    bit     4, (hl)
+.l1:    ld      a, (hl)
+        bit     4, a
         jr      z, .l3
-        ld      (hl), 60h               ; release
+        and     0ch                     ; a half rate envelope step is
+        or      60h                     ; finished first
+        ld      (hl), a                 ; release
         inc     l
         ld      e, (hl)
         inc     l
         ld      d, (hl)                 ; DE = chn->env_ptr
+        bit     3, a
+        jr      nz, .l2                 ; hold frame checked after the step
         ld      a, (de)
         cp      0c0h
         jr      c, .l2
@@ -266,10 +292,11 @@ find_best_channel:
         or      low dave_chn
         ld      ixl, a
         ld      ixh, high dave_chn      ; IX = chn0
-        ld      b, (ix)                 ; chn0->env_state
-        res     4, b                    ; B = chn0->env_state & 0xEF
+        ld      a, (ix)                 ; chn0->env_state
+        and     0e0h
+        ld      b, a                    ; B = chn0->env_state & 0xE0
         ld      a, (hl)                 ; chn1->env_state
-        and     0efh
+        and     0e0h
         cp      b
         jr      c, .l2
         jr      nz, .l1
@@ -285,13 +312,14 @@ find_best_channel:
         and     0f0h
         ld      ixl, a
         ld      l, a
-        ld      b, (hl)
-        res     4, b                    ; B = chn1->env_state & 0xEF
+        ld      a, (hl)
+        and     0e0h
+        ld      b, a                    ; B = chn1->env_state & 0xE0
 .l2:    ld      a, c                    ; c2 * 16
         or      low dave_chn
         ld      l, a                    ; HL = chn2
         ld      a, (hl)                 ; chn2->env_state
-        and     0efh
+        and     0e0h
         cp      b
         ret     c
         ld      b, l
@@ -335,17 +363,26 @@ dave_channel_on:
         rla
         rla
         cp      40h
+    if DAVE_VIRT_CHNS > 4
         jr      nc, .l2
+    else
+        jr      c, .l2
+        and     10h                     ; channels 4 to 7 are mapped to 0, 1
+        add     a, 10h
+.l2:
+    endif
         add     a, low (dave_chn - 16)  ; simple fixed channel
         ld      ixl, a
         ld      ixh, high dave_chn
         jr      .l5
+    if DAVE_VIRT_CHNS > 4
 .l2:    push    bc
         and     10h
         ld      b, a
         or      60h
         ld      c, a
         jr      .l4
+    endif
 .l3:    push    bc
         ld      a, l
         and     01h
@@ -459,6 +496,77 @@ pan_note:
         ld      a, b
         ret
 
+; A = DAVE channel (0 to 7)
+; HL = note parameters: envelope offset and flags (2 bytes), pitch (2 bytes),
+;      distortion, velocity, pan, volume
+; midiconv clears the panned instrument flag for channel 3, so unlike in
+; dave_channel_on, it is not checked here
+;
+; returns HL = address of the byte after the parameters
+
+dave_channel_start:
+        push    ix
+        ld      b, a
+        add     a, a
+        add     a, a
+        add     a, a
+        add     a, a
+        or      low dave_chn
+        ld      ixl, a
+        ld      ixh, high dave_chn      ; IX = chn
+        ld      a, (hl)
+        inc     hl
+        add     a, a
+        ld      (ix + 1), a             ; chn->env_ptr
+        ld      a, (hl)
+        inc     hl
+        ld      c, a
+        rla
+        and     1fh
+        add     a, high envelope_data
+        ld      (ix + 2), a
+        ld      a, c
+        and     0b0h
+        ld      (ix), a                 ; chn->env_state
+        ld      e, (hl)
+        inc     hl
+        ld      d, (hl)                 ; DE = pitch
+        inc     hl
+        ld      (ix + 7), e             ; chn->pitch
+        ld      (ix + 8), d
+        ld      a, (hl)
+        inc     hl
+        add     a, a
+        add     a, a
+        ld      (ix + 10), a            ; chn->dist
+    if ENABLE_VELOCITY == 0
+        ld      (ix + 9), 127           ; chn->veloc
+    else
+        ld      a, (hl)
+        ld      (ix + 9), a
+    endif
+        inc     hl
+        ld      a, (hl)
+        inc     hl
+        ld      (ix + 11), a            ; chn->pan
+        ld      a, (hl)
+        inc     hl
+        ld      (ix + 12), a            ; chn->vol
+        ld      (ix + 13), 0ffh         ; chn->vol_l
+        ld      (ix + 15), 0            ; chn->aftertouch
+        ld      (ix + 5), 0             ; chn->env_timer
+        ld      (ix + 6), 0
+        bit     6, c
+        jr      z, .l1                  ; not using panned instrument?
+        push    hl
+        push    ix
+        pop     hl                      ; HL = chn
+        ld      a, b
+        call    pan_note
+        pop     hl
+.l1:    pop     ix
+        ret
+
 ; A = DAVE channel
 ; B = value
 
@@ -468,6 +576,10 @@ dave_chn_distortion:
         add     a, a
         add     a, a
         ld      (hl), a                 ; chn->dist
+        ld      a, l
+        and     0f0h
+        ld      l, a
+        set     2, (hl)                 ; chn->env_state |= 04h
         ret
 
 ; A = MIDI channel (0 to 15)
@@ -564,6 +676,10 @@ volume_mult:
 dave_channel_pitch:
         dave_channel_ptr  7
         ld      (hl), b                 ; chn->pitch
+        ld      a, l
+        and     0f0h
+        ld      l, a
+        set     2, (hl)                 ; chn->env_state |= 04h
         ret
 
 ; converts MIDI pitch to DAVE frequency in HL
@@ -759,6 +875,34 @@ set_dave_registers:
         jp      nz, .l1
         ret
 
+; write the next 16 byte frame of rendered register data from ring_buf,
+; the registers are not changed if a full frame is not decompressed yet
+
+dave_play_regs:
+        ld      hl, (ring_buf_wr_ptr)
+        ld      de, (ring_buf_rd_ptr)
+        or      a
+        sbc     hl, de
+        ld      a, h
+        and     high (RING_BUF_SIZE - 1)
+        jr      nz, .l1
+        ld      a, l
+        cp      16
+        ret     c
+.l1:    ex      de, hl
+        ld      bc, 109fh
+.l2:    inc     c
+        outi
+        jp      nz, .l2
+        ld      a, h
+        cp      high (ring_buf + RING_BUF_SIZE)
+        jr      nz, .l3
+        ld      h, high ring_buf
+.l3:    ld      (ring_buf_rd_ptr), hl
+        ret
+
+    if DAVE_VIRT_CHNS > 4
+
 update_chn_01_index:
         ld      a, (dave_chn)
         ld      hl, dave_chn + (4 * 16)
@@ -814,7 +958,12 @@ update_chn_01_index:
         ld      (hl), c
         ret
 
+    endif
+
 dave_play:
+        ld      a, (reg_stream_mode)
+        or      a
+        jp      nz, dave_play_regs
         ld      hl, dave_regs
         ld      de, dave_regs + 1
         ld      bc, 15
@@ -827,6 +976,8 @@ dave_play:
 .l1:    ld      a, (ix)                 ; chn->env_state
         or      a
         jp      m, .l3
+        bit     3, a
+        jp      nz, .l16                ; second frame of a half rate step?
         ld      b, a
         ld      l, (ix + 1)
         ld      h, (ix + 2)             ; HL = chn->env_ptr
@@ -856,8 +1007,12 @@ dave_play:
         cp      low (dave_chn + (DAVE_VIRT_CHNS * 16))
         jr      nz, .l1
         pop     ix
+    if DAVE_VIRT_CHNS > 4
         call    set_dave_registers
         jp      update_chn_01_index
+    else
+        jp      set_dave_registers
+    endif
 .l4:    jp      (hl)
 .l5:    ld      l, (ix + 3)             ; end of loop
         ld      h, (ix + 4)             ; HL = chn->env_loop_ptr
@@ -879,25 +1034,33 @@ dave_play:
 .l8:    inc     (ix + 5)                ; chn->env_timer
         jr      nz, .l9
         inc     (ix + 6)
-.l9:    ld      a, ixl
+.l9:    bit     7, d
+        jr      z, .l10                 ; not a half rate step?
+        res     7, d
+        ld      a, (ix)
+        or      0ch                     ; chn->env_state |= 0Ch
+        ld      (ix), a
+.l10:   ld      a, ixl
         and     16 * (DAVE_VIRT_CHNS - 1)
         rra
         rra
         rra
         rra
+    if DAVE_VIRT_CHNS > 4
         cp      2
-        jr      z, .l11                 ; channel 2?
+        jr      z, .l12                 ; channel 2?
         cp      3
-        jr      z, .l11                 ; channel 3?
+        jr      z, .l12                 ; channel 3?
         ld      c, a
         ld      a, (dave_chn0_index)
         cp      c
-        jr      z, .l10                 ; channel 0?
+        jr      z, .l11                 ; channel 0?
         ld      a, (dave_chn1_index)
         cp      c
-        jr      nz, .l3
-.l10:   and     1
-.l11:   or      low (dave_regs + 12)
+        jp      nz, .l3
+.l11:   and     1
+    endif
+.l12:   or      low (dave_regs + 12)
         ld      c, a
         ld      b, high dave_regs
         push    bc
@@ -914,7 +1077,7 @@ dave_play:
         ld      h, (ix + 13)            ; chn->vol_l
         ld      a, h
         inc     a
-        jr      nz, .l12
+        jr      nz, .l14
         push    bc
         ld      l, (ix + 9)             ; chn->veloc
         ld      h, (ix + 12)            ; chn->vol
@@ -940,7 +1103,7 @@ dave_play:
         ld      (ix + 13), h            ; chn->vol_l
         ld      (ix + 14), l            ; chn->vol_r
         pop     bc
-.l12:   ld      l, c                    ; C = vol_l, B = vol_r, H = chn->vol_l
+.l14:   ld      l, c                    ; C = vol_l, B = vol_r, H = chn->vol_l
         call    volume_mult
         ld      c, l
         ld      l, b
@@ -960,5 +1123,117 @@ dave_play:
         ld      (hl), e
         inc     l
         ld      (hl), d
+        bit     3, (ix)
+        jp      z, .l3                  ; not the first frame of a half rate step?
+; first frame of a half rate envelope step (bit 7 of vol_r is set): the
+; registers are also stored to dave_chn_regs, and played from there on the
+; next frame; if the channel is not played, they are calculated on the next
+; frame only if it is played then
+        res     2, (ix)                 ; chn->env_state &= FBh
+        ld      a, ixl
+        and     16 * (DAVE_VIRT_CHNS - 1)
+        rra
+        rra
+        rra
+        rra
+    if DAVE_VIRT_CHNS > 4
+        cp      4
+        jr      c, .l15
+        add     a, 12                   ; channels 4 to 7: second block
+.l15:
+    endif
+        or      low (dave_chn_regs + 12)
+        ld      l, a
+        ld      h, high dave_chn_regs   ; HL = &(dave_chn_regs.volume_r[c])
+        ld      (hl), b
+        res     2, l
+        ld      (hl), c
+        ld      a, l
+        and     3
+        sub     8
+        add     a, l
+        ld      l, a                    ; HL = &(dave_chn_regs.chn_freq[c])
+        ld      (hl), e
+        inc     l
+        ld      (hl), d
+        jp      .l3
+; second frame of a half rate envelope step: the envelope is not updated,
+; and the registers stored in dave_chn_regs are played again, unless the
+; pitch, distortion or a controller has changed, or the registers were not
+; calculated on the first frame
+.l16:   res     3, (ix)                 ; chn->env_state &= F7h
+        inc     (ix + 5)                ; chn->env_timer
+        jr      nz, .l17
+        inc     (ix + 6)
+.l17:   bit     2, (ix)
+        jr      nz, .l18                ; the cached registers are not valid?
+        ld      a, (ix + 13)            ; chn->vol_l
+        inc     a
+        jr      nz, .l19                ; no controller update?
+.l18:   ld      l, (ix + 1)
+        ld      h, (ix + 2)             ; HL = chn->env_ptr
+        dec     hl
+        dec     l
+        dec     l
+        ld      d, (hl)                 ; vol_r of the first frame
+        dec     l
+        ld      e, (hl)                 ; vol_l
+        inc     l
+        inc     l
+        res     7, d
+        jp      .l10
+.l19:   ld      a, ixl
+        and     16 * (DAVE_VIRT_CHNS - 1)
+        rra
+        rra
+        rra
+        rra
+    if DAVE_VIRT_CHNS > 4
+        ld      c, a
+        cp      2
+        jr      z, .l21                 ; channel 2?
+        cp      3
+        jr      z, .l21                 ; channel 3?
+        ld      a, (dave_chn0_index)
+        cp      c
+        jr      z, .l20                 ; channel 0?
+        ld      a, (dave_chn1_index)
+        cp      c
+        jp      nz, .l3
+.l20:   and     1
+.l21:   ld      b, a                    ; B = DAVE channel
+        ld      a, c
+        cp      4
+        jr      c, .l22
+        add     a, 12                   ; channels 4 to 7: second block
+.l22:
+    else
+        ld      b, a
+    endif
+        or      low (dave_chn_regs + 8)
+        ld      l, a
+        ld      h, high dave_chn_regs   ; HL = &(dave_chn_regs.volume_l[c])
+        ld      a, b
+        or      low (dave_regs + 8)
+        ld      e, a
+        ld      d, high dave_regs       ; DE = &(dave_regs.volume_l[c])
+        ld      a, (hl)
+        ld      (de), a
+        set     2, l
+        set     2, e
+        ld      a, (hl)                 ; volume_r
+        ld      (de), a
+        ld      a, l
+        and     3
+        sub     12
+        add     a, l
+        ld      l, a                    ; HL = &(dave_chn_regs.chn_freq[c])
+        ld      a, e
+        and     3
+        sub     12
+        add     a, e
+        ld      e, a                    ; DE = &(dave_regs.chn_freq[c])
+        ldi
+        ldi
         jp      .l3
 
@@ -0,0 +1,134 @@
+
+; generated by midiconv -tables, do not edit
+
+oct_table_data:
+        defw    34323, 34292, 34261, 34230, 34199, 34168, 34137, 34107
+        defw    34076, 34046, 34015, 33984, 33953, 33923, 33892, 33862
+        defw    33831, 33801, 33770, 33740, 33709, 33679, 33648, 33618
+        defw    33588, 33558, 33528, 33498, 33467, 33437, 33407, 33377
+        defw    33346, 33316, 33286, 33256, 33226, 33196, 33166, 33136
+        defw    33106, 33076, 33046, 33017, 32987, 32958, 32928, 32898
+        defw    32868, 32839, 32809, 32780, 32750, 32721, 32691, 32662
+        defw    32632, 32603, 32573, 32544, 32514, 32485, 32455, 32426
+        defw    32397, 32368, 32339, 32310, 32280, 32251, 32222, 32193
+        defw    32164, 32135, 32106, 32077, 32048, 32019, 31990, 31961
+        defw    31932, 31904, 31875, 31846, 31817, 31789, 31760, 31732
+        defw    31703, 31675, 31646, 31618, 31589, 31561, 31532, 31504
+        defw    31475, 31447, 31418, 31390, 31362, 31334, 31306, 31278
+        defw    31249, 31221, 31193, 31165, 31136, 31108, 31080, 31052
+        defw    31024, 30996, 30968, 30940, 30912, 30884, 30856, 30829
+        defw    30801, 30774, 30746, 30718, 30690, 30663, 30635, 30607
+        defw    30578, 30551, 30523, 30496, 30468, 30441, 30413, 30386
+        defw    30358, 30331, 30303, 30276, 30249, 30222, 30195, 30167
+        defw    30139, 30112, 30085, 30058, 30030, 30003, 29976, 29949
+        defw    29922, 29895, 29868, 29841, 29814, 29787, 29760, 29734
+        defw    29707, 29681, 29654, 29627, 29600, 29574, 29547, 29520
+        defw    29493, 29467, 29440, 29414, 29387, 29361, 29334, 29308
+        defw    29281, 29255, 29228, 29202, 29176, 29150, 29123, 29097
+        defw    29071, 29045, 29019, 28993, 28966, 28940, 28914, 28888
+        defw    28862, 28836, 28810, 28784, 28758, 28732, 28706, 28681
+        defw    28655, 28629, 28603, 28578, 28552, 28527, 28501, 28475
+        defw    28448, 28423, 28397, 28372, 28346, 28321, 28295, 28270
+        defw    28244, 28219, 28193, 28168, 28142, 28117, 28091, 28066
+        defw    28040, 28015, 27990, 27965, 27939, 27914, 27889, 27864
+        defw    27838, 27813, 27788, 27763, 27738, 27713, 27688, 27663
+        defw    27638, 27613, 27588, 27563, 27538, 27513, 27488, 27464
+        defw    27439, 27415, 27390, 27365, 27340, 27316, 27291, 27267
+        defw    27242, 27218, 27193, 27169, 27144, 27120, 27095, 27071
+        defw    27046, 27022, 26997, 26973, 26949, 26925, 26900, 26876
+        defw    26851, 26827, 26803, 26779, 26754, 26730, 26706, 26682
+        defw    26658, 26634, 26610, 26586, 26562, 26538, 26514, 26490
+        defw    26466, 26442, 26418, 26395, 26371, 26348, 26324, 26300
+        defw    26276, 26253, 26229, 26205, 26181, 26158, 26134, 26110
+        defw    26086, 26063, 26039, 26016, 25992, 25969, 25945, 25922
+        defw    25899, 25876, 25852, 25829, 25806, 25783, 25760, 25737
+        defw    25713, 25690, 25667, 25644, 25620, 25597, 25574, 25551
+        defw    25528, 25505, 25482, 25459, 25436, 25413, 25390, 25367
+        defw    25344, 25321, 25298, 25276, 25253, 25231, 25208, 25185
+        defw    25162, 25140, 25117, 25094, 25071, 25049, 25026, 25004
+        defw    24981, 24959, 24936, 24914, 24891, 24869, 24846, 24824
+        defw    24801, 24779, 24756, 24734, 24712, 24690, 24668, 24646
+        defw    24623, 24601, 24579, 24557, 24534, 24512, 24490, 24468
+        defw    24446, 24424, 24402, 24380, 24358, 24336, 24314, 24292
+        defw    24270, 24248, 24226, 24205, 24183, 24161, 24139, 24118
+        defw    24096, 24075, 24053, 24031, 24009, 23988, 23966, 23944
+        defw    23922, 23901, 23879, 23858, 23836, 23815, 23793, 23772
+        defw    23750, 23729, 23707, 23686, 23664, 23643, 23621, 23600
+        defw    23579, 23558, 23537, 23516, 23494, 23473, 23452, 23431
+        defw    23410, 23389, 23368, 23347, 23326, 23305, 23284, 23263
+        defw    23241, 23220, 23199, 23178, 23157, 23136, 23115, 23095
+        defw    23074, 23053, 23032, 23012, 22991, 22971, 22950, 22929
+        defw    22908, 22888, 22867, 22847, 22826, 22806, 22785, 22764
+        defw    22743, 22723, 22702, 22682, 22661, 22641, 22620, 22600
+        defw    22579, 22559, 22538, 22518, 22498, 22478, 22457, 22437
+        defw    22417, 22397, 22377, 22357, 22336, 22316, 22296, 22276
+        defw    22256, 22236, 22216, 22196, 22176, 22156, 22136, 22116
+        defw    22096, 22076, 22056, 22036, 22016, 21996, 21976, 21957
+        defw    21937, 21918, 21898, 21878, 21858, 21839, 21819, 21799
+        defw    21779, 21760, 21740, 21721, 21701, 21682, 21662, 21642
+        defw    21622, 21603, 21583, 21564, 21544, 21525, 21505, 21486
+        defw    21467, 21448, 21428, 21409, 21390, 21371, 21351, 21332
+        defw    21312, 21293, 21274, 21255, 21235, 21216, 21197, 21178
+        defw    21159, 21140, 21121, 21102, 21083, 21064, 21045, 21026
+        defw    21006, 20987, 20968, 20949, 20930, 20911, 20892, 20874
+        defw    20855, 20836, 20817, 20799, 20780, 20762, 20743, 20724
+        defw    20705, 20687, 20668, 20649, 20630, 20612, 20593, 20575
+        defw    20556, 20538, 20519, 20501, 20482, 20464, 20445, 20427
+        defw    20409, 20391, 20372, 20354, 20336, 20318, 20299, 20281
+        defw    20262, 20244, 20226, 20208, 20189, 20171, 20153, 20135
+        defw    20116, 20098, 20080, 20062, 20044, 20026, 20008, 19990
+        defw    19971, 19953, 19935, 19917, 19899, 19881, 19863, 19846
+        defw    19828, 19810, 19792, 19775, 19757, 19739, 19721, 19703
+        defw    19685, 19668, 19650, 19632, 19614, 19597, 19579, 19562
+        defw    19544, 19527, 19509, 19492, 19474, 19457, 19439, 19422
+        defw    19404, 19387, 19369, 19352, 19334, 19317, 19299, 19281
+        defw    19263, 19246, 19228, 19211, 19194, 19177, 19159, 19142
+        defw    19125, 19108, 19091, 19074, 19056, 19039, 19022, 19005
+        defw    18987, 18970, 18953, 18936, 18919, 18902, 18885, 18868
+        defw    18851, 18834, 18817, 18800, 18783, 18766, 18749, 18732
+        defw    18715, 18698, 18681, 18665, 18648, 18631, 18614, 18597
+        defw    18580, 18564, 18547, 18530, 18513, 18497, 18480, 18464
+        defw    18447, 18431, 18414, 18398, 18381, 18365, 18348, 18331
+        defw    18314, 18298, 18281, 18265, 18248, 18232, 18215, 18199
+        defw    18182, 18166, 18149, 18133, 18117, 18101, 18084, 18068
+        defw    18051, 18035, 18018, 18002, 17986, 17970, 17954, 17938
+        defw    17921, 17905, 17889, 17873, 17856, 17840, 17824, 17808
+        defw    17792, 17776, 17760, 17744, 17728, 17712, 17696, 17680
+        defw    17664, 17648, 17632, 17616, 17600, 17584, 17568, 17553
+        defw    17537, 17521, 17505, 17490, 17474, 17459, 17443, 17427
+        defw    17411, 17396, 17380, 17364, 17348, 17333, 17317, 17302
+        defw    17286, 17271, 17255, 17240, 17224, 17209, 17193, 17178
+
+sin_table_data:
+        defb    0, 1, 2, 3, 4, 6, 7, 8
+        defb    9, 10, 11, 12, 13, 14, 16, 17
+        defb    18, 19, 20, 21, 22, 23, 24, 26
+        defb    27, 28, 29, 30, 31, 32, 33, 34
+        defb    36, 37, 38, 39, 40, 41, 42, 43
+        defb    44, 45, 47, 48, 49, 50, 51, 52
+        defb    53, 54, 55, 56, 58, 59, 60, 61
+        defb    62, 63, 64, 65, 66, 67, 68, 69
+        defb    70, 71, 72, 73, 74, 75, 76, 77
+        defb    78, 79, 80, 81, 82, 83, 84, 85
+        defb    86, 87, 88, 89, 90, 91, 92, 93
+        defb    94, 95, 96, 97, 98, 99, 99, 100
+        defb    101, 102, 103, 104, 105, 106, 107, 108
+        defb    108, 109, 110, 111, 112, 113, 114, 115
+        defb    115, 116, 117, 118, 119, 120, 120, 121
+        defb    122, 123, 124, 124, 125, 126, 127, 128
+        defb    128, 129, 130, 131, 131, 132, 133, 134
+        defb    135, 135, 136, 137, 138, 138, 139, 140
+        defb    140, 141, 142, 143, 143, 144, 145, 145
+        defb    146, 147, 147, 148, 149, 149, 150, 151
+        defb    151, 152, 153, 153, 154, 155, 155, 156
+        defb    156, 157, 158, 158, 159, 159, 160, 160
+        defb    161, 161, 162, 162, 163, 163, 164, 164
+        defb    165, 165, 166, 166, 167, 167, 167, 168
+        defb    168, 169, 169, 169, 170, 170, 170, 171
+        defb    171, 171, 172, 172, 172, 173, 173, 173
+        defb    174, 174, 174, 174, 175, 175, 175, 175
+        defb    175, 176, 176, 176, 176, 176, 177, 177
+        defb    177, 177, 177, 177, 177, 178, 178, 178
+        defb    178, 178, 178, 178, 178, 178, 178, 178
+        defb    178, 178, 178, 178, 178, 178, 178, 178
+        defb    178, 178, 178, 178, 178, 178, 178, 178
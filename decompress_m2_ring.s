@@ -0,0 +1,241 @@
+
+; resumable version of decompressData for playing rendered DAVE register data
+; ('r' files with transform type 0) while decompressing it: the data is
+; decompressed to ring_buf until the ring buffer is full, and decoding is
+; continued from the saved state on the next call; after the end of the
+; last block, decompression restarts at the beginning of the data
+; NOTE: the compressed data must not contain matches with an offset greater
+; than RING_BUF_SIZE, and the decode tables are shared with decompressData
+; (see decompress_m2_new.s, which must also be included)
+
+        assert  (RING_BUF_SIZE & 0ffh) == 0
+        assert  (ring_buf & 0ffh) == 0
+
+; input parameters:
+;   HL:               compressed data address (including the checksum byte)
+; output parameters:
+;   AF, HL:           undefined
+;   BC, DE, IX, IY:   not changed
+
+ringStreamInit:
+        ld    (ringStreamStart), hl
+
+; restart decompression, and clear the ring buffer
+; NOTE: interrupts must be disabled when calling this
+
+ringStreamRewind:
+        ld    hl, (ringStreamStart)
+        inc   hl                        ; skip checksum byte
+        ld    (ringStreamSrc), hl
+        ld    a, 80h                    ; initialize shift register
+        ld    (ringStreamShiftReg), a
+        xor   a
+        ld    (ringStreamLastBlock), a
+        ld    l, a
+        ld    h, a
+        ld    (ringStreamSymbolsLeft), hl
+        ld    (ringStreamCopyLen), hl
+        ld    (ringStreamCopySrc), hl
+        ld    hl, ring_buf
+        ld    (ring_buf_rd_ptr), hl
+        ld    (ring_buf_wr_ptr), hl
+        ret
+
+; decompress data until the ring buffer is full
+; the read pointer may be changed by the interrupt routine at any time,
+; the write pointer is updated after each byte written
+; output parameters:
+;   AF, BC, DE, HL, AF', BC', DE', HL':   undefined
+;   IX, IY:                               not changed
+
+decompressToRing:
+        ld    de, (ring_buf_wr_ptr)
+        exx
+        ld    hl, (ringStreamSrc)       ; HL' = compressed data read address
+        ld    a, (ringStreamShiftReg)
+        ld    e, a                      ; E' = shift register
+        ld    a, (ringStreamOffs3Code)
+        ld    d, a                      ; D' = prefix size code for len >= 3
+        ld    bc, (ringStreamSymbolsLeft)
+        exx
+.l1:    ld    hl, (ring_buf_rd_ptr)     ; check the space in the ring buffer:
+        scf
+        sbc   hl, de
+        ld    a, h
+        and   high (RING_BUF_SIZE - 1)
+        or    l
+        jr    z, .l18                   ; buffer full ?
+        ld    hl, (ringStreamCopyLen)
+        ld    a, l
+        or    h
+        jr    z, .l6                    ; no pending match or literal data ?
+        dec   hl
+        ld    (ringStreamCopyLen), hl
+        ld    hl, (ringStreamCopySrc)
+        ld    a, l
+        or    h
+        jr    z, .l3                    ; copy from the compressed data ?
+        ld    c, (hl)                   ; copy match data from the ring buffer
+        inc   hl
+        ld    a, h
+        cp    high (ring_buf + RING_BUF_SIZE)
+        jr    nz, .l2
+        ld    h, high ring_buf
+.l2:    ld    (ringStreamCopySrc), hl
+        ld    a, c
+        jr    .l4
+.l3:    exx                             ; copy literal sequence,
+        ld    a, (hl)                   ; or uncompressed block
+        inc   hl
+        exx
+.l4:    ld    (de), a                   ; store decompressed byte
+        inc   de
+        ld    a, d
+        cp    high (ring_buf + RING_BUF_SIZE)
+        jr    nz, .l5
+        ld    d, high ring_buf
+.l5:    ld    (ring_buf_wr_ptr), de
+        jp    .l1
+.l6:    exx
+        ld    a, c                      ; check the data size remaining:
+        or    b
+        jp    z, .l19                   ; end of block ?
+        dec   bc
+        sla   e                         ; read flag bit
+        jr    nz, .l7
+        ld    e, (hl)
+        inc   hl
+        rl    e
+.l7:    jr    c, .l8
+        ld    a, (hl)                   ; literal byte
+        inc   hl
+        exx
+        jr    .l4
+.l8:    ld    a, 0f8h
+.l9:    sla   e                         ; read length prefix bits
+        jr    nz, .l10
+        ld    e, (hl)
+        inc   hl
+        rl    e
+.l10:   jr    nc, .l11                  ; LZ77 match ?
+        inc   a
+        jr    nz, .l9
+        exx                             ; literal sequence:
+        ld    bc, 0811h                 ; 0b1, 0b11111111, 0bxxxxxxxx
+        ld    h, a
+        call  readBits16                ; length is 8-bit value + 17
+        ld    (ringStreamCopyLen), hl
+        ld    hl, 0
+        ld    (ringStreamCopySrc), hl
+        jp    .l1
+.l11:   exx
+        ld    b, low (lengthDecodeTable + 24)
+        call  readEncodedValue          ; decode match length
+        ld    (ringStreamCopyLen), hl
+        ld    c, 0                      ; set C = 0 for read2Bits/readBits
+        or    h                         ; if length <= 255, then A and H are 0
+        jr    nz, .l13                  ; length >= 256 bytes ?
+        dec   l
+        jr    nz, .l12                  ; length > 1 byte ?
+        ld    b, low offs1DecodeTable   ; no, read 2 prefix bits
+        call  read2Bits
+        jr    .l15
+.l12:   dec   l
+        jr    nz, .l13                  ; length > 2 bytes ?
+        ld    b, low offs2DecodeTable   ; no, read 3 prefix bits
+        ld    a, 20h
+        jr    .l14
+.l13:   exx                             ; length >= 3 bytes,
+        ld    a, d                      ; variable prefix size
+        exx
+        ld    b, low offs3DecodeTable
+.l14:   call  readBits
+.l15:   call  readEncodedValue          ; decode match offset
+        ld    a, e                      ; calculate LZ77 match read address
+        sub   l
+        ld    l, a
+        ld    a, d
+        sbc   a, h
+        ld    h, a
+        jr    c, .l16                   ; wrap around to the end of the buffer
+        cp    high ring_buf             ; if the address is before ring_buf
+        jr    nc, .l17
+.l16:   ld    bc, RING_BUF_SIZE
+        add   hl, bc
+.l17:   ld    (ringStreamCopySrc), hl
+        jp    .l1
+.l18:   exx                             ; save decompression state, and return
+        ld    (ringStreamSrc), hl
+        ld    a, e
+        ld    (ringStreamShiftReg), a
+        ld    a, d
+        ld    (ringStreamOffs3Code), a
+        ld    (ringStreamSymbolsLeft), bc
+        exx
+        ret
+.l19:   ld    a, (ringStreamLastBlock)  ; check last block flag:
+        or    a
+        jr    z, .l20                   ; more blocks remaining ?
+        ld    hl, (ringStreamStart)     ; restart at the beginning of the data
+        inc   hl                        ; skip checksum byte
+        ld    e, 80h
+.l20:   xor   a                         ; read block header
+        ld    c, a
+        ld    b, a
+        exx
+        ld    bc, 1001h
+        ld    h, a
+        call  readBits16                ; read the number of symbols (HL)
+        ld    c, 0                      ; set C = 0 for read2Bits/readBits
+        call  read2Bits                 ; read flag bits
+        srl   a
+        ld    (ringStreamLastBlock), a
+        jr    c, .l21                   ; compressed data ?
+        ld    (ringStreamCopyLen), hl   ; uncompressed block
+        ld    hl, 0
+        ld    (ringStreamCopySrc), hl
+        jp    .l1
+.l21:   call  read2Bits                 ; get prefix size for >= 3 byte matches
+        push  de                        ; save decompressed data write address
+        push  hl
+        exx
+        ld    b, a
+        ld    a, 02h                    ; len >= 3 offset slots: 4, 8, 16, 32
+        ld    d, 80h                    ; prefix size codes: 40h, 20h, 10h, 08h
+        inc   b
+.l22:   rlca
+        srl   d                         ; D' = prefix size code for length >= 3
+        djnz  .l22
+        pop   bc                        ; store the number of symbols in BC'
+        exx
+        add   a, nLengthSlots + nOffs1Slots + nOffs2Slots - 3
+        ld    b, a                      ; store total table size - 3 in B
+        ld    hl, decodeTablesBegin     ; initialize decode tables
+.l23:   ld    de, 1
+.l24:   ld    a, 10h                    ; NOTE: C is 0 here, as set above
+        call  readBits
+        ld    (hl), a                   ; store the number of bits to read
+        inc   hl
+        ld    (hl), e                   ; store base value LSB
+        inc   hl
+        ld    (hl), d                   ; store base value MSB
+        inc   hl
+        push  hl
+        ld    hl, 1                     ; calculate 2 ^ nBits
+        jr    z, .l26                   ; readBits sets Z = 1 if A = 0
+.l25:   add   hl, hl
+        dec   a
+        jr    nz, .l25
+.l26:   add   hl, de                    ; calculate new base value
+        ex    de, hl
+        pop   hl
+        ld    a, l
+        cp    low offs1DecodeTable
+        jr    z, .l23                   ; end of length decode table ?
+        cp    low offs2DecodeTable
+        jr    z, .l23                   ; end of offset table for length = 1 ?
+        cp    low offs3DecodeTable
+        jr    z, .l23                   ; end of offset table for length = 2 ?
+        djnz  .l24                      ; continue until all tables are read
+        pop   de                        ; DE = decompressed data write address
+        jp    .l1
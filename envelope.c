@@ -3,6 +3,8 @@
 #include "eplib.h"
 #include "exos.h"
 
+#include <string.h>
+
 unsigned char       envelope_data[ENV_BUF_SIZE];
 unsigned int        pgm_env_offsets[128];
 unsigned int        drum_env_offsets[128];
@@ -363,6 +365,38 @@ unsigned int compile_envelopes(char *file_buf, unsigned int fsize)
   return (unsigned int) (p - envelope_data);
 }
 
+/* returns non-zero if the file is already compiled (midiconv -env format), */
+/* using the same test as midiconv */
+
+static unsigned char is_binary_envelope_file(const unsigned char *buf,
+                                             unsigned int fsize)
+{
+  /* b0 = NUL, b1 = 80 80, b2 = FF FF, b3 = CR or LF */
+  unsigned char flags = 0;
+  for ( ; fsize != 0; fsize--, buf++) {
+    switch (*buf) {
+    case 0x00:
+      flags |= 0x01;
+      break;
+    case 0x80:
+      if (fsize > 1 && buf[1] == 0x80)
+        flags |= 0x02;
+      break;
+    case 0xFF:
+      if (fsize > 1 && buf[1] == 0xFF)
+        flags |= 0x04;
+      break;
+    case '\r':
+    case '\n':
+      flags |= 0x08;
+      break;
+    }
+  }
+  if (!(flags & 0x04))
+    return 0;
+  return (unsigned char) (!(flags & 0x08) || (flags & 0x03) != 0);
+}
+
 void load_envelopes(const char *file_name,
                     unsigned char *file_buf, unsigned int file_buf_size)
 {
@@ -375,6 +409,17 @@ void load_envelopes(const char *file_name,
     error_exit("Invalid envelope file size");
   exos_close_channel(1);
   exos_irq_handler(0);
+  if (is_binary_envelope_file(file_buf, n)) {
+    /* precompiled envelopes can be used without compiling */
+    if (n < (1024 + 6) || n > (1024 + ENV_BUF_SIZE) || (n & 1) != 0)
+      error_exit("Invalid envelope file size");
+    memcpy(midi_pgm_layer2, file_buf, 256);
+    memcpy(midi_drum_layer2, file_buf + 256, 256);
+    memcpy(pgm_env_offsets, file_buf + 512, sizeof(unsigned int) * 128);
+    memcpy(drum_env_offsets, file_buf + 768, sizeof(unsigned int) * 128);
+    memcpy(envelope_data, file_buf + 1024, n - 1024);
+    return;
+  }
   status_message("Compiling envelopes...");
   n = compile_envelopes((char *) file_buf, n);
   status_message((char *) 0);
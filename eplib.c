@@ -353,9 +353,15 @@ void exos_irq_handler(int enabled) __naked
       ".byte 6\n"
       "ret\n"
       "00001$:\n"
+      "dec   a\n"
+      "jr    nz, 00002$\n"
       "rst   0x10\n"
       ".byte 9\n"
       "ret\n"
+      "00002$:\n"
+      "rst   0x10\n"
+      ".byte 18\n"
+      "ret\n"
   );
 }
 
@@ -24,6 +24,10 @@ void status_message(const char *msg);
 void error_exit(const char *msg);
 
 void vsync_wait(void);
+/* 0: the IRQ callback is called on video interrupts, 1: EXOS interrupt
+ * handler only, 2: the IRQ callback and then the EXOS handler, for making
+ * EXOS calls while playing
+ */
 void exos_irq_handler(int enabled);
 void set_irq_callback(void (*func)(void));
 void set_exit_callback(void (*func)(void));
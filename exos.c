@@ -215,6 +215,36 @@ int exos_channel_read_status(unsigned char chn) __naked
   );
 }
 
+unsigned char exos_set_channel_pos(unsigned char chn,
+                                  unsigned long pos) __naked
+{
+  (void) chn;
+  (void) pos;
+  __asm__ (
+      "ld    hl, #-16\n"
+      "add   hl, sp\n"
+      "ld    sp, hl\n"
+      "ex    de, hl\n"
+      "ld    hl, #19\n"
+      "add   hl, sp\n"
+      "push  de\n"
+      "ld    bc, #4\n"
+      "ldir\n"
+      "pop   de\n"
+      "ld    hl, #18\n"
+      "add   hl, sp\n"
+      "ld    a, (hl)\n"
+      "ld    c, #1\n"
+      "rst   0x30\n"
+      ".byte 10\n"
+      "ld    hl, #16\n"
+      "add   hl, sp\n"
+      "ld    sp, hl\n"
+      "ld    l, a\n"
+      "ret\n"
+  );
+}
+
 unsigned char exos_set_variable(unsigned char n, unsigned char value) __naked
 {
   (void) n;
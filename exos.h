@@ -15,6 +15,8 @@ unsigned char exos_special_func(unsigned char chn, unsigned char func,
                                 unsigned char param1, unsigned char param2,
                                 unsigned char param3);
 int exos_channel_read_status(unsigned char chn);
+/* set the file pointer of a channel (EXOS 10) */
+unsigned char exos_set_channel_pos(unsigned char chn, unsigned long pos);
 unsigned char exos_set_variable(unsigned char n, unsigned char value);
 int exos_get_variable(unsigned char n);
 /* status * 256 + segment, < 0: error, > 255: shared */
@@ -1,8 +1,9 @@
 
 midiPlayDataBegin:
 
-DAVE_VIRT_CHNS  equ     8
 ENV_BUF_SIZE    equ     8192
+RING_BUF_SIZE   equ     ENV_BUF_SIZE
+MIDI_MAX_BANKS  equ     64
 FILE_BUF_SIZE   equ     31744
 
 exdosFDCommand:
@@ -28,6 +29,9 @@ errMsg_envNotFound:
 errMsg_envInvalid:
         defm    "Invalid envelope data size"
         defb    0
+errMsg_envDict:
+        defm    "MIDI file requires a different ENVELOPE.BIN"
+        defb    0
 errMsg_midiNotFound:
         defm    "Error opening MIDI file"
         defb    0
@@ -37,9 +41,21 @@ errMsg_midiInvalid:
 errMsg_midiReadErr:
         defm    "Error reading MIDI file"
         defb    0
+    if DAVE_VIRT_CHNS < 8
+errMsg_voiceChns:
+        defm    "Voice data requires more DAVE channels"
+        defb    0
+    endif
+    if DISPLAY_ENABLED == 0
+errMsg_midiNoMemory:
+        defm    "Not enough memory for MIDI data"
+        defb    0
+    endif
 
+    if DAVE_INIT_TABLES != 0
 msg_creatingTables:
         defm    "Creating tables..."
+    endif
 msg_clear:
         defb    0
 
@@ -89,6 +105,10 @@ drum_env_offsets:
 envelope_data:
         block   ENV_BUF_SIZE, 0ffh
 
+; rendered DAVE register data is decompressed to the envelope buffer while
+; playing, it is not used in this mode
+ring_buf        equ     envelope_data
+
         align   256
 
 ; midi_key_state[chn][key] = DAVE channel assigned + 1, or 0 if key not pressed
@@ -137,6 +157,13 @@ dave_regs:
 
         align   32
 
+; registers calculated on the first frame of a half rate envelope step, in
+; the same format as dave_regs, channels 0 to 3 and 4 to 7 in separate blocks
+dave_chn_regs:
+        block   DAVE_VIRT_CHNS * 4, 00h
+
+        align   32
+
 poly4_offs_table_15:
         defb      0,   0, 255,   0, 255,   1,   0,   0
         defb    255,   1,   0,   1,   0,   0,   1,   0
@@ -157,10 +184,12 @@ midi_evt_handlers:
         defw    midi_program_change, midi_channel_aft   ; C0h, D0h
         defw    midi_pitch_bend, midi_unused            ; E0h, F0h
 
+    if DAVE_VIRT_CHNS > 4
         align   8
 
 chn_index_table:
         defb    4, 5, 4, 5, 6, 7, 0, 1
+    endif
 
 ; 0, 4, 6
 dave_chn0_index:
@@ -171,10 +200,12 @@ dave_chn1_index:
 
         align   2
 
+    if DAVE_INIT_TABLES != 0
 ; freq_mult_table[n] =
 ;     (unsigned int) (65536.0 * pow(0.5, 1.0 / (3.0 * (1 << n))) + 0.5)
 freq_mult_table:
         defw    52016, 58386, 61858, 63670, 64596, 65065, 65300, 65418, 65477
+    endif
 
         align   2
 file_buf_ptr:
@@ -218,6 +249,9 @@ no_file_chooser:
         align   2
 midi_port_read:
         defw    0
+; midi_read_file or midi_read_voice, depending on the file type
+midi_file_reader:
+        defw    0
 midi_file_buf:
         defw    0
 midi_file_end:
@@ -228,6 +262,54 @@ midi_delta_time:
         defw    0
 midi_prv_status:
         defb    0
+; non-zero if playing rendered DAVE register data from ring_buf
+reg_stream_mode:
+        defb    0
+
+        align   2
+ring_buf_rd_ptr:
+        defw    ring_buf
+ring_buf_wr_ptr:
+        defw    ring_buf
+ringStreamStart:
+        defw    0
+ringStreamSrc:
+        defw    0
+ringStreamSymbolsLeft:
+        defw    0
+ringStreamCopyLen:
+        defw    0
+; 0: copy from the compressed data
+ringStreamCopySrc:
+        defw    0
+ringStreamShiftReg:
+        defb    80h
+ringStreamOffs3Code:
+        defb    0
+ringStreamLastBlock:
+        defb    0
+
+    if DISPLAY_ENABLED == 0
+; MIDI data banks are mapped to page 3 while playing, the number of banks is
+; 0 if the MIDI data is in file_buf
+midi_bank_cnt:
+        defb    0
+midi_bank_cur:
+        defb    0
+; segment of the current bank, or 0 if not banked
+midi_bank_segment:
+        defb    0
+midi_bank_segments:
+        block   MIDI_MAX_BANKS, 00h
+
+        align   2
+midi_bank_sizes:
+        block   MIDI_MAX_BANKS * 2, 00h
+    endif
 
 midiPlayDataEnd:
 
+    if DISPLAY_ENABLED == 0
+        assert  midiPlayDataEnd <= 0c000h
+    endif
+
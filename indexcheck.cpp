@@ -0,0 +1,355 @@
+// indexcheck: plays random MIDI data with the index written by
+// addMIDIDataIndex() in a model of the C player (midi_in.c), and checks
+// that every event is played at its own frame number and time, including
+// after the loop and after seeking to any index entry
+
+#include <cstdio>
+#include <cstdlib>
+
+#define MIDICONV_NO_MAIN    1
+
+#include "midiconv.cpp"
+
+static unsigned int randomState = 1U;
+
+static unsigned int randomNumber(unsigned int n)
+{
+  // returns a random number in the range 0 to n - 1
+  randomState = randomState * 1103515245U + 12345U;
+  unsigned int  tmp = (randomState >> 16) & 0x7FFFU;
+  randomState = randomState * 1103515245U + 12345U;
+  tmp = (tmp << 15) | ((randomState >> 16) & 0x7FFFU);
+  return (n > 1U ? (tmp % n) : 0U);
+}
+
+// the frame and MIDI data position (after the delta time) of each event
+
+struct TestEvent {
+  long    frame;
+  size_t  pos;
+};
+
+// writes an 'm' file with a dummy envelope block and 'nEvents' random
+// events to 'outBuf'
+
+static void createTestData(std::vector< unsigned char >& outBuf,
+                           std::vector< TestEvent >& events, size_t nEvents)
+{
+  const size_t  envSize = 1024 + 6;
+  outBuf.clear();
+  outBuf.resize(16 + envSize, 0x00);
+  outBuf[1] = 'm';
+  outBuf[4] = (unsigned char) (envSize & 0xFF);
+  outBuf[5] = (unsigned char) (envSize >> 8);
+  events.clear();
+  long    f = 0L;
+  for (size_t i = 0; i < nEvents; i++) {
+    unsigned int  dTime = 0U;
+    switch (randomNumber(4U)) {
+    case 0:
+      dTime = randomNumber(2U);
+      break;
+    case 1:
+    case 2:
+      dTime = randomNumber(64U);
+      break;
+    default:
+      dTime = randomNumber(400U);
+      break;
+    }
+    if (dTime >= 0x80U)
+      outBuf.push_back((unsigned char) ((dTime >> 7) | 0x80U));
+    outBuf.push_back((unsigned char) (dTime & 0x7FU));
+    f = f + long(dTime);
+    TestEvent e;
+    e.frame = f;
+    e.pos = outBuf.size() - (16 + envSize);
+    events.push_back(e);
+    unsigned char c = (unsigned char) randomNumber(16U);
+    switch (randomNumber(5U)) {
+    case 0:
+      outBuf.push_back(0xC0 | c);
+      outBuf.push_back((unsigned char) randomNumber(128U));
+      break;
+    case 1:
+      outBuf.push_back(0xB0 | c);
+      outBuf.push_back((unsigned char) (randomNumber(2U) ? 7 : 10));
+      outBuf.push_back((unsigned char) randomNumber(128U));
+      break;
+    case 2:
+      outBuf.push_back(0xE0 | c);
+      outBuf.push_back((unsigned char) randomNumber(128U));
+      outBuf.push_back((unsigned char) randomNumber(128U));
+      break;
+    default:
+      outBuf.push_back(0x90 | c);
+      outBuf.push_back((unsigned char) randomNumber(128U));
+      outBuf.push_back((unsigned char) randomNumber(128U));
+      break;
+    }
+  }
+  outBuf[6] = (unsigned char) ((outBuf.size() - (16 + envSize)) & 0xFF);
+  outBuf[7] = (unsigned char) ((outBuf.size() - (16 + envSize)) >> 8);
+  outBuf[2] = (unsigned char) ((outBuf.size() - 16) & 0xFF);
+  outBuf[3] = (unsigned char) ((outBuf.size() - 16) >> 8);
+}
+
+// the state of the player in midi_in.c that is relevant to the timing
+
+class PlayerModel {
+ private:
+  const unsigned char *midiData;
+  const unsigned char *index;
+  size_t  midiSize;
+  size_t  filePtr;
+  size_t  fileEnd;
+  unsigned int  deltaTime;
+  unsigned int  loopDTime;
+  unsigned long fileFrame;
+  unsigned long loopFrame;
+  unsigned int  loopWait;
+  unsigned char prvStatus;
+  static unsigned int readWord(const unsigned char *p)
+  {
+    return ((unsigned int) p[0] | ((unsigned int) p[1] << 8));
+  }
+  void dtime()
+  {
+    if (filePtr >= fileEnd) {
+      if (loopDTime != 0xFFFFU) {
+        unsigned long frame = fileFrame;
+        restore(index + 8);
+        if (loopDTime) {
+          loopFrame = fileFrame;
+          loopWait = loopDTime;
+          fileFrame = frame;
+          deltaTime = deltaTime + loopDTime;
+        }
+        else {
+          fileFrame++;
+        }
+        return;
+      }
+      filePtr = 0;
+      deltaTime = 0;
+      prvStatus = 0x00;
+      fileFrame = 1UL;
+      loopWait = 0;
+    }
+    unsigned int  dt = midiData[filePtr++];
+    if (dt & 0x80)
+      dt = (((dt & 0x7F) << 8) >> 1) | midiData[filePtr++];
+    deltaTime = dt;
+  }
+ public:
+  // positions of the events played during the last call to readFile()
+  std::vector< size_t > eventsPlayed;
+  // --------
+  PlayerModel(const std::vector< unsigned char >& buf)
+  {
+    size_t  envSize = size_t(buf[4]) | (size_t(buf[5]) << 8);
+    midiSize = size_t(buf[6]) | (size_t(buf[7]) << 8);
+    midiData = &(buf.front()) + (16 + envSize);
+    index = midiData + midiSize;
+    if ((buf[12] | buf[13]) == 0)
+      errorMessage("the index is missing");
+    fileEnd = midiSize;
+    loopDTime = 0xFFFFU;
+    if (readWord(index + 4)) {
+      fileEnd = readWord(index + 4);
+      loopDTime = readWord(index + 6);
+    }
+    filePtr = 0;
+    deltaTime = 0;
+    prvStatus = 0x00;
+    loopWait = 0;
+    dtime();
+    fileFrame = 0UL;
+  }
+  size_t indexEntries() const
+  {
+    return readWord(index);
+  }
+  unsigned int indexFrames() const
+  {
+    return readWord(index + 2);
+  }
+  unsigned long position() const
+  {
+    return fileFrame;
+  }
+  // midi_file_restore()
+  void restore(const unsigned char *p)
+  {
+    filePtr = readWord(p);
+    deltaTime = readWord(p + 2);
+    fileFrame = (unsigned long) p[4] | ((unsigned long) p[5] << 8)
+                | ((unsigned long) p[6] << 16);
+    loopWait = 0;
+    prvStatus = p[7];
+  }
+  // midi_file_seek()
+  void seek(unsigned long frame)
+  {
+    size_t  n = indexEntries() - 1;
+    if ((frame / indexFrames()) < n)
+      n = size_t(frame / indexFrames());
+    restore(index + (8 + 104 + (n * 104)));
+  }
+  // midi_read_file(), called once per frame
+  void readFile()
+  {
+    eventsPlayed.clear();
+    if (loopWait) {
+      if (!(--loopWait))
+        fileFrame = loopFrame;
+    }
+    fileFrame++;
+    if (deltaTime) {
+      deltaTime--;
+      return;
+    }
+    do {
+      eventsPlayed.push_back(filePtr);
+      unsigned char st = midiData[filePtr++];
+      if (st >= 0x80) {
+        prvStatus = st;
+        filePtr++;
+      }
+      if ((prvStatus & 0xE0) != 0xC0)
+        filePtr++;
+      dtime();
+    } while (!deltaTime);
+    deltaTime--;
+  }
+};
+
+// plays 'nFrames' frames starting from 'startFrame', and checks that each
+// event is played at its frame in the MIDI data, and that the position
+// reported by the player is the frame just played; after the loop end,
+// the frames continue from 'loopEnd' - 'loopFrames'
+
+static void playAndCheck(PlayerModel& player,
+                         const std::vector< TestEvent >& events,
+                         long startFrame, long loopEnd, long loopFrames,
+                         long nFrames)
+{
+  std::map< size_t, size_t >  eventIndex;
+  for (size_t i = 0; i < events.size(); i++)
+    eventIndex[events[i].pos] = i;
+  long    t = startFrame;
+  size_t  prvEvent = 0;
+  bool    firstEvent = true;
+  for (long i = 0L; i < nFrames; i++) {
+    player.readFile();
+    for (size_t j = 0; j < player.eventsPlayed.size(); j++) {
+      std::map< size_t, size_t >::const_iterator  k =
+          eventIndex.find(player.eventsPlayed[j]);
+      if (k == eventIndex.end())
+        errorMessage("event position %lu is invalid",
+                     (unsigned long) player.eventsPlayed[j]);
+      long    f = events[k->second].frame;
+      if (!firstEvent && k->second <= prvEvent) {
+        // continued from the loop start
+        if (f < (loopEnd - loopFrames))
+          errorMessage("event at frame %ld played after the loop", f);
+        t = t - loopFrames;
+      }
+      else if (f > loopEnd || (f == loopEnd && f != events.back().frame)) {
+        errorMessage("event at frame %ld played after the loop end", f);
+      }
+      prvEvent = k->second;
+      firstEvent = false;
+      if ((t + i) != f)
+        errorMessage("event at frame %ld played at frame %ld", f, t + i);
+    }
+    long    pos = startFrame + i + 1L;
+    while (pos > loopEnd)
+      pos = pos - loopFrames;
+    if (long(player.position()) != pos)
+      errorMessage("position is %lu instead of %ld at frame %ld",
+                   player.position(), pos, startFrame + i);
+  }
+}
+
+static void checkIndex(size_t nEvents, long indexFrames, bool loopEnabled)
+{
+  std::vector< unsigned char >  outBuf;
+  std::vector< TestEvent >  events;
+  createTestData(outBuf, events, nEvents);
+  long    songLength = events.back().frame;
+  if (songLength < 1L)
+    return;
+  long    loopStart = -1L;
+  long    loopEnd = -1L;
+  if (loopEnabled) {
+    switch (randomNumber(4U)) {
+    case 0:
+      break;
+    case 1:
+      loopStart = long(randomNumber((unsigned int) songLength / 2U));
+      break;
+    case 2:
+      loopEnd = songLength + long(randomNumber(300U));
+      break;
+    default:
+      loopStart = long(randomNumber((unsigned int) songLength / 2U));
+      loopEnd = loopStart + 1L
+                + long(randomNumber((unsigned int) (songLength + 300L
+                                                    - loopStart)));
+      break;
+    }
+    if (loopStart < 0L && loopEnd < 0L)
+      loopStart = 0L;
+  }
+  try {
+    addMIDIDataIndex(outBuf, indexFrames, loopStart, loopEnd);
+  }
+  catch (std::exception& e) {
+    // the loop points may be invalid, and delta times out of range
+    (void) e;
+    return;
+  }
+  // without a loop end, the loop is at the last event, and without a loop
+  // the song is restarted from the beginning at the same frame
+  if (loopStart < 0L)
+    loopStart = 0L;
+  if (loopEnd < 0L)
+    loopEnd = songLength;
+  long    loopFrames = loopEnd - loopStart;
+  long    playFrames = loopEnd + (loopFrames * 3L) + 1L;
+  {
+    PlayerModel player(outBuf);
+    playAndCheck(player, events, 0L, loopEnd, loopFrames, playFrames);
+  }
+  PlayerModel player(outBuf);
+  for (size_t i = 0; i < player.indexEntries(); i++) {
+    unsigned long frame = (unsigned long) i * (unsigned long) indexFrames;
+    player.seek(frame);
+    if (player.position() != frame)
+      errorMessage("index entry %lu is at frame %lu",
+                   (unsigned long) i, player.position());
+    playAndCheck(player, events, long(frame), loopEnd, loopFrames,
+                 loopFrames * 2L);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int     nTests = 1000;
+  if (argc > 1)
+    nTests = std::atoi(argv[1]);
+  try {
+    for (int i = 0; i < nTests; i++) {
+      size_t  nEvents = size_t(randomNumber(200U)) + 2;
+      long    indexFrames = long(randomNumber(500U)) + 1L;
+      checkIndex(nEvents, indexFrames, bool(i & 1));
+    }
+  }
+  catch (std::exception& e) {
+    std::fprintf(stderr, " *** indexcheck: %s\n", e.what());
+    return -1;
+  }
+  std::printf("indexcheck: %d tests passed\n", nTests);
+  return 0;
+}
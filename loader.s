@@ -80,13 +80,17 @@ vsyncWait:
         jr      nz, .l2
         ret
 
+; the video interrupt latch is not reset when switching handlers, so that
+; a pending interrupt is not lost (setIRQHandler and setIRQHandlerShared are
+; called before and after reading each block of a streamed MIDI file)
+
 setIRQHandler:
         di
         ld      a, 0c3h                 ; = JP nn
         ld      hl, irqRoutine
         ld      (0038h), a
         ld      (0039h), hl
-        ld      a, 30h                  ; video interrupt only
+        ld      a, 10h                  ; video interrupt only
         out     (0b4h), a
         ei
         ret
@@ -102,10 +106,55 @@ restoreIRQHandler:
         ei
         ret
 
+; the IRQ callback is called on video interrupts, followed by the EXOS
+; handler, so that EXOS calls can be made while playing (e.g. to read the
+; blocks of a streamed MIDI file) without disabling the 1 Hz and EXOS device
+; interrupts; the displacement at 003Bh is not changed by setIRQHandler
+
+setIRQHandlerShared:
+        di
+        ld      a, (003bh)
+        ld      l, a
+        rla
+        sbc     a, a
+        ld      h, a
+        ld      de, 003ch
+        add     hl, de
+        ld      (irqRoutineShared.l1 + 1), hl
+        ld      a, 0c3h                 ; = JP nn
+        ld      hl, irqRoutineShared
+        ld      (0038h), a
+        ld      (0039h), hl
+        ld      a, 1ch                  ; video + 1 Hz interrupt
+        out     (0b4h), a
+        ei
+        ret
+
+; the interrupt may also occur during EXOS calls (e.g. while loading a
+; streamed MIDI file), so a separate stack is used, and all pages are mapped
+
 irqRoutine:
         push    af
         ld      a, 30h
         out     (0b4h), a
+        call    irqPlay
+        pop     af
+        ei
+        ret
+
+irqRoutineShared:
+        push    af
+        in      a, (0b4h)
+        and     20h                     ; video interrupt latch
+        call    nz, irqPlay
+        pop     af
+        push    af                      ; = PUSH AF, SCF of the EXOS handler
+        scf
+.l1:    jp      0000h                   ; * JR +d target of the EXOS handler
+
+irqPlay:
+        ld      (irqSavedSP), sp
+        ld      sp, irqStackTop
         push    bc
         push    de
         push    hl
@@ -116,12 +165,18 @@ irqRoutine:
         in      a, (0b2h)
         ld      h, a
         push    hl
+        in      a, (0b3h)
+        push    af
         ld      hl, (page1Segment)
         ld      a, l
         out     (0b1h), a
         ld      a, h
         out     (0b2h), a
+        ld      a, (page3Segment)
+        out     (0b3h), a
 .l1:    call    .l2                     ; * irqCallback
+        pop     af
+        out     (0b3h), a
         pop     hl
         ld      a, l
         out     (0b1h), a
@@ -132,11 +187,10 @@ irqRoutine:
         pop     hl
         pop     de
         pop     bc
-        pop     af
-        ei
+        ld      sp, (irqSavedSP)
 .l2:    ret
 
-irqCallback     equ     irqRoutine.l1 + 1
+irqCallback     equ     irqPlay.l1 + 1
 
 resetRoutine:
         di
@@ -153,8 +207,8 @@ resetRoutine:
         outi
         inc     c
         outi
-.l1:    ld      hl, irqRoutine.l2       ; * exitCallback
-        ld      de, irqRoutine.l2
+.l1:    ld      hl, irqPlay.l2       ; * exitCallback
+        ld      de, irqPlay.l2
         ld      (exitCallback), de
         call    .l2
         ld      a, 0ffh
@@ -173,7 +227,7 @@ setIRQCallback:
         ld      a, l
         or      h
         jr      nz, .l1
-        ld      hl, irqRoutine.l2
+        ld      hl, irqPlay.l2
 .l1:    ld      (irqCallback), hl
         ret
 
@@ -181,7 +235,7 @@ setExitCallback:
         ld      a, l
         or      h
         jr      nz, .l1
-        ld      hl, irqRoutine.l2
+        ld      hl, irqPlay.l2
 .l1:    ld      (exitCallback), hl
         ret
 
@@ -220,6 +274,7 @@ rst10Handler:
         jp      restoreIRQHandler       ; RST 10H  9
         jp      setIRQCallback          ; RST 10H 12
         jp      setExitCallback         ; RST 10H 15
+        jp      setIRQHandlerShared     ; RST 10H 18
 
 ; -----------------------------------------------------------------------------
 
@@ -270,6 +325,11 @@ page2Segment:
         defb    00h
 page3Segment:
         defb    00h
+irqSavedSP:
+        defw    0000h
+irqStack:
+        block   512, 00h
+irqStackTop:
 
         assert  $ <= (STACK_TOP - 1024)
 
@@ -6,6 +6,11 @@
 static unsigned char  file_buf[31744];
 static unsigned char  no_file_chooser = 0;
 
+/* F2 and F3 seek backward and forward by this number of IRQ frames */
+#define SEEK_FRAMES     500
+/* while playing MIDI input, F2 and F3 change midi_in_budget up to this */
+#define MIDI_IN_BUDGET_MAX      99
+
 static unsigned char load_midi_file(void)
 {
   char    name_buf[256];
@@ -19,24 +24,85 @@ static unsigned char load_midi_file(void)
   return midi_file_load(name_buf, file_buf, sizeof(file_buf));
 }
 
+/* show the MIDI input event limit and the number of buffer overflows */
+
+static void midi_in_status(unsigned int overflows)
+{
+  char    buf[48];
+  sprintf_simple(buf, "MIDI in limit: %u, overflows: %u",
+                 (unsigned int) midi_in_budget, overflows);
+  status_message(buf);
+}
+
 int main(void)
 {
-  unsigned char fkeys;
+  unsigned char fkeys, prv_fkeys = 0xFF;
+  unsigned char midi_input;
+  unsigned int  overflows, prv_overflows;
+  unsigned char prv_budget;
   do {
-    if (!load_midi_file())
+    midi_input = !load_midi_file();
+    if (midi_input)
       load_envelopes("envelope.txt", file_buf, sizeof(file_buf));
     exos_irq_handler(0);
+#if DAVE_INIT_TABLES
     status_message("Creating tables...");
+#endif
     dave_init();
+#if DAVE_INIT_TABLES
     status_message((char *) 0);
+#endif
     midi_reset();
+    prv_overflows = 0xFFFFU;
+    prv_budget = 0xFF;
     set_irq_callback(&dave_play);
     do {
       __asm__ (
           "halt\n"
       );
+      midi_file_stream_update();
+      if (midi_input) {
+        /* the counter is updated by the IRQ callback */
+        do {
+          overflows = midi_in_overflows;
+        } while (overflows != midi_in_overflows);
+        if (overflows != prv_overflows || midi_in_budget != prv_budget) {
+          prv_overflows = overflows;
+          prv_budget = midi_in_budget;
+          midi_in_status(overflows);
+        }
+      }
       dave_keyboard_port = 4;
-      fkeys = (dave_keyboard_port ^ 0xFF) & 0x8B;
+      fkeys = dave_keyboard_port ^ 0xFF;
+      if (fkeys & (prv_fkeys ^ 0xFF) & 0x74) {
+        set_irq_callback((void (*)(void)) 0);
+        if (fkeys & 0x30) {
+          /* F5, F7: next or previous song of a bank file */
+          midi_file_next_song(fkeys & 0x20);
+        }
+        else if (midi_input) {
+          if (fkeys & 0x04) {
+            if (midi_in_budget < MIDI_IN_BUDGET_MAX)
+              midi_in_budget++;
+          }
+          else if (midi_in_budget) {
+            midi_in_budget--;
+          }
+        }
+        else {
+          unsigned long pos = midi_file_position();
+          if (fkeys & 0x04)
+            pos = pos + SEEK_FRAMES;
+          else if (pos >= SEEK_FRAMES)
+            pos = pos - SEEK_FRAMES;
+          else
+            pos = 0UL;
+          midi_file_seek(pos);
+        }
+        set_irq_callback(&dave_play);
+      }
+      prv_fkeys = fkeys;
+      fkeys = fkeys & 0x8B;
       if (fkeys) {
         set_irq_callback((void (*)(void)) 0);
         if (fkeys & 0x09) {
@@ -49,6 +115,8 @@ int main(void)
       }
     } while (!(fkeys & 0x82));
     midi_reset();
+    if (midi_input)
+      status_message((char *) 0);
   } while (!(fkeys & 0x02));
   return 0;
 }
@@ -4,6 +4,8 @@
 #include "eplib.h"
 #include "exos.h"
 
+#include <string.h>
+
 unsigned char         midi_ctrl_state[16][4];
 static unsigned char  midi_key_state[2048];
 static unsigned int   midi_chn_pitch[16];
@@ -17,6 +19,8 @@ unsigned char         midi_drum_layer2[256];
 
 static void midi_read_hw(void);
 static void midi_read_file(void);
+static void midi_read_voice(void);
+static void midi_read_stalled(void);
 
 void (*midi_port_read)(void) = &midi_read_hw;
 
@@ -25,6 +29,66 @@ static const unsigned char  *midi_file_end;
 static const unsigned char  *midi_file_ptr;
 static unsigned int   midi_delta_time;
 static unsigned char  midi_prv_status;
+static void (*midi_file_reader)(void);
+/* number of frames played since the start of the song */
+static unsigned long  midi_file_frame;
+
+/* events read from the MIDI input are stored in a ring buffer with the frame
+ * of arrival, and at most midi_in_budget of them are played per frame, unless
+ * they have already been delayed by MIDI_IN_MAX_DELAY frames; a controller or
+ * pitch bend event replaces the value of a pending one of the same type if
+ * there is no other event on the same channel after it
+ */
+
+#define MIDI_IN_BUF_SIZE        64      /* number of events, power of 2 */
+#define MIDI_IN_MAX_DELAY       4
+
+unsigned char         midi_in_budget = 8;
+volatile unsigned int midi_in_overflows = 0;
+static unsigned char  midi_in_buf[MIDI_IN_BUF_SIZE][4];
+static unsigned char  midi_in_rd_pos = 0;
+static unsigned char  midi_in_wr_pos = 0;
+static unsigned char  midi_in_frame = 0;
+
+/* the optional index of 'm' files (see addMIDIDataIndex() in midiconv.cpp)
+ * stores the state of the MIDI channels at regular intervals and at the loop
+ * start, so that playback can continue from these positions without
+ * processing the events before them
+ */
+
+#define MIDI_INDEX_ENTRY_SIZE   104
+
+static const unsigned char  *midi_index = (unsigned char *) 0;
+static unsigned int   midi_index_entries;
+static unsigned int   midi_index_frames;
+static unsigned int   midi_loop_dtime;          /* 0xFFFF: no loop */
+/* at the loop end, midi_file_frame jumps to the loop start frame only after
+ * the remaining delay (midi_loop_dtime) has been played
+ */
+static unsigned long  midi_loop_frame;
+static unsigned int   midi_loop_wait = 0;
+
+/* streamed files ('m' or 'v' type with a block size in the header) are read
+ * in blocks of midi_stream_blk_size bytes to the two halves of the file
+ * buffer, the main loop loads the next block while the other one is played;
+ * each block begins with the data size, bit 15 is set in the last block
+ */
+
+static unsigned int   midi_stream_blk_size = 0;         /* 0: not streamed */
+static unsigned char  *midi_stream_bufs[2];
+static volatile unsigned char midi_stream_ready[2];
+static volatile unsigned char midi_stream_cur;
+static unsigned char  midi_stream_last;
+static unsigned char  midi_stream_at_end;
+static unsigned long  midi_stream_data_pos;
+
+/* bank files ('b' type) contain multiple songs that share the envelopes,
+ * the MIDI data begins with a table of the data size of each song
+ */
+
+static unsigned char  midi_bank_songs = 0;      /* 0: not a bank file */
+static unsigned char  midi_bank_song;
+static unsigned char  *midi_bank_data;
 
 void midi_reset(void)
 {
@@ -43,6 +107,8 @@ void midi_reset(void)
     midi_chn_program[i] = 0;
     dave_assign_channel(i, 0);
   }
+  midi_in_rd_pos = 0;
+  midi_in_wr_pos = 0;
   midi_statuscmd_port = 0x00;
 }
 
@@ -246,8 +312,89 @@ void midi_stop(void)
   midi_all_notes_off();
 }
 
+/* play the oldest event from the MIDI input buffer */
+
+static void midi_in_dispatch(void)
+{
+  const unsigned char *e = midi_in_buf[midi_in_rd_pos];
+  unsigned char st = e[1];
+  unsigned char d1 = e[2];
+  unsigned char d2 = e[3];
+  midi_in_rd_pos = (midi_in_rd_pos + 1) & (MIDI_IN_BUF_SIZE - 1);
+  if (st < 0xF0) {
+    switch (st & 0xF0) {
+    case 0x80:
+      midi_note_off(st & 0x0F, d1);
+      break;
+    case 0x90:
+      if (!d2)
+        midi_note_off(st & 0x0F, d1);
+      else
+        midi_note_on(st & 0x0F, d1, d2);
+      break;
+    case 0xA0:
+      midi_poly_aft(st & 0x0F, d1, d2);
+      break;
+    case 0xB0:
+      midi_control_change(st & 0x0F, d1, d2);
+      break;
+    case 0xC0:
+      midi_program_change(st & 0x0F, d1);
+      break;
+    case 0xD0:
+      midi_channel_aft(st & 0x0F, d1);
+      break;
+    case 0xE0:
+      midi_pitch_bend(st & 0x0F, (((unsigned int) d2 << 8) >> 1) | d1);
+      break;
+    }
+  }
+  else if (st == 0xFC) {
+    midi_stop();
+  }
+}
+
+static void midi_in_store(unsigned char st, unsigned char d1, unsigned char d2)
+{
+  unsigned char *e;
+  unsigned char i = midi_in_wr_pos;
+  if ((st & 0xF0) == 0xB0 || (st & 0xF0) == 0xE0) {
+    /* replace the value of a pending controller or pitch bend event */
+    while (i != midi_in_rd_pos) {
+      i = (i - 1) & (MIDI_IN_BUF_SIZE - 1);
+      e = midi_in_buf[i];
+      if (e[1] >= 0xF0) {
+        if (e[1] == 0xFC)
+          break;
+        continue;
+      }
+      if ((e[1] ^ st) & 0x0F)
+        continue;                       /* other channel */
+      if (e[1] == st && (st >= 0xE0 || e[2] == d1)) {
+        e[2] = d1;
+        e[3] = d2;
+        return;
+      }
+      break;
+    }
+  }
+  i = (midi_in_wr_pos + 1) & (MIDI_IN_BUF_SIZE - 1);
+  if (i == midi_in_rd_pos) {
+    /* buffer full, the oldest event is played now */
+    midi_in_overflows++;
+    midi_in_dispatch();
+  }
+  e = midi_in_buf[midi_in_wr_pos];
+  e[0] = midi_in_frame;
+  e[1] = st;
+  e[2] = d1;
+  e[3] = d2;
+  midi_in_wr_pos = i;
+}
+
 static void midi_read_hw(void)
 {
+  unsigned char n;
   while (midi_statuscmd_port < 0x80) {
     unsigned char st = midi_data_port;
     unsigned char d1 = 0x00;
@@ -258,50 +405,139 @@ static void midi_read_hw(void)
       d1 = midi_data_port & 0x7F;
       if (st < 0xC0 || st >= 0xE0)
         d2 = midi_data_port & 0x7F;
-      switch (st & 0xF0) {
-      case 0x80:
-        midi_note_off(st & 0x0F, d1);
-        break;
-      case 0x90:
-        if (!d2)
-          midi_note_off(st & 0x0F, d1);
-        else
-          midi_note_on(st & 0x0F, d1, d2);
-        break;
-      case 0xA0:
-        midi_poly_aft(st & 0x0F, d1, d2);
-        break;
-      case 0xB0:
-        midi_control_change(st & 0x0F, d1, d2);
-        break;
-      case 0xC0:
-        midi_program_change(st & 0x0F, d1);
-        break;
-      case 0xD0:
-        midi_channel_aft(st & 0x0F, d1);
-        break;
-      case 0xE0:
-        midi_pitch_bend(st & 0x0F, (((unsigned int) d2 << 8) >> 1) | d1);
-        break;
-      }
     }
-    else {
-      switch (st) {
-      case 0xF8:
+    else if (st != 0xFC) {
+      /* other real-time messages are not buffered, and do not count
+       * against midi_in_budget
+       */
+      if (st == 0xF8)
         midi_clock();
-        break;
-      case 0xFA:
+      else if (st == 0xFA)
         midi_start();
-        break;
-      case 0xFB:
+      else if (st == 0xFB)
         midi_continue();
-        break;
-      case 0xFC:
-        midi_stop();
-        break;
-      }
+      continue;
+    }
+    midi_in_store(st, d1, d2);
+  }
+  for (n = 0; midi_in_rd_pos != midi_in_wr_pos; n++) {
+    if (n >= midi_in_budget && midi_in_budget &&
+        (unsigned char) (midi_in_frame - midi_in_buf[midi_in_rd_pos][0])
+        < MIDI_IN_MAX_DELAY) {
+      break;
     }
+    midi_in_dispatch();
+  }
+  midi_in_frame++;
+}
+
+static void midi_file_read_blk(void *buf, unsigned int nbytes)
+{
+  if (exos_read_block(1, buf, nbytes) != nbytes)
+    error_exit("Error reading MIDI file");
+}
+
+static void midi_stream_read_block(unsigned char n)
+{
+  unsigned char *buf = midi_stream_bufs[n];
+  unsigned int  nbytes;
+  if (midi_stream_at_end) {
+    /* continue from the first block */
+    if (exos_set_channel_pos(1, midi_stream_data_pos) != 0)
+      error_exit("Error reading MIDI file");
+  }
+  midi_file_read_blk(buf, midi_stream_blk_size);
+  nbytes = *((unsigned int *) buf) & 0x7FFF;
+  if (nbytes < 2 || nbytes > (midi_stream_blk_size - 2))
+    error_exit("Invalid block size in MIDI file");
+  midi_stream_at_end = buf[1] & 0x80;
+  midi_stream_ready[n] = 1;
+}
+
+static void midi_stream_start(void)
+{
+  const unsigned char *buf = midi_stream_bufs[midi_stream_cur];
+  midi_file_ptr = buf + 2;
+  midi_file_end = midi_file_ptr + (*((unsigned int *) buf) & 0x7FFF);
+  midi_stream_last = buf[1] & 0x80;
+}
+
+/* called from midi_file_dtime() at the end of a block, returns 0 if the
+ * next block is not loaded yet
+ */
+
+static unsigned char midi_stream_next_block(void)
+{
+  midi_stream_ready[midi_stream_cur] = 0;
+  if (midi_stream_last) {
+    midi_prv_status = 0x00;
+    midi_reset();
+  }
+  midi_stream_cur = midi_stream_cur ^ 1;
+  if (!midi_stream_ready[midi_stream_cur]) {
+    midi_port_read = &midi_read_stalled;
+    midi_delta_time = 1;
+    return 0;
+  }
+  midi_stream_start();
+  return 1;
+}
+
+/* NOTE: interrupts or the IRQ callback must be disabled when calling this */
+
+static void midi_stream_restart(void)
+{
+  midi_stream_ready[0] = 0;
+  midi_stream_ready[1] = 0;
+  midi_stream_cur = 0;
+  midi_stream_at_end = 1;
+  midi_stream_read_block(0);
+  midi_stream_start();
+  midi_port_read = midi_file_reader;
+}
+
+void midi_file_stream_update(void)
+{
+  unsigned char n;
+  if (!midi_stream_blk_size)
+    return;
+  n = midi_stream_cur;
+  if (midi_stream_ready[n]) {
+    n = n ^ 1;
+    if (midi_stream_ready[n])
+      return;
   }
+  /* the block is read while playing the other one, keep the EXOS
+   * interrupts running during the read
+   */
+  exos_irq_handler(2);
+  midi_stream_read_block(n);
+  exos_irq_handler(0);
+}
+
+static void midi_bank_select(unsigned char n)
+{
+  const unsigned int  *p = (const unsigned int *) midi_bank_data;
+  unsigned char *buf = midi_bank_data + ((unsigned int) midi_bank_songs << 1);
+  midi_bank_song = n;
+  for ( ; n; n--)
+    buf = buf + *(p++);
+  midi_file_buf = buf;
+  midi_file_end = buf + *p;
+}
+
+static void midi_bank_check(unsigned int nbytes)
+{
+  const unsigned int  *p = (const unsigned int *) midi_bank_data;
+  unsigned char n = midi_bank_songs;
+  nbytes = nbytes - ((unsigned int) n << 1);
+  do {
+    if (*p < 3 || *p > nbytes)
+      error_exit("Invalid song table in MIDI file");
+    nbytes = nbytes - *(p++);
+  } while (--n);
+  if (nbytes)
+    error_exit("Invalid song table in MIDI file");
 }
 
 static void midi_file_reset(void)
@@ -309,15 +545,63 @@ static void midi_file_reset(void)
   midi_file_ptr = midi_file_buf;
   midi_delta_time = 0;
   midi_prv_status = 0x00;
+  midi_file_frame = 0UL;
+  midi_loop_wait = 0;
   midi_reset();
 }
 
+/* continue playing from index entry 'p', the notes are released */
+
+static void midi_file_restore(const unsigned char *p)
+{
+  unsigned char i;
+  midi_all_notes_off();
+  midi_file_ptr = midi_file_buf + ((const unsigned int *) p)[0];
+  midi_delta_time = ((const unsigned int *) p)[1];
+  midi_file_frame = *((const unsigned long *) (p + 4)) & 0x00FFFFFFUL;
+  midi_loop_wait = 0;
+  midi_prv_status = p[7];
+  memcpy(midi_chn_program, p + 8, 16);
+  memcpy(midi_ctrl_state, p + 40, 64);
+  for (i = 0; i < 16; i++) {
+    *((unsigned char *) &(midi_chn_pitch[i])) = p[i + 24];
+    dave_assign_channel(i, midi_ctrl_state[i][1]);
+  }
+}
+
 static void midi_file_dtime(void)
 {
   const unsigned char *p = midi_file_ptr;
   unsigned int  dt;
   if (p >= midi_file_end) {
-    midi_file_reset();
+    if (midi_stream_blk_size) {
+      if (!midi_stream_next_block())
+        return;
+    }
+    else if (midi_loop_dtime != 0xFFFFU) {
+      unsigned long frame = midi_file_frame;
+      midi_file_restore(midi_index + 8);
+      if (midi_loop_dtime) {
+        midi_loop_frame = midi_file_frame;
+        midi_loop_wait = midi_loop_dtime;
+        midi_file_frame = frame;
+        midi_delta_time = midi_delta_time + midi_loop_dtime;
+      }
+      else {
+        /* the current frame has already been counted by midi_read_file() */
+        midi_file_frame++;
+      }
+      return;
+    }
+    else {
+      if (midi_bank_songs) {
+        /* continue with the next song of the bank */
+        midi_bank_select(midi_bank_song + 1 < midi_bank_songs ?
+                         midi_bank_song + 1 : 0);
+      }
+      midi_file_reset();
+      midi_file_frame = 1UL;
+    }
     p = midi_file_ptr;
   }
   dt = *(p++);
@@ -330,12 +614,64 @@ static void midi_file_dtime(void)
 void midi_file_rewind(void)
 {
   midi_file_reset();
-  if (midi_port_read == &midi_read_file)
+  if (midi_stream_blk_size) {
+    exos_irq_handler(1);
+    midi_stream_restart();
+    exos_irq_handler(0);
+  }
+  if (midi_port_read != &midi_read_hw)
     midi_file_dtime();
 }
 
+unsigned char midi_file_next_song(unsigned char prev)
+{
+  unsigned char n = midi_bank_song;
+  if (!midi_bank_songs)
+    return 0;
+  if (prev)
+    n = (n ? n : midi_bank_songs) - 1;
+  else if (++n >= midi_bank_songs)
+    n = 0;
+  midi_bank_select(n);
+  midi_file_rewind();
+  return 1;
+}
+
+unsigned long midi_file_position(void)
+{
+  return midi_file_frame;
+}
+
+unsigned char midi_file_seek(unsigned long frame)
+{
+  unsigned int  n;
+  if (!midi_index)
+    return 0;
+  n = midi_index_entries - 1;
+  if ((frame / midi_index_frames) < n)
+    n = (unsigned int) (frame / midi_index_frames);
+  midi_file_restore(midi_index + (8 + MIDI_INDEX_ENTRY_SIZE)
+                    + (n * MIDI_INDEX_ENTRY_SIZE));
+  return 1;
+}
+
+static void midi_read_stalled(void)
+{
+  if (!midi_stream_ready[midi_stream_cur])
+    return;
+  midi_port_read = midi_file_reader;
+  midi_stream_start();
+  midi_file_dtime();
+  midi_port_read();
+}
+
 static void midi_read_file(void)
 {
+  if (midi_loop_wait) {
+    if (!(--midi_loop_wait))
+      midi_file_frame = midi_loop_frame;
+  }
+  midi_file_frame++;
   if (midi_delta_time) {
     midi_delta_time--;
     return;
@@ -385,19 +721,67 @@ static void midi_read_file(void)
   midi_delta_time--;
 }
 
-static void midi_file_read_blk(void *buf, unsigned int nbytes)
+/* voice events ('v' file type) are already resolved to DAVE channels by
+ * midiconv, only the channel parameters need to be set here
+ */
+
+static void midi_read_voice(void)
 {
-  if (exos_read_block(1, buf, nbytes) != nbytes)
-    error_exit("Error reading MIDI file");
+  if (midi_delta_time) {
+    midi_delta_time--;
+    return;
+  }
+  do {
+    unsigned char cmd = *(midi_file_ptr++);
+    unsigned char c = cmd & 0x07;
+    switch (cmd & 0xF8) {
+    case 0x00:
+      dave_channel_start(c, midi_file_ptr);
+      midi_file_ptr = midi_file_ptr + 8;
+      break;
+    case 0x08:
+      dave_channel_release(dave_channel_ptr(c));
+      break;
+    case 0x10:
+      dave_channel_off(c);
+      break;
+    case 0x18:
+      dave_chn_distortion(c, *(midi_file_ptr++));
+      break;
+    case 0x20:
+      dave_chn_set_pan(c, *(midi_file_ptr++));
+      break;
+    case 0x28:
+      dave_chn_set_volume(c, *(midi_file_ptr++));
+      break;
+    case 0x30:
+      dave_chn_aftertouch(c, *(midi_file_ptr++));
+      break;
+    case 0x38:
+      dave_channel_pitch(c, *(midi_file_ptr++));
+      break;
+    }                                   /* 0xFF = no operation */
+    midi_file_dtime();
+  } while (!midi_delta_time);
+  midi_delta_time--;
 }
 
 unsigned char midi_file_load(const char *file_name,
                              unsigned char *file_buf,
                              unsigned int file_buf_size)
 {
-  unsigned int  env_size, midi_size;
+  unsigned int  env_size, midi_size, file_type, blk_size, index_size;
   midi_port_read = &midi_read_hw;
+  midi_index = (unsigned char *) 0;
+  midi_loop_dtime = 0xFFFFU;
+  midi_bank_songs = 0;
   exos_irq_handler(1);
+  if (midi_stream_blk_size) {
+    midi_stream_blk_size = 0;
+    exos_close_channel(1);
+  }
+  blk_size = 0;
+  index_size = 0;
   if (exos_open_channel(1, file_name) != 0) {
     exos_close_channel(1);
     exos_irq_handler(0);
@@ -405,7 +789,9 @@ unsigned char midi_file_load(const char *file_name,
   }
   if (exos_read_block(1, file_buf, 16) < 10)
     error_exit("Error reading MIDI file header");
-  if (*((unsigned int *) file_buf) != 0x6D00) { /* 'm' */
+  file_type = *((unsigned int *) file_buf);
+  if (file_type != 0x6D00 && file_type != 0x7600 &&     /* 'm', 'v' */
+      file_type != 0x6200) {                            /* 'b' */
     exos_close_channel(1);
     exos_irq_handler(0);
     load_envelopes("envelope.txt", file_buf, file_buf_size);
@@ -420,26 +806,99 @@ unsigned char midi_file_load(const char *file_name,
       error_exit("Invalid MIDI data size in MIDI file");
   }
   else {
+    /* header byte 9 is the compression format, bytes 10 to 14 are only
+     * valid as block size and index size for uncompressed data
+     */
+    if (file_buf[9])
+      error_exit("Compressed MIDI files are not supported");
     env_size = ((unsigned int *) file_buf)[2];
     midi_size = ((unsigned int *) file_buf)[3];
+    /* MIDI data stored in banks (midiconv -banked, the number of banks is in
+     * header byte 10) is only supported by the assembly player
+     */
+    if (!midi_size && file_buf[10])
+      error_exit("Banked MIDI files are not supported");
+    if (!midi_size)
+      blk_size = (unsigned int) file_buf[11] << 8;
+    else if (file_type == 0x6D00)
+      index_size = ((unsigned int *) file_buf)[6];
+    else if (file_type == 0x6200)
+      midi_bank_songs = file_buf[8];
+#if DAVE_VIRT_CHNS < 8
+    /* voice data can only be played if it was converted for the same or a
+     * smaller number of virtual channels (header byte 15, 0 = 8)
+     */
+    if (file_type == 0x7600 &&
+        (!file_buf[15] || file_buf[15] > DAVE_VIRT_CHNS)) {
+      error_exit("Voice data requires more DAVE channels");
+    }
+#endif
     if (env_size < (1024 + 6) || env_size > (1024 + ENV_BUF_SIZE))
       error_exit("Invalid envelope data size in MIDI file");
-    if (midi_size < 3 || midi_size >= file_buf_size)
+    if (blk_size) {
+      if (blk_size < 1024 || blk_size > (file_buf_size >> 1))
+        error_exit("Invalid block size in MIDI file");
+    }
+    else if (midi_size < 3 || midi_size >= file_buf_size ||
+             index_size >= (file_buf_size - midi_size) ||
+             (file_type == 0x6200 &&
+              (!midi_bank_songs ||
+               midi_size < (((unsigned int) midi_bank_songs << 1) + 3)))) {
       error_exit("Invalid MIDI data size in MIDI file");
+    }
     midi_file_read_blk(midi_pgm_layer2, 256);
     midi_file_read_blk(midi_drum_layer2, 256);
     midi_file_read_blk(pgm_env_offsets, sizeof(unsigned int) * 128);
     midi_file_read_blk(drum_env_offsets, sizeof(unsigned int) * 128);
     midi_file_read_blk(envelope_data, env_size - 1024);
-    midi_file_read_blk(file_buf, midi_size);
+    if (!blk_size)
+      midi_file_read_blk(file_buf, midi_size + index_size);
   }
-  exos_close_channel(1);
-  exos_irq_handler(0);
+  if (file_type == 0x7600)
+    midi_file_reader = &midi_read_voice;
+  else
+    midi_file_reader = &midi_read_file;
   midi_file_buf = file_buf;
-  midi_file_ptr = file_buf;
-  midi_file_end = file_buf + midi_size;
+  if (blk_size) {
+    /* the channel is kept open, and read by midi_file_stream_update() */
+    midi_stream_blk_size = blk_size;
+    midi_stream_bufs[0] = file_buf;
+    midi_stream_bufs[1] = file_buf + blk_size;
+    midi_stream_data_pos = (unsigned long) env_size + 16UL;
+    midi_stream_restart();
+    midi_stream_read_block(1);
+  }
+  else {
+    exos_close_channel(1);
+    midi_file_end = file_buf + midi_size;
+    if (midi_bank_songs) {
+      midi_bank_data = file_buf;
+      midi_bank_check(midi_size);
+      midi_bank_select(0);
+    }
+    midi_file_ptr = midi_file_buf;
+    if (index_size) {
+      midi_index = file_buf + midi_size;
+      midi_index_entries = ((unsigned int *) midi_index)[0];
+      midi_index_frames = ((unsigned int *) midi_index)[1];
+      if (!midi_index_entries || !midi_index_frames ||
+          index_size != (8 + MIDI_INDEX_ENTRY_SIZE)
+                        + (midi_index_entries * MIDI_INDEX_ENTRY_SIZE) ||
+          ((unsigned int *) midi_index)[2] > midi_size) {
+        error_exit("Invalid index in MIDI file");
+      }
+      if (((unsigned int *) midi_index)[2]) {
+        /* loop end position */
+        midi_file_end = file_buf + ((unsigned int *) midi_index)[2];
+        midi_loop_dtime = ((unsigned int *) midi_index)[3];
+      }
+    }
+  }
+  exos_irq_handler(0);
   midi_file_dtime();
   midi_prv_status = 0x00;
-  midi_port_read = &midi_read_file;
+  midi_file_frame = 0UL;
+  midi_loop_wait = 0;
+  midi_port_read = midi_file_reader;
   return 1;
 }
@@ -24,10 +24,34 @@ void midi_start(void);
 void midi_continue(void);
 void midi_stop(void);
 
+/* maximum number of MIDI input events played per IRQ frame (0 = no limit),
+ * the remaining ones are delayed by up to 4 frames; changed with F2 and F3
+ * while playing MIDI input
+ */
+extern unsigned char midi_in_budget;
+/* number of MIDI input events played early because the buffer was full,
+ * shown on the status line with midi_in_budget
+ */
+extern volatile unsigned int midi_in_overflows;
+
 extern void (*midi_port_read)(void);
 unsigned char midi_file_load(const char *file_name,
                              unsigned char *file_buf,
                              unsigned int file_buf_size);
 void midi_file_rewind(void);
+/* play the next (or previous if 'prev' is non-zero) song of a bank file
+ * from the beginning, returns 0 if the file is not a bank
+ */
+unsigned char midi_file_next_song(unsigned char prev);
+/* number of IRQ frames played since the start of the song */
+unsigned long midi_file_position(void);
+/* continue playing from the last index entry at or before 'frame',
+ * returns 0 if the file has no index
+ */
+unsigned char midi_file_seek(unsigned long frame);
+/* load the next block of a streamed file if needed, called from the main loop
+ * while playing
+ */
+void midi_file_stream_update(void);
 
 #endif  /* MIDIPLAY_MIDI_IN_H */
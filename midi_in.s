@@ -489,6 +489,14 @@ midi_handle_event:
         jp      (hl)
 
 midi_file_reset:
+    if DISPLAY_ENABLED == 0
+        ld      a, (midi_bank_cnt)
+        or      a
+        jr      z, .l1
+        xor     a
+        call    midi_bank_select        ; restart from the first bank
+.l1:
+    endif
         ld      hl, (midi_file_buf)
         ld      (midi_file_ptr), hl
         xor     a
@@ -499,12 +507,15 @@ midi_file_reset:
         jp      midi_reset
 
 midi_file_rewind:
+        ld      a, (reg_stream_mode)
+        or      a
+        jp      nz, ringStreamRewind
         call    midi_file_reset
         ld      hl, (midi_port_read)
-        ld      de, midi_read_file
+        ld      de, midi_read_hw
         or      a
         sbc     hl, de
-        ret     nz
+        ret     z
 
 ; read and set delta time
 
@@ -536,10 +547,77 @@ midi_file_dtime:
         ld      c, a
         ld      (midi_delta_time), bc
         ret
-.l3:    call    midi_file_reset
+.l3:
+    if DISPLAY_ENABLED == 0
+        ld      a, (midi_bank_cnt)
+        or      a
+        jr      z, .l4
+        ld      b, a
+        ld      a, (midi_bank_cur)
+        inc     a
+        cp      b
+        jr      nc, .l4                 ; end of the last bank?
+        call    midi_bank_select        ; no, continue with the next bank
+        jr      .l1
+.l4:
+    endif
+        call    midi_file_reset
         ld      hl, (midi_file_ptr)
         jr      .l1
 
+    if DISPLAY_ENABLED == 0
+
+; map bank A to page 3, and set the file pointers to its data
+; returns HL = midi_file_ptr
+
+midi_bank_select:
+        ld      (midi_bank_cur), a
+        ld      e, a
+        ld      d, 0
+        ld      hl, midi_bank_segments
+        add     hl, de
+        ld      a, (hl)
+        ld      (midi_bank_segment), a
+        out     (0b3h), a
+        ld      hl, midi_bank_sizes
+        add     hl, de
+        add     hl, de
+        ld      e, (hl)
+        inc     hl
+        ld      d, (hl)
+        ld      hl, 0c000h
+        add     hl, de
+        ld      (midi_file_end), hl
+        ld      hl, 0c000h
+        ld      (midi_file_ptr), hl
+        ret
+
+; free the segments of the previously loaded banked MIDI data, and restore
+; the system segment in page 3
+
+midi_file_free_banks:
+        ld      a, 0ffh
+        out     (0b3h), a
+        ld      hl, midi_bank_cnt
+        ld      b, (hl)
+        xor     a
+        ld      (hl), a
+        ld      (midi_bank_segment), a
+        or      b
+        ret     z
+        ld      hl, midi_bank_segments
+.l1:    ld      c, (hl)
+        inc     hl
+        push    bc
+        push    hl
+        exos    25
+        pop     hl
+        pop     bc
+        djnz    .l1
+        ret
+
+    endif
+
 midi_read_file_:
 .l1:    ld      hl, (midi_file_ptr)
         ld      a, (hl)
@@ -577,6 +655,63 @@ midi_read_file_:
 
 midi_read_file  equ     midi_read_file_.l7
 
+; voice events ('v' file type) are already resolved to DAVE channels by
+; midiconv, only the channel parameters need to be set here; the commands
+; with a value byte jump to the daveplay.s handlers with A = DAVE channel,
+; B = value, and .l7 pushed as the return address
+
+midi_read_voice_:
+.l1:    ld      hl, (midi_file_ptr)
+        ld      a, (hl)
+        inc     hl
+        cp      18h
+        jr      c, .l3                  ; start note, release or off?
+        cp      40h
+        jr      nc, .l2                 ; no operation?
+        ld      b, (hl)                 ; B = value
+        inc     hl
+        ld      (midi_file_ptr), hl
+        ld      c, a
+        and     07h                     ; A = DAVE channel
+        ld      hl, .l7
+        push    hl
+        bit     5, c
+        jp      z, dave_chn_distortion  ; 18h
+        bit     4, c
+        jr      nz, .l4
+        bit     3, c
+        jp      z, dave_chn_set_pan     ; 20h
+        jp      dave_chn_set_volume     ; 28h
+.l2:    ld      (midi_file_ptr), hl
+        jr      .l7
+.l3:    ld      c, a
+        and     07h                     ; A = DAVE channel
+        bit     4, c
+        jr      nz, .l6                 ; off?
+        bit     3, c
+        jr      nz, .l5                 ; release?
+        call    dave_channel_start      ; HL = note parameters
+        ld      (midi_file_ptr), hl
+        jr      .l7
+.l4:    bit     3, c
+        jp      z, dave_chn_aftertouch  ; 30h
+        jp      dave_channel_pitch      ; 38h
+.l5:    ld      (midi_file_ptr), hl
+        call    dave_channel_release
+        jr      .l7
+.l6:    ld      (midi_file_ptr), hl
+        call    dave_channel_off
+.l7:    call    midi_file_dtime
+.l8:    ld      hl, (midi_delta_time)   ; midi_read_voice
+        ld      a, l
+        or      h
+        jp      z, .l1
+        dec     hl
+        ld      (midi_delta_time), hl
+        ret
+
+midi_read_voice equ     midi_read_voice_.l8
+
 ; DE = file name address
 ; HL = file buffer address
 ; BC = file buffer size
@@ -584,8 +719,17 @@ midi_read_file  equ     midi_read_file_.l7
 midi_file_load:
         push    bc
         push    hl
+    if DISPLAY_ENABLED == 0
+        push    de
+        call    midi_file_free_banks
+        pop     de
+    endif
         ld      hl, midi_read_hw
         ld      (midi_port_read), hl
+        ld      hl, midi_read_file
+        ld      (midi_file_reader), hl
+        xor     a
+        ld      (reg_stream_mode), a
         pop     hl
         ld      a, 1
         push    de
@@ -600,6 +744,12 @@ midi_file_load:
         inc     hl
         ld      a, (hl)
         dec     hl
+        cp      76h                     ; 'v'
+        jp      z, .l16
+        cp      72h                     ; 'r'
+        jp      z, .l17
+        cp      62h                     ; 'b'
+        jp      z, .l6                  ; song banks are not supported
         xor     6dh                     ; 'm'
         or      (hl)
         jr      z, .l8
@@ -631,7 +781,7 @@ midi_file_load:
         jr      c, .l6
         ld      a, 1
         exos    3
-        ld      hl, midi_read_file
+        ld      hl, (midi_file_reader)
         ld      (midi_port_read), hl
         call    midi_file_dtime
         xor     a
@@ -654,6 +804,8 @@ midi_file_load:
         ld      a, (hl)
         cp      02h
         jr      z, .l10                 ; compressed format?
+        cp      03h
+        jr      z, .l10                 ; compressed with envelope dictionary?
         or      a
         jr      nz, .l6
         ld      bc, 10000h - 5
@@ -681,6 +833,11 @@ midi_file_load:
         ld      b, (hl)                 ; BC = MIDI data size
         pop     hl                      ; HL = file buffer address
         pop     de                      ; DE = file buffer size
+    if DISPLAY_ENABLED == 0
+        ld      a, c
+        or      b
+        jp      z, .l18                 ; MIDI data is stored in banks?
+    endif
         ld      a, c
         cp      3
         ld      a, b
@@ -697,7 +854,7 @@ midi_file_load:
         exos    6
         jp      z, .l2
 .l9:    ld      hl, errMsg_midiReadErr
-        jr      .l8
+        jr      .l7
 .l10:   ld      bc, 10000h - 7
         add     hl, bc
         ld      c, (hl)
@@ -719,12 +876,15 @@ midi_file_load:
         ld      a, 1
         exos    6
         jr      nz, .l9
+        ld      a, (file_buf + 9)
+        cp      03h
+        jr      z, .l12                 ; envelope data uses dictionary?
         ld      de, midi_pgm_layer2
         di
         ld      a, 0ch
         out     (0bfh), a
         call    decompressData
-        pop     de                      ; DE = file buffer address
+.l11:   pop     de                      ; DE = file buffer address
         pop     bc                      ; BC = file buffer size
         call    decompressData
         ld      a, 04h
@@ -733,4 +893,195 @@ midi_file_load:
         ld      hl, file_buf
         xor     a
         jp      .l2
-
+.l12:   push    hl                      ; save compressed data address
+        ld      a, 1
+        exos    3
+        call    load_envelopes          ; ENVELOPE.BIN is the dictionary
+        ld      hl, 10000h - midi_pgm_layer2
+        add     hl, de                  ; HL = size of ENVELOPE.BIN
+        ld      bc, (file_buf + 12)     ; BC = dictionary size
+        or      a
+        sbc     hl, bc
+        jr      nz, .l14                ; not the same size?
+        ld      hl, midi_pgm_layer2
+        ld      a, 0ffh
+.l13:   xor     (hl)                    ; calculate the checksum of the
+        rlca                            ; dictionary, and compare it with
+        add     a, 0ach                 ; the one stored in the header
+        cpi
+        jp      pe, .l13
+        ld      hl, file_buf + 14
+        cp      (hl)
+        jr      z, .l15
+.l14:   ld      hl, errMsg_envDict      ; ENVELOPE.BIN is not the same file
+        jp      error_exit              ; that the data was compressed with
+.l15:   ld      de, (file_buf + 4)      ; DE = envelope data size
+        ld      bc, (file_buf + 12)     ; BC = dictionary size
+        ld      hl, file_buf
+        add     hl, bc
+        add     hl, de
+        ex      de, hl                  ; DE = envelope data end address
+        ex      (sp), hl                ; HL = compressed data address
+        push    hl
+        or      a
+        sbc     hl, de
+        jp      c, .l6                  ; not enough space in file buffer?
+        ld      hl, midi_pgm_layer2
+        ld      de, file_buf
+        ldir                            ; copy dictionary to file buffer,
+        pop     hl                      ; and decompress envelope data after it
+        di
+        ld      a, 0ch
+        out     (0bfh), a
+        push    de
+        call    decompressData
+        pop     de                      ; DE = envelope data address
+        pop     bc                      ; BC = envelope data size
+        push    hl
+        ex      de, hl
+        ld      de, midi_pgm_layer2
+        ldir                            ; copy envelope data to midi_pgm_layer2
+        pop     hl                      ; HL = compressed MIDI data address
+        jr      .l11
+.l16:   ld      a, (hl)
+        or      a
+        jp      nz, .l1
+    if DAVE_VIRT_CHNS < 8
+        push    hl
+        ld      bc, 15
+        add     hl, bc
+        ld      a, (hl)                 ; number of virtual channels used
+        dec     a                       ; by the voice data, 0 = 8
+        cp      DAVE_VIRT_CHNS
+        ld      hl, errMsg_voiceChns
+        jp      nc, .l7
+        pop     hl
+    endif
+        ld      bc, midi_read_voice     ; voice events
+        ld      (midi_file_reader), bc
+        jp      .l8
+.l17:   ld      a, (hl)                 ; rendered DAVE register data
+        or      a
+        jp      nz, .l1
+        pop     de
+        push    hl
+        ld      bc, 8
+        add     hl, bc
+        ld      a, (hl)
+        inc     hl
+        or      a
+        jp      nz, .l6                 ; not transform type 0?
+        ld      a, (hl)
+        cp      02h
+        jp      nz, .l6                 ; not compressed?
+        inc     hl
+        inc     hl
+        inc     hl
+        ld      c, (hl)
+        inc     hl
+        ld      b, (hl)                 ; BC = maximum match offset
+        ld      a, c
+        or      b
+        jp      z, .l6
+        dec     bc
+        ld      a, b
+        cp      high RING_BUF_SIZE
+        jp      nc, .l6                 ; does not fit in the ring buffer?
+        pop     hl                      ; HL = file buffer address
+        pop     bc                      ; BC = file buffer size
+        ld      a, 1
+        ld      e, l
+        ld      d, h
+        exos    6
+        xor     0e4h                    ; .EOF
+        jp      nz, .l6
+        push    hl
+        ld      a, 1
+        exos    3
+        pop     hl
+        call    ringStreamInit          ; HL = compressed data address
+        ld      a, 1
+        ld      (reg_stream_mode), a
+        or      a
+        ret
+    if DISPLAY_ENABLED == 0
+.l18:   ld      a, (file_buf + 10)      ; A = number of banks
+        or      a
+        jp      z, .l6
+        cp      MIDI_MAX_BANKS + 1
+        jp      nc, .l6
+        add     a, a
+        ld      c, a
+        ld      b, 0
+        ld      de, midi_bank_sizes
+        ld      a, 1
+        exos    6                       ; read bank size table
+        jp      nz, .l9
+        ld      a, (file_buf + 10)
+        ld      b, a
+        ld      hl, midi_bank_sizes
+.l19:   push    bc
+        push    hl
+        exos    24                      ; allocate segment for the bank
+        jp      nz, .l20
+        ld      hl, midi_bank_cnt
+        ld      e, (hl)
+        inc     (hl)
+        ld      d, 0
+        ld      hl, midi_bank_segments
+        add     hl, de
+        ld      (hl), c
+        pop     hl
+        ld      e, (hl)
+        inc     hl
+        ld      d, (hl)                 ; DE = bank size
+        inc     hl
+        push    hl
+        push    bc                      ; C = segment
+        ld      a, e
+        or      d
+        jp      z, .l6
+        ld      a, d
+        cp      40h
+        jp      nc, .l6                 ; more than 16383 bytes?
+        ld      c, e
+        ld      b, d
+        push    bc
+        ld      de, file_buf
+        ld      a, 1
+        exos    6                       ; read bank data to file_buf,
+        jp      nz, .l9
+        pop     bc                      ; BC = bank size
+        pop     de                      ; E = segment
+        di
+        ld      a, e
+        out     (0b3h), a
+        ld      hl, file_buf
+        ld      de, 0c000h
+        ldir                            ; and copy it to the segment
+        ld      a, 0ffh
+        out     (0b3h), a
+        ei
+        pop     hl
+        pop     bc
+        djnz    .l19
+        ld      a, 1
+        exos    3
+        ld      hl, 0c000h
+        ld      (midi_file_buf), hl
+        xor     a
+        ld      (midi_prv_status), a
+        di
+        call    midi_bank_select        ; read the first delta time
+        call    midi_file_dtime         ; from bank 0
+        ld      a, 0ffh
+        out     (0b3h), a
+        ei
+        ld      hl, (midi_file_reader)
+        ld      (midi_port_read), hl
+        xor     a
+        inc     a
+        ret
+.l20:   ld      hl, errMsg_midiNoMemory
+        jp      error_exit
+    endif
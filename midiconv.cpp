@@ -20,7 +20,11 @@
 #include <cstdlib>
 #include <cstring>
 #include <cstdarg>
+#include <chrono>
+#include <string>
 #include <vector>
+#include <map>
+#include <algorithm>
 #include <exception>
 #include <stdexcept>
 
@@ -113,7 +117,9 @@ class File {
   File(const char *fileName, const char *mode);
   virtual ~File();
   size_t size();
+  void seek(size_t pos);
   void readBlock(std::vector< unsigned char >& buf, size_t nBytes);
+  void writeBlock(const unsigned char *buf, size_t nBytes);
   void writeBlock(const std::vector< unsigned char >& buf);
 };
 
@@ -148,6 +154,12 @@ size_t File::size()
   return size_t(fileSize);
 }
 
+void File::seek(size_t pos)
+{
+  if (pos > 0x7FFFFFFFUL || std::fseek(f, long(pos), SEEK_SET) < 0)
+    errorMessage("error seeking file");
+}
+
 void File::readBlock(std::vector< unsigned char >& buf, size_t nBytes)
 {
   buf.resize(buf.size() + nBytes);
@@ -157,21 +169,38 @@ void File::readBlock(std::vector< unsigned char >& buf, size_t nBytes)
   }
 }
 
-void File::writeBlock(const std::vector< unsigned char >& buf)
+void File::writeBlock(const unsigned char *buf, size_t nBytes)
 {
-  if (buf.size() < 1)
+  if (nBytes < 1)
     return;
-  if (std::fwrite(&(buf.front()), sizeof(unsigned char), buf.size(), f)
-      != buf.size() || std::fflush(f) != 0) {
+  if (std::fwrite(buf, sizeof(unsigned char), nBytes, f) != nBytes ||
+      std::fflush(f) != 0) {
     errorMessage("error writing output file");
   }
 }
 
+void File::writeBlock(const std::vector< unsigned char >& buf)
+{
+  if (buf.size() < 1)
+    return;
+  writeBlock(&(buf.front()), buf.size());
+}
+
 // ----------------------------------------------------------------------------
 
 class Envelopes {
  public:
   static const size_t env_buf_size = 8192;
+  // if not empty, envelope text files are compiled only once, and the
+  // result is stored in this directory in the format written by -env,
+  // with a file name derived from a hash of the text
+  static std::string  cacheDirectory;
+  // if not negative, optimizeData() replaces pairs of envelope frames
+  // without loop flags that have the same pitch and distortion, and left and
+  // right volumes differing by at most this value, with the first frame
+  // flagged by bit 7 of the right volume; the players update these channels
+  // on every second IRQ only (half rate envelope)
+  static int          halfRateMaxVolDiff;
  protected:
   struct EnvelopeState {
     unsigned int  vol_l;
@@ -207,10 +236,19 @@ class Envelopes {
   void parsePitchBend(bool isDrum);
   void parseInstrLayer2(int n);
   void compileEnvelopes();
+  void getEnvelope(std::vector< unsigned char >& buf,
+                   unsigned short envOffset) const;
+  static uint64_t hashEnvelope(const unsigned char *buf, size_t nBytes);
+  static void halveEnvelope(std::vector< unsigned char >& buf);
+  std::string getCacheFileName() const;
+  void saveCacheFile(const std::string& cacheFileName) const;
  public:
   Envelopes(const char *fileName);
   virtual ~Envelopes();
   void midiEvent(unsigned char st, unsigned char d1, unsigned char d2);
+  // reset the MIDI channel programs before the events of the next song
+  // when the envelopes are shared by multiple songs
+  void resetMIDIState();
   void optimizeData(bool renumberPgm = false);
   void saveData(std::vector< unsigned char >& outBuf) const;
   inline unsigned char mapMIDIProgram(unsigned char pgm) const
@@ -559,6 +597,52 @@ void Envelopes::compileEnvelopes()
   }
 }
 
+std::string Envelopes::cacheDirectory;
+int Envelopes::halfRateMaxVolDiff = -1;
+
+std::string Envelopes::getCacheFileName() const
+{
+  // FNV-1a hash of the envelope text, the version number at the start
+  // should be changed if the compiled format or compileEnvelopes() changes
+  uint64_t  h = 0xCBF29CE484222325ULL;
+  const char  *versionString = "midiconv envelope cache 1\n";
+  for (size_t i = 0; versionString[i] != '\0'; i++)
+    h = (h ^ uint64_t((unsigned char) versionString[i])) * 0x100000001B3ULL;
+  for (size_t i = 0; i < file_buf.size(); i++)
+    h = (h ^ uint64_t(file_buf[i])) * 0x100000001B3ULL;
+  char    tmpBuf[32];
+  std::sprintf(tmpBuf, "env-%08lx%08lx.bin",
+               (unsigned long) (h >> 32), (unsigned long) (h & 0xFFFFFFFFUL));
+  std::string s(cacheDirectory);
+  if (s[s.length() - 1] != '/' && s[s.length() - 1] != '\\')
+    s += '/';
+  s += tmpBuf;
+  return s;
+}
+
+void Envelopes::saveCacheFile(const std::string& cacheFileName) const
+{
+  std::vector< unsigned char >  tmpBuf;
+  saveData(tmpBuf);
+  // write to a temporary file first, so that a partially written cache
+  // file is never used
+  std::string tmpFileName(cacheFileName);
+  tmpFileName += ".tmp";
+  try {
+    {
+      File    f(tmpFileName.c_str(), "wb");
+      f.writeBlock(tmpBuf);
+    }
+    std::remove(cacheFileName.c_str());
+    if (std::rename(tmpFileName.c_str(), cacheFileName.c_str()) != 0)
+      std::remove(tmpFileName.c_str());
+  }
+  catch (std::exception& e) {
+    // the cache is optional, errors are only reported
+    std::fprintf(stderr, "WARNING: envelope cache: %s\n", e.what());
+  }
+}
+
 Envelopes::Envelopes(const char *fileName)
   : midi_pgm_layer2(128, 0xFFFF),
     midi_drum_layer2(128, 0xFFFF),
@@ -604,6 +688,19 @@ Envelopes::Envelopes(const char *fileName)
     if (isBinary && !haveFFFF)
       errorMessage("invalid binary envelope file format");
   }
+  std::string cacheFileName;
+  if (!isBinary && !cacheDirectory.empty()) {
+    cacheFileName = getCacheFileName();
+    std::FILE *f = std::fopen(cacheFileName.c_str(), "rb");
+    if (f) {
+      std::fclose(f);
+      File    cacheFile(cacheFileName.c_str(), "rb");
+      file_buf.clear();
+      cacheFile.readBlock(file_buf, cacheFile.size());
+      cacheFileName.clear();
+      isBinary = true;
+    }
+  }
   if (isBinary) {
     if (file_buf.size() < (1024 + 6) ||
         file_buf.size() > (1024 + env_buf_size) || (file_buf.size() & 1) != 0) {
@@ -642,6 +739,8 @@ Envelopes::Envelopes(const char *fileName)
   }
   else {
     compileEnvelopes();
+    if (!cacheFileName.empty())
+      saveCacheFile(cacheFileName);
   }
 }
 
@@ -683,6 +782,71 @@ void Envelopes::midiEvent(unsigned char st, unsigned char d1, unsigned char d2)
   }
 }
 
+void Envelopes::resetMIDIState()
+{
+  for (size_t i = 0; i < midiChnProgram.size(); i++)
+    midiChnProgram[i] = 0;
+}
+
+// copy the envelope at 'envOffset' (in 2 byte units, with flags in the
+// high 4 bits) from envelope_data to 'buf', up to and including the end
+// marker
+
+void Envelopes::getEnvelope(std::vector< unsigned char >& buf,
+                            unsigned short envOffset) const
+{
+  buf.clear();
+  for (size_t j = (envOffset & 0x0FFF) << 1;
+       (j + 2) <= envelope_data.size();
+       j = j + 4) {
+    unsigned char b0 = envelope_data[j];
+    unsigned char b1 = envelope_data[j + 1];
+    buf.push_back(b0);
+    buf.push_back(b1);
+    if (((b0 & 0x80) != 0 && b1 == 0xFF) ||
+        ((envOffset & 0x3000) == 0 && b0 == 0x80 && b1 == 0x00)) {
+      break;
+    }
+    if ((j + 2) < envelope_data.size())
+      buf.push_back(envelope_data[j + 2]);
+    if ((j + 3) < envelope_data.size())
+      buf.push_back(envelope_data[j + 3]);
+  }
+}
+
+uint64_t Envelopes::hashEnvelope(const unsigned char *buf, size_t nBytes)
+{
+  uint64_t  h = 1UL;
+  for (size_t i = 0; i < nBytes; i++) {
+    h = h ^ uint64_t(buf[i]);
+    h = uint32_t(h) * uint64_t(0xC2B0C3CCUL);
+    h = (h ^ (h >> 32)) & 0xFFFFFFFFUL;
+  }
+  return (h | (uint64_t(nBytes) << 32));
+}
+
+void Envelopes::halveEnvelope(std::vector< unsigned char >& buf)
+{
+  std::vector< unsigned char >  tmpBuf;
+  size_t  i = 0;
+  while ((i + 4) <= buf.size()) {
+    const unsigned char *p = &(buf.front()) + i;
+    tmpBuf.insert(tmpBuf.end(), p, p + 4);
+    i = i + 4;
+    if ((i + 4) > buf.size() || ((p[0] | p[4]) & 0xC0) != 0 ||
+        ((p[1] | p[5]) & 0x80) != 0 || p[2] != p[6] || p[3] != p[7]) {
+      continue;
+    }
+    if (std::abs(int(p[0]) - int(p[4])) <= halfRateMaxVolDiff &&
+        std::abs(int(p[1]) - int(p[5])) <= halfRateMaxVolDiff) {
+      tmpBuf[tmpBuf.size() - 3] |= 0x80;
+      i = i + 4;
+    }
+  }
+  tmpBuf.insert(tmpBuf.end(), buf.begin() + i, buf.end());
+  buf = tmpBuf;
+}
+
 void Envelopes::optimizeData(bool renumberPgm)
 {
   std::vector< unsigned short > pgm_l2_new(128, 0xFFFF);
@@ -690,91 +854,115 @@ void Envelopes::optimizeData(bool renumberPgm)
   std::vector< unsigned short > pgm_env_new(128, 0x8000);
   std::vector< unsigned short > drum_env_new(128, 0x8000);
   std::vector< unsigned char >  env_data_new;
-  unsigned char pgm = 0;
-  for (size_t i = 0; i < 128; i++) {
-    if (!pgm_used[i])
-      continue;
-    if (!renumberPgm)
-      pgm = i;
-    midiProgramMap[i] = pgm;
-    pgm_l2_new[pgm] = midi_pgm_layer2[i];
-    if (pgm_env_offsets[i] & 0x8000) {
-      pgm_env_new[pgm] = 0x8000;
-      pgm++;
-      continue;
-    }
-    bool    foundMatch = false;
-    for (size_t j = 0; j < i; j++) {
-      if (pgm_used[j] &&
-          !((pgm_env_offsets[i] ^ pgm_env_offsets[j]) & 0x8FFF)) {
-        pgm_env_new[pgm] = (pgm_env_offsets[i] & 0xF000)
-                           | (pgm_env_new[midiProgramMap[j]] & 0x0FFF);
-        foundMatch = true;
-        break;
+  // envelopes used, in the order of first use, and the index of the
+  // envelope of each program (0-127) and drum (128-255)
+  std::vector< std::vector< unsigned char > > envList;
+  std::vector< size_t > envIndex(256, 0);
+  {
+    std::multimap< uint64_t, size_t > envHashTable;
+    std::vector< unsigned char >  tmpBuf;
+    unsigned char pgm = 0;
+    for (size_t i = 0; i < 256; i++) {
+      bool    isDrum = (i >= 128);
+      size_t  n = i & 0x7F;
+      if (!(isDrum ? drum_used[n] : pgm_used[n]))
+        continue;
+      if (!isDrum) {
+        if (!renumberPgm)
+          pgm = n;
+        midiProgramMap[n] = pgm;
+        pgm_l2_new[pgm] = midi_pgm_layer2[n];
+        pgm++;
       }
-    }
-    if (foundMatch) {
-      pgm++;
-      continue;
-    }
-    pgm_env_new[pgm] = (pgm_env_offsets[i] & 0xF000)
-                       | (unsigned short) (env_data_new.size() >> 1);
-    for (size_t j = (pgm_env_offsets[i] & 0x0FFF) << 1;
-         (j + 2) <= envelope_data.size();
-         j = j + 4) {
-      unsigned char b0 = envelope_data[j];
-      unsigned char b1 = envelope_data[j + 1];
-      env_data_new.push_back(b0);
-      env_data_new.push_back(b1);
-      if (((b0 & 0x80) != 0 && b1 == 0xFF) ||
-          ((pgm_env_offsets[i] & 0x3000) == 0 && b0 == 0x80 && b1 == 0x00)) {
-        break;
+      else {
+        drum_l2_new[n] = midi_drum_layer2[n];
+      }
+      unsigned short  envOffset =
+          (isDrum ? drum_env_offsets[n] : pgm_env_offsets[n]);
+      if (envOffset & 0x8000)
+        continue;
+      getEnvelope(tmpBuf, envOffset);
+      if (halfRateMaxVolDiff >= 0)
+        halveEnvelope(tmpBuf);
+      uint64_t  h = hashEnvelope(&(tmpBuf.front()), tmpBuf.size());
+      std::multimap< uint64_t, size_t >::iterator j = envHashTable.find(h);
+      for ( ; j != envHashTable.end() && (*j).first == h; j++) {
+        if (envList[(*j).second] == tmpBuf)
+          break;
+      }
+      if (j != envHashTable.end() && (*j).first == h) {
+        envIndex[i] = (*j).second;
+      }
+      else {
+        envIndex[i] = envList.size();
+        envHashTable.insert(std::pair< uint64_t, size_t >(h, envList.size()));
+        envList.push_back(tmpBuf);
       }
-      if ((j + 2) < envelope_data.size())
-        env_data_new.push_back(envelope_data[j + 2]);
-      if ((j + 3) < envelope_data.size())
-        env_data_new.push_back(envelope_data[j + 3]);
     }
-    pgm++;
   }
-  for (size_t i = 0; i < 128; i++) {
-    if (!drum_used[i])
-      continue;
-    drum_l2_new[i] = midi_drum_layer2[i];
-    if (drum_env_offsets[i] & 0x8000) {
-      drum_env_new[i] = 0x8000;
-      continue;
-    }
-    bool    foundMatch = false;
-    for (size_t j = 0; j < i; j++) {
-      if (drum_used[j] &&
-          !((drum_env_offsets[i] ^ drum_env_offsets[j]) & 0x8FFF)) {
-        drum_env_new[i] = (drum_env_offsets[i] & 0xF000)
-                          | (drum_env_new[j] & 0x0FFF);
-        foundMatch = true;
-        break;
+  // envelopes that are the end of a longer one are stored as a pointer into
+  // that envelope; the longest ones are checked first, so that the
+  // envelope to be shared is always stored in full
+  std::vector< size_t > envParent(envList.size());
+  std::vector< size_t > envParentOffs(envList.size(), 0);
+  {
+    std::vector< std::pair< size_t, size_t > >  sortBuf;
+    for (size_t i = 0; i < envList.size(); i++)
+      sortBuf.push_back(std::pair< size_t, size_t >(~envList[i].size(), i));
+    std::sort(sortBuf.begin(), sortBuf.end());
+    // hash values of all suffixes of the envelopes stored in full that
+    // begin on a frame boundary
+    std::multimap< uint64_t, size_t > suffixHashTable;
+    for (size_t i = 0; i < sortBuf.size(); i++) {
+      size_t  n = sortBuf[i].second;
+      const std::vector< unsigned char >& s = envList[n];
+      uint64_t  h = hashEnvelope(&(s.front()), s.size());
+      envParent[n] = n;
+      std::multimap< uint64_t, size_t >::iterator j = suffixHashTable.find(h);
+      for ( ; j != suffixHashTable.end() && (*j).first == h; j++) {
+        size_t  p = (*j).second;
+        size_t  offs = envList[p].size() - s.size();
+        if (std::memcmp(&(envList[p].front()) + offs, &(s.front()),
+                        s.size()) == 0) {
+          envParent[n] = p;
+          envParentOffs[n] = offs;
+          break;
+        }
+      }
+      if (envParent[n] != n)
+        continue;
+      for (size_t offs = 4; offs < s.size(); offs = offs + 4) {
+        suffixHashTable.insert(
+            std::pair< uint64_t, size_t >(
+                hashEnvelope(&(s.front()) + offs, s.size() - offs), n));
       }
     }
-    if (foundMatch)
+  }
+  std::vector< size_t > envDataOffs(envList.size(), 0);
+  for (size_t i = 0; i < envList.size(); i++) {
+    if (envParent[i] != i)
       continue;
-    drum_env_new[i] = (drum_env_offsets[i] & 0xF000)
-                      | (unsigned short) (env_data_new.size() >> 1);
-    for (size_t j = (drum_env_offsets[i] & 0x0FFF) << 1;
-         (j + 2) <= envelope_data.size();
-         j = j + 4) {
-      unsigned char b0 = envelope_data[j];
-      unsigned char b1 = envelope_data[j + 1];
-      env_data_new.push_back(b0);
-      env_data_new.push_back(b1);
-      if (((b0 & 0x80) != 0 && b1 == 0xFF) ||
-          ((drum_env_offsets[i] & 0x3000) == 0 && b0 == 0x80 && b1 == 0x00)) {
-        break;
-      }
-      if ((j + 2) < envelope_data.size())
-        env_data_new.push_back(envelope_data[j + 2]);
-      if ((j + 3) < envelope_data.size())
-        env_data_new.push_back(envelope_data[j + 3]);
+    envDataOffs[i] = env_data_new.size();
+    env_data_new.insert(env_data_new.end(),
+                        envList[i].begin(), envList[i].end());
+  }
+  for (size_t i = 0; i < 256; i++) {
+    bool    isDrum = (i >= 128);
+    size_t  n = i & 0x7F;
+    if (!(isDrum ? drum_used[n] : pgm_used[n]))
+      continue;
+    unsigned short  envOffset =
+        (isDrum ? drum_env_offsets[n] : pgm_env_offsets[n]);
+    if (!(envOffset & 0x8000)) {
+      size_t  e = envIndex[i];
+      envOffset = (envOffset & 0xF000)
+                  | (unsigned short) ((envDataOffs[envParent[e]]
+                                       + envParentOffs[e]) >> 1);
     }
+    if (isDrum)
+      drum_env_new[n] = envOffset;
+    else
+      pgm_env_new[midiProgramMap[n]] = envOffset;
   }
   midi_pgm_layer2.clear();
   midi_pgm_layer2.insert(midi_pgm_layer2.end(),
@@ -826,6 +1014,10 @@ class MIDIFile {
   size_t  trackBytesLeft;
   int     dTime;
   bool    noTempo;
+  // time of the "loopStart" and "loopEnd" marker events in MIDI ticks,
+  // or -1 if not present
+  long    loopStartTick;
+  long    loopEndTick;
   // --------
   inline unsigned char readByte()
   {
@@ -881,16 +1073,52 @@ class MIDIFile {
   void sortEvents();
   double calculateTickTime(unsigned int usPerBeat, double irqFreq,
                            int quantizeTPQN) const;
+  // returns 0 for events that are not delayed, and 1 to 3 for note on,
+  // controller and pitch bend, and aftertouch events (the ones with the
+  // highest number are delayed first)
+  static inline int eventDelayClass(const MIDIEvent& e)
+  {
+    switch (e.st & 0xF0) {
+    case 0x90:
+      return (e.d2 == 0 ? 0 : 1);
+    case 0xB0:
+      return (e.d1 < 120 ? 2 : 0);
+    case 0xE0:
+      return 2;
+    case 0xA0:
+    case 0xD0:
+      return 3;
+    }
+    return 0;
+  }
+  void smoothEventLoad(std::vector< size_t >& evtOrder,
+                       std::vector< long >& evtFrame, size_t maxEvents) const;
  public:
   MIDIFile(const char *fileName);
   virtual ~MIDIFile();
+  // if 'maxFrameEvents' is non-zero, events are moved to later IRQ frames
+  // so that at most this number of events is played in one frame, where
+  // it can be done by delaying note on events by up to smoothNoteOnDelay
+  // and other events by up to smoothMaxDelay frames
   void getRawData(std::vector< unsigned char >& outBuf,
                   double irqFreq, const Envelopes *env,
-                  int roundingBias = 64, int quantizeTPQN = 0) const;
+                  int roundingBias = 64, int quantizeTPQN = 0,
+                  int maxFrameEvents = 0) const;
+  // mark the programs and drums used by the song in 'env'
+  void addEnvelopeEvents(Envelopes& env) const;
   void getAllData(std::vector< unsigned char >& outBuf,
                   const char *envFile, double irqFreq,
                   bool renumberPgm = false, int roundingBias = 64,
-                  int quantizeTPQN = 0) const;
+                  int quantizeTPQN = 0, int maxFrameEvents = 0) const;
+  // returns the IRQ frame of MIDI tick 't', calculated in the same way as
+  // the frames of the events by getRawData()
+  long getTickFrame(unsigned long t, double irqFreq,
+                    int roundingBias = 64, int quantizeTPQN = 0) const;
+  // returns the frames of the loop markers, or -1 if not present
+  void getLoopFrames(long& loopStart, long& loopEnd, double irqFreq,
+                     int roundingBias = 64, int quantizeTPQN = 0) const;
+  static const long smoothNoteOnDelay = 2;
+  static const long smoothMaxDelay = 8;
 };
 
 void MIDIFile::sortEvents()
@@ -925,7 +1153,9 @@ void MIDIFile::sortEvents()
 MIDIFile::MIDIFile(const char *fileName)
   : bufPos(14),
     trackBytesLeft(0x7FFFFFFF),
-    noTempo(false)
+    noTempo(false),
+    loopStartTick(-1L),
+    loopEndTick(-1L)
 {
   buf.clear();
   File    f(fileName, "rb");
@@ -983,6 +1213,19 @@ MIDIFile::MIDIFile(const char *fileName)
           if (!noTempo)
             evtBuf.push_back(e);
           break;
+        case 0x06:                      // marker
+          {
+            std::string s;
+            for ( ; evtBytes > 0; evtBytes--) {
+              char    c = char(readByte());
+              s += ((c >= 'A' && c <= 'Z') ? (c + ('a' - 'A')) : c);
+            }
+            if (s == "loopstart" && loopStartTick < 0L)
+              loopStartTick = long(curTime);
+            else if (s == "loopend" && loopEndTick < 0L)
+              loopEndTick = long(curTime);
+          }
+          break;
         }
         for ( ; evtBytes > 0; evtBytes--)
           (void) readByte();
@@ -1054,15 +1297,164 @@ double MIDIFile::calculateTickTime(unsigned int usPerBeat, double irqFreq,
   return (double(int(usPerBeat)) / (double(dTime) * 1000000.0));
 }
 
+void MIDIFile::smoothEventLoad(std::vector< size_t >& evtOrder,
+                               std::vector< long >& evtFrame,
+                               size_t maxEvents) const
+{
+  std::vector< size_t > newOrder;
+  std::vector< long >   newFrame;
+  // events not played yet, and the frame in which they were originally
+  std::vector< size_t > q;
+  std::vector< long >   qFrame;
+  std::vector< bool >   selected;
+  size_t  nMerged = 0;
+  size_t  i = 0;
+  long    f = 0L;
+  while (i < evtOrder.size() || q.size() > 0) {
+    if (q.size() < 1)
+      f = evtFrame[i];
+    for ( ; i < evtOrder.size() && evtFrame[i] <= f; i++) {
+      q.push_back(evtOrder[i]);
+      qFrame.push_back(evtFrame[i]);
+    }
+    if (q.size() > maxEvents) {
+      // remove controller, pitch bend and aftertouch events that are
+      // immediately followed on the same channel by a new value of the same
+      // parameter
+      for (size_t j = 0; j < q.size(); j++) {
+        const MIDIEvent&  e = evtBuf[q[j]];
+        if (eventDelayClass(e) < 2)
+          continue;
+        for (size_t k = j + 1; k < q.size(); k++) {
+          const MIDIEvent&  e2 = evtBuf[q[k]];
+          if (((e.st ^ e2.st) & 0x0F) != 0 || e2.st >= 0xF0)
+            continue;
+          if (e2.st == e.st &&
+              ((e.st & 0xF0) == 0xD0 || (e.st & 0xF0) == 0xE0 ||
+               e2.d1 == e.d1)) {
+            q.erase(q.begin() + j);
+            qFrame.erase(qFrame.begin() + j);
+            nMerged++;
+            j--;
+          }
+          break;
+        }
+      }
+    }
+    // events that cannot be delayed more, and all events before them on the
+    // same channel are played in this frame
+    selected.clear();
+    selected.resize(q.size(), false);
+    size_t  nSelected = 0;
+    {
+      bool    chnSelected[17];
+      for (int c = 0; c < 17; c++)
+        chnSelected[c] = false;
+      for (size_t j = q.size(); j-- > 0; ) {
+        const MIDIEvent&  e = evtBuf[q[j]];
+        int     c = (e.st < 0xF0 ? int(e.st & 0x0F) : 16);
+        int     n = eventDelayClass(e);
+        if (chnSelected[c] || n == 0 ||
+            (f - qFrame[j]) >= (n == 1 ? smoothNoteOnDelay : smoothMaxDelay)) {
+          selected[j] = true;
+          chnSelected[c] = true;
+          nSelected++;
+        }
+      }
+    }
+    // then the remaining events in order of delay class, the order of
+    // events on the same channel is not changed
+    while (nSelected < maxEvents) {
+      bool    chnBlocked[17];
+      for (int c = 0; c < 17; c++)
+        chnBlocked[c] = false;
+      size_t  bestPos = q.size();
+      int     bestClass = 4;
+      for (size_t j = 0; j < q.size(); j++) {
+        const MIDIEvent&  e = evtBuf[q[j]];
+        int     c = (e.st < 0xF0 ? int(e.st & 0x0F) : 16);
+        if (selected[j] || chnBlocked[c])
+          continue;
+        chnBlocked[c] = true;
+        if (eventDelayClass(e) < bestClass) {
+          bestPos = j;
+          bestClass = eventDelayClass(e);
+        }
+      }
+      if (bestPos >= q.size())
+        break;
+      selected[bestPos] = true;
+      nSelected++;
+    }
+    size_t  j = 0;
+    for (size_t k = 0; k < q.size(); k++) {
+      if (selected[k]) {
+        newOrder.push_back(q[k]);
+        newFrame.push_back(f);
+      }
+      else {
+        q[j] = q[k];
+        qFrame[j] = qFrame[k];
+        j++;
+      }
+    }
+    q.resize(j);
+    qFrame.resize(j);
+    f++;
+  }
+  // print the number of events per frame before and after smoothing
+  size_t  maxCnt[2] = { 0, 0 };
+  size_t  overCnt[2] = { 0, 0 };
+  for (int k = 0; k < 2; k++) {
+    const std::vector< long >&  t = (k == 0 ? evtFrame : newFrame);
+    for (size_t j = 0; j < t.size(); ) {
+      size_t  n = 1;
+      while ((j + n) < t.size() && t[j + n] == t[j])
+        n++;
+      maxCnt[k] = (n > maxCnt[k] ? n : maxCnt[k]);
+      if (n > maxEvents)
+        overCnt[k]++;
+      j = j + n;
+    }
+  }
+  size_t  nDelayed = 0;
+  long    maxDelay = 0L;
+  {
+    std::vector< long > origFrame(evtBuf.size(), 0L);
+    for (size_t j = 0; j < evtOrder.size(); j++)
+      origFrame[evtOrder[j]] = evtFrame[j];
+    for (size_t j = 0; j < newOrder.size(); j++) {
+      long    d = newFrame[j] - origFrame[newOrder[j]];
+      if (d > 0L)
+        nDelayed++;
+      maxDelay = (d > maxDelay ? d : maxDelay);
+    }
+  }
+  std::fprintf(stderr, "Events per frame: maximum %lu -> %lu, "
+                       "frames with more than %lu: %lu -> %lu\n",
+               (unsigned long) maxCnt[0], (unsigned long) maxCnt[1],
+               (unsigned long) maxEvents,
+               (unsigned long) overCnt[0], (unsigned long) overCnt[1]);
+  std::fprintf(stderr, "Delayed events: %lu (maximum %ld frames), "
+                       "merged events: %lu\n",
+               (unsigned long) nDelayed, maxDelay, (unsigned long) nMerged);
+  evtOrder = newOrder;
+  evtFrame = newFrame;
+}
+
 void MIDIFile::getRawData(std::vector< unsigned char >& outBuf,
                           double irqFreq, const Envelopes *env,
-                          int roundingBias, int quantizeTPQN) const
+                          int roundingBias, int quantizeTPQN,
+                          int maxFrameEvents) const
 {
   double  tickTime = calculateTickTime(500000U, irqFreq, quantizeTPQN);
   double  curTime = 0.0;
   long    prvTick = 0L;
   long    prvIRQCnt = 0L;
   unsigned char prvStatus = 0xFF;
+  // calculate the IRQ frame of all events
+  std::vector< size_t > evtOrder;
+  std::vector< long >   evtFrame;
   for (size_t i = 0; i < evtBuf.size(); i++) {
     long    curTick = long(evtBuf[i].t);
     curTime = curTime + (tickTime * (curTick - prvTick));
@@ -1070,73 +1462,410 @@ void MIDIFile::getRawData(std::vector< unsigned char >& outBuf,
       tickTime = calculateTickTime(evtBuf[i].getTempo(), irqFreq, quantizeTPQN);
     }
     else {
-      long    irqCnt = long(curTime * irqFreq + (double(roundingBias) / 256.0));
-      unsigned int  dt = (unsigned int) (irqCnt - prvIRQCnt);
-      if (!dt && evtBuf[i].st == prvStatus && (prvStatus & 0xF0) >= 0xA0 &&
-          ((prvStatus & 0xE0) == 0xC0 ||
-           evtBuf[i].d1 == outBuf[outBuf.size() - 2])) {
-        // delete redundant events
-        outBuf.resize(outBuf.size() - ((prvStatus & 0xE0) == 0xC0 ? 1 : 2));
-      }
-      else {
-        if (dt >= 0x4000U)
-          outBuf.push_back((unsigned char) (((dt >> 14) & 0x7F) | 0x80));
-        if (dt >= 0x80U)
-          outBuf.push_back((unsigned char) (((dt >> 7) & 0x7F) | 0x80));
-        outBuf.push_back((unsigned char) (dt & 0x7F));
-      }
-      if (evtBuf[i].st != prvStatus) {
-        prvStatus = evtBuf[i].st;
-        outBuf.push_back(prvStatus);
-      }
-      if (env && (prvStatus & 0xF0) == 0xC0)
-        outBuf.push_back(env->mapMIDIProgram(evtBuf[i].d1));
-      else
-        outBuf.push_back(evtBuf[i].d1);
-      if ((prvStatus & 0xE0) != 0xC0)
-        outBuf.push_back(evtBuf[i].d2);
-      prvIRQCnt = irqCnt;
+      evtOrder.push_back(i);
+      evtFrame.push_back(long(curTime * irqFreq
+                              + (double(roundingBias) / 256.0)));
+    }
+    prvTick = curTick;
+  }
+  if (maxFrameEvents > 0)
+    smoothEventLoad(evtOrder, evtFrame, size_t(maxFrameEvents));
+  for (size_t k = 0; k < evtOrder.size(); k++) {
+    size_t  i = evtOrder[k];
+    long    irqCnt = evtFrame[k];
+    unsigned int  dt = (unsigned int) (irqCnt - prvIRQCnt);
+    if (!dt && evtBuf[i].st == prvStatus && (prvStatus & 0xF0) >= 0xA0 &&
+        ((prvStatus & 0xE0) == 0xC0 ||
+         evtBuf[i].d1 == outBuf[outBuf.size() - 2])) {
+      // delete redundant events
+      outBuf.resize(outBuf.size() - ((prvStatus & 0xE0) == 0xC0 ? 1 : 2));
     }
+    else {
+      if (dt >= 0x4000U)
+        outBuf.push_back((unsigned char) (((dt >> 14) & 0x7F) | 0x80));
+      if (dt >= 0x80U)
+        outBuf.push_back((unsigned char) (((dt >> 7) & 0x7F) | 0x80));
+      outBuf.push_back((unsigned char) (dt & 0x7F));
+    }
+    if (evtBuf[i].st != prvStatus) {
+      prvStatus = evtBuf[i].st;
+      outBuf.push_back(prvStatus);
+    }
+    if (env && (prvStatus & 0xF0) == 0xC0)
+      outBuf.push_back(env->mapMIDIProgram(evtBuf[i].d1));
+    else
+      outBuf.push_back(evtBuf[i].d1);
+    if ((prvStatus & 0xE0) != 0xC0)
+      outBuf.push_back(evtBuf[i].d2);
+    prvIRQCnt = irqCnt;
+  }
+}
+
+long MIDIFile::getTickFrame(unsigned long t, double irqFreq,
+                            int roundingBias, int quantizeTPQN) const
+{
+  double  tickTime = calculateTickTime(500000U, irqFreq, quantizeTPQN);
+  double  curTime = 0.0;
+  long    prvTick = 0L;
+  for (size_t i = 0; i < evtBuf.size() && evtBuf[i].t <= t; i++) {
+    long    curTick = long(evtBuf[i].t);
+    curTime = curTime + (tickTime * (curTick - prvTick));
+    if (evtBuf[i].isTempo())
+      tickTime = calculateTickTime(evtBuf[i].getTempo(), irqFreq, quantizeTPQN);
     prvTick = curTick;
   }
+  curTime = curTime + (tickTime * (long(t) - prvTick));
+  return long(curTime * irqFreq + (double(roundingBias) / 256.0));
+}
+
+void MIDIFile::getLoopFrames(long& loopStart, long& loopEnd, double irqFreq,
+                             int roundingBias, int quantizeTPQN) const
+{
+  loopStart = -1L;
+  loopEnd = -1L;
+  if (loopStartTick >= 0L) {
+    loopStart = getTickFrame((unsigned long) loopStartTick, irqFreq,
+                             roundingBias, quantizeTPQN);
+  }
+  if (loopEndTick >= 0L) {
+    loopEnd = getTickFrame((unsigned long) loopEndTick, irqFreq,
+                           roundingBias, quantizeTPQN);
+  }
+}
+
+void MIDIFile::addEnvelopeEvents(Envelopes& env) const
+{
+  for (size_t i = 0; i < evtBuf.size(); i++) {
+    if (!evtBuf[i].isTempo())
+      env.midiEvent(evtBuf[i].st, evtBuf[i].d1, evtBuf[i].d2);
+  }
 }
 
 void MIDIFile::getAllData(std::vector< unsigned char >& outBuf,
                           const char *envFile, double irqFreq, bool renumberPgm,
-                          int roundingBias, int quantizeTPQN) const
+                          int roundingBias, int quantizeTPQN,
+                          int maxFrameEvents) const
 {
   size_t  envSize;
   outBuf.resize(16, 0x00);
   outBuf[1] = 'm';
   {
     Envelopes env(envFile);
-    for (size_t i = 0; i < evtBuf.size(); i++) {
-      if (!evtBuf[i].isTempo())
-        env.midiEvent(evtBuf[i].st, evtBuf[i].d1, evtBuf[i].d2);
-    }
+    addEnvelopeEvents(env);
     env.optimizeData(renumberPgm);
     env.saveData(outBuf);
     envSize = outBuf.size() - 16;
     if (envSize < (1024 + 6) || envSize > (1024 + Envelopes::env_buf_size))
       errorMessage("\"%s\": invalid envelope file size", envFile);
-    getRawData(outBuf, irqFreq, &env, roundingBias, quantizeTPQN);
+    getRawData(outBuf, irqFreq, &env, roundingBias, quantizeTPQN,
+               maxFrameEvents);
+  }
+  outBuf[2] = (unsigned char) ((outBuf.size() - 16) & 0xFF);
+  outBuf[3] = (unsigned char) ((outBuf.size() - 16) >> 8);
+  outBuf[4] = (unsigned char) (envSize & 0xFF);
+  outBuf[5] = (unsigned char) (envSize >> 8);
+  outBuf[6] = (unsigned char) ((outBuf.size() - (envSize + 16)) & 0xFF);
+  outBuf[7] = (unsigned char) ((outBuf.size() - (envSize + 16)) >> 8);
+}
+
+// Creates a bank of multiple songs that share the envelope data, which is
+// optimized for the programs and drums used by all songs. The file format
+// is the same as that of 'm' files, with the following differences:
+//   1:     'b'
+//   6-7:   size of the song table and the MIDI data of all songs
+//   8:     number of songs (1 to 255)
+// the envelope data is followed by a table of the MIDI data sizes of the
+// songs (2 bytes per song), and then the MIDI data of each song, which is
+// encoded in the same way as in 'm' files
+
+static void getSongBankData(std::vector< unsigned char >& outBuf,
+                            const char *envFile,
+                            const std::vector< const char * >& songFiles,
+                            double irqFreq, bool renumberPgm,
+                            int roundingBias, int quantizeTPQN,
+                            int maxFrameEvents)
+{
+  if (songFiles.size() < 1 || songFiles.size() > 255)
+    errorMessage("invalid number of songs in bank");
+  size_t  envSize;
+  // total size of the envelope data if each song was stored separately
+  size_t  separateEnvSize = 0;
+  outBuf.resize(16, 0x00);
+  outBuf[1] = 'b';
+  outBuf[8] = (unsigned char) songFiles.size();
+  Envelopes env(envFile);
+  for (size_t i = 0; i < songFiles.size(); i++) {
+    MIDIFile  midiFile(songFiles[i]);
+    env.resetMIDIState();
+    midiFile.addEnvelopeEvents(env);
+    Envelopes songEnv(envFile);
+    midiFile.addEnvelopeEvents(songEnv);
+    songEnv.optimizeData(renumberPgm);
+    std::vector< unsigned char >  tmpBuf;
+    songEnv.saveData(tmpBuf);
+    separateEnvSize = separateEnvSize + tmpBuf.size();
   }
+  env.optimizeData(renumberPgm);
+  env.saveData(outBuf);
+  envSize = outBuf.size() - 16;
+  if (envSize < (1024 + 6) || envSize > (1024 + Envelopes::env_buf_size))
+    errorMessage("\"%s\": invalid envelope file size", envFile);
+  outBuf.resize(outBuf.size() + (songFiles.size() * 2), 0x00);
+  for (size_t i = 0; i < songFiles.size(); i++) {
+    size_t  startPos = outBuf.size();
+    {
+      MIDIFile  midiFile(songFiles[i]);
+      midiFile.getRawData(outBuf, irqFreq, &env, roundingBias, quantizeTPQN,
+                          maxFrameEvents);
+    }
+    size_t  nBytes = outBuf.size() - startPos;
+    if (nBytes < 3)
+      errorMessage("\"%s\": no MIDI events", songFiles[i]);
+    outBuf[16 + envSize + (i * 2)] = (unsigned char) (nBytes & 0xFF);
+    outBuf[17 + envSize + (i * 2)] = (unsigned char) (nBytes >> 8);
+    std::fprintf(stderr, "Song %lu: %s, %lu bytes\n",
+                 (unsigned long) (i + 1), songFiles[i], (unsigned long) nBytes);
+  }
+  if ((outBuf.size() - 16) > 0xFFFF)
+    errorMessage("song bank is too large");
   outBuf[2] = (unsigned char) ((outBuf.size() - 16) & 0xFF);
   outBuf[3] = (unsigned char) ((outBuf.size() - 16) >> 8);
   outBuf[4] = (unsigned char) (envSize & 0xFF);
   outBuf[5] = (unsigned char) (envSize >> 8);
   outBuf[6] = (unsigned char) ((outBuf.size() - (envSize + 16)) & 0xFF);
   outBuf[7] = (unsigned char) ((outBuf.size() - (envSize + 16)) >> 8);
+  std::fprintf(stderr, "Envelope data: %lu bytes shared by %lu songs, "
+                       "%lu bytes in separate files\n",
+               (unsigned long) envSize, (unsigned long) songFiles.size(),
+               (unsigned long) separateEnvSize);
 }
 
 // ----------------------------------------------------------------------------
 
-static void renderDaveData(std::vector< unsigned char >& outBuf)
+// Writes DAVE register data as a log of only the registers changed in each
+// frame. The file format is:
+//   0:     0x00
+//   1:     'w'
+//   2-4:   total number of frames
+//   6-7:   number of frames per index entry
+//   8-11:  file position of the index
+//   12-14: number of index entries
+//   16-:   register writes, one record per changed register:
+//            byte 0 b0-b3 = register, b4-b7 = number of frames since the
+//                           previous record (the first is relative to
+//                           frame 0); if 15, the value - 15 follows as
+//                           7 bit groups, low bits first, b7 set if more
+//                           groups follow
+//            next byte      = register value
+//   index: 24 byte entries at the start of every 'frames per index entry'
+//          frames: file position (4 bytes) of the first record at or after
+//          the entry's frame, the frame of the previous record (4 bytes,
+//          0 if none), and the value of all registers before the frame
+//          (0xFF if not written yet)
+// all numbers are stored in little-endian byte order
+
+class DaveRegisterLog {
+ public:
+  static const size_t indexInterval = 256;
+ protected:
+  static const size_t writeBufferSize = 65536;
+  File&   f;
+  // records not written to the file yet
+  std::vector< unsigned char >  buf;
+  std::vector< unsigned char >  indexBuf;
+  size_t  filePos;
+  size_t  frameCnt;
+  size_t  prvFrame;
+  // -1 if the register was not written yet
+  int     prvRegs[16];
+  // --------
+  static void storeUInt32(std::vector< unsigned char >& buf, size_t n);
+  void flushBuffer();
+ public:
+  DaveRegisterLog(File& f_);
+  virtual ~DaveRegisterLog();
+  void writeFrame(const unsigned char *regs);
+  // write the index and the file header, this must be called after all
+  // frames are written
+  void finish();
+};
+
+void DaveRegisterLog::storeUInt32(std::vector< unsigned char >& buf, size_t n)
+{
+  buf.push_back((unsigned char) (n & 0xFF));
+  buf.push_back((unsigned char) ((n >> 8) & 0xFF));
+  buf.push_back((unsigned char) ((n >> 16) & 0xFF));
+  buf.push_back((unsigned char) ((n >> 24) & 0xFF));
+}
+
+void DaveRegisterLog::flushBuffer()
+{
+  f.writeBlock(buf);
+  filePos = filePos + buf.size();
+  buf.clear();
+}
+
+DaveRegisterLog::DaveRegisterLog(File& f_)
+  : f(f_),
+    filePos(16),
+    frameCnt(0),
+    prvFrame(0)
+{
+  for (size_t i = 0; i < 16; i++)
+    prvRegs[i] = -1;
+  buf.reserve(writeBufferSize + 64);
+  // the header is written again by finish()
+  buf.resize(16, 0x00);
+  f.writeBlock(buf);
+  buf.clear();
+}
+
+DaveRegisterLog::~DaveRegisterLog()
+{
+}
+
+void DaveRegisterLog::writeFrame(const unsigned char *regs)
+{
+  if ((frameCnt % indexInterval) == 0) {
+    storeUInt32(indexBuf, filePos + buf.size());
+    storeUInt32(indexBuf, prvFrame);
+    for (size_t i = 0; i < 16; i++)
+      indexBuf.push_back((unsigned char) (prvRegs[i] & 0xFF));
+  }
+  for (size_t i = 0; i < 16; i++) {
+    if (int(regs[i]) == prvRegs[i])
+      continue;
+    prvRegs[i] = regs[i];
+    size_t  d = frameCnt - prvFrame;
+    prvFrame = frameCnt;
+    if (d < 15) {
+      buf.push_back((unsigned char) ((d << 4) | i));
+    }
+    else {
+      buf.push_back((unsigned char) (0xF0 | i));
+      d = d - 15;
+      while (d >= 0x80) {
+        buf.push_back((unsigned char) ((d & 0x7F) | 0x80));
+        d = d >> 7;
+      }
+      buf.push_back((unsigned char) d);
+    }
+    buf.push_back(regs[i]);
+  }
+  frameCnt++;
+  if (buf.size() >= writeBufferSize)
+    flushBuffer();
+}
+
+void DaveRegisterLog::finish()
+{
+  flushBuffer();
+  size_t  indexPos = filePos;
+  f.writeBlock(indexBuf);
+  filePos = filePos + indexBuf.size();
+  if (frameCnt > 0x00FFFFFF || filePos > 0xFFFFFFFFUL)
+    errorMessage("register log is too long");
+  size_t  nEntries = indexBuf.size() / 24;
+  buf.resize(16, 0x00);
+  buf[1] = 'w';
+  buf[2] = (unsigned char) (frameCnt & 0xFF);
+  buf[3] = (unsigned char) ((frameCnt >> 8) & 0xFF);
+  buf[4] = (unsigned char) (frameCnt >> 16);
+  buf[6] = (unsigned char) (indexInterval & 0xFF);
+  buf[7] = (unsigned char) (indexInterval >> 8);
+  buf[8] = (unsigned char) (indexPos & 0xFF);
+  buf[9] = (unsigned char) ((indexPos >> 8) & 0xFF);
+  buf[10] = (unsigned char) ((indexPos >> 16) & 0xFF);
+  buf[11] = (unsigned char) ((indexPos >> 24) & 0xFF);
+  buf[12] = (unsigned char) (nEntries & 0xFF);
+  buf[13] = (unsigned char) ((nEntries >> 8) & 0xFF);
+  buf[14] = (unsigned char) (nEntries >> 16);
+  f.seek(0);
+  f.writeBlock(buf);
+  buf.clear();
+}
+
+// ----------------------------------------------------------------------------
+
+// Writes the note frequency and pan tables calculated by
+// DavePlay::initTables() as a C header and as an assembler include file, so
+// that the players can be built with the tables instead of calculating them
+// at run time (see DAVE_INIT_TABLES in daveplay.h and daveplay.s)
+
+static void appendTableLine(std::string& s, const char *prefix,
+                            const unsigned int *buf, size_t nValues,
+                            const char *suffix)
+{
+  char    tmpBuf[16];
+  s += prefix;
+  for (size_t i = 0; i < nValues; i++) {
+    std::sprintf(tmpBuf, (i > 0 ? ", %u" : "%u"), buf[i]);
+    s += tmpBuf;
+  }
+  s += suffix;
+}
+
+static void writeDaveTables(const char *cFileName, const char *asmFileName)
+{
+  std::vector< unsigned int > octTable(768);
+  std::vector< unsigned int > sinTable(256);
+  {
+    DavePlay  *davePlay = new DavePlay();
+    for (size_t i = 0; i < octTable.size(); i++)
+      octTable[i] = davePlay->getOctTable()[i];
+    for (size_t i = 0; i < sinTable.size(); i++)
+      sinTable[i] = davePlay->getSinTable()[i];
+    delete davePlay;
+  }
+  std::string cText = "\n/* generated by midiconv -tables, do not edit */\n"
+                      "\nstatic const unsigned int   oct_table[768] = {\n";
+  std::string asmText = "\n; generated by midiconv -tables, do not edit\n"
+                        "\noct_table_data:\n";
+  for (size_t i = 0; i < octTable.size(); i = i + 8) {
+    appendTableLine(cText, "  ", &(octTable[i]), 8,
+                    ((i + 8) < octTable.size() ? ",\n" : "\n"));
+    appendTableLine(asmText, "        defw    ", &(octTable[i]), 8, "\n");
+  }
+  cText += "};\n\nstatic const unsigned char  sin_table[256] = {\n";
+  asmText += "\nsin_table_data:\n";
+  for (size_t i = 0; i < sinTable.size(); i = i + 8) {
+    appendTableLine(cText, "  ", &(sinTable[i]), 8,
+                    ((i + 8) < sinTable.size() ? ",\n" : "\n"));
+    appendTableLine(asmText, "        defb    ", &(sinTable[i]), 8, "\n");
+  }
+  cText += "};\n";
+  {
+    std::vector< unsigned char >  tmpBuf(cText.begin(), cText.end());
+    File    f(cFileName, "wb");
+    f.writeBlock(tmpBuf);
+  }
+  {
+    std::vector< unsigned char >  tmpBuf(asmText.begin(), asmText.end());
+    File    f(asmFileName, "wb");
+    f.writeBlock(tmpBuf);
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+// if 'regLog' is not NULL, the frames are written to it, and 'outBuf' is
+// returned empty
+// if 'voiceFormat' is true, the MIDI data in 'outBuf' is replaced with the
+// events resolved to DAVE channels (see DavePlay::setVoiceBuffer()), and the
+// file type in the header is changed from 'm' to 'v', and the number of
+// virtual channels used ('nVirtChns', 4 or 8) is stored at offset 15
+
+static void renderDaveData(std::vector< unsigned char >& outBuf,
+                           DaveRegisterLog *regLog = (DaveRegisterLog *) 0,
+                           bool voiceFormat = false,
+                           unsigned char nVirtChns = 8)
 {
   size_t    envSize = size_t(outBuf[4]) | (size_t(outBuf[5]) << 8);
-  DavePlay  *davePlay = new DavePlay();
+  DavePlay  *davePlay = new DavePlay(nVirtChns);
   davePlay->loadEnvelopes(&(outBuf.front()) + 16, envSize);
   std::vector< unsigned char >  tmpBuf;
+  if (voiceFormat)
+    davePlay->setVoiceBuffer(&tmpBuf);
   unsigned char daveRegs[16];
   unsigned int  dTime = 0;
   unsigned char prvStatus = 0x00;
@@ -1157,6 +1886,12 @@ static void renderDaveData(std::vector< unsigned char >& outBuf)
     }
     for ( ; dTime > 0; dTime--) {
       davePlay->update(daveRegs);
+      if (regLog) {
+        regLog->writeFrame(&(daveRegs[0]));
+        continue;
+      }
+      if (voiceFormat)
+        continue;
       for (size_t j = 0; j < 16; j++)
         tmpBuf.push_back(daveRegs[j]);
     }
@@ -1186,49 +1921,700 @@ static void renderDaveData(std::vector< unsigned char >& outBuf)
     davePlay->midiEvent(st, d1, d2);
   }
   delete davePlay;
+  if (voiceFormat) {
+    if (tmpBuf.size() < 3)
+      errorMessage("no events in the voice data");
+    if ((envSize + tmpBuf.size()) > 0xFFFF)
+      errorMessage("voice data is too large");
+    outBuf.resize(envSize + 16);
+    outBuf.insert(outBuf.end(), tmpBuf.begin(), tmpBuf.end());
+    outBuf[1] = 'v';
+    outBuf[2] = (unsigned char) ((outBuf.size() - 16) & 0xFF);
+    outBuf[3] = (unsigned char) ((outBuf.size() - 16) >> 8);
+    outBuf[6] = (unsigned char) (tmpBuf.size() & 0xFF);
+    outBuf[7] = (unsigned char) (tmpBuf.size() >> 8);
+    outBuf[15] = nVirtChns;
+    return;
+  }
+  outBuf.clear();
+  outBuf.insert(outBuf.end(), tmpBuf.begin(), tmpBuf.end());
+}
+
+// MIDI or voice data that does not fit in the player's file buffer can be
+// split into banks of at most 16383 bytes, that are loaded to separate 16K
+// memory segments. In this case, the header fields at 2-3 and 6-7 are zero,
+// byte 10 is the number of banks, and the envelope data is followed by a
+// table of the bank sizes (2 bytes each), and then by the banks. A bank
+// contains only complete delta time and event pairs, so that the player can
+// switch to the next bank when it reaches the end of the current one.
+
+static const size_t midiBankSize = 16383;
+static const size_t midiMaxBanks = 64;
+
+// stores the start position and delta time of each delta time and event
+// pair of the MIDI or voice data in 'outBuf' to 'unitPos' and 'unitDTime'
+
+static void getMIDIDataUnits(const std::vector< unsigned char >& outBuf,
+                             bool voiceFormat, std::vector< size_t >& unitPos,
+                             std::vector< unsigned int >& unitDTime)
+{
+  size_t  envSize = size_t(outBuf[4]) | (size_t(outBuf[5]) << 8);
+  unsigned char prvStatus = 0x00;
+  unitPos.clear();
+  unitDTime.clear();
+  for (size_t i = envSize + 16; i < outBuf.size(); ) {
+    size_t  j = i;
+    unsigned int  dTime = outBuf[j] & 0x7F;
+    while (outBuf[j] >= 0x80 && (j - i) < 2 && (j + 1) < outBuf.size()) {
+      j++;
+      dTime = (dTime << 7) | (outBuf[j] & 0x7F);
+    }
+    j++;
+    if (j < outBuf.size()) {
+      unsigned char st = outBuf[j];
+      j++;
+      if (voiceFormat) {
+        if (st < 0x08)
+          j = j + 8;                    // channel start
+        else if (st >= 0x18 && st < 0x40)
+          j++;
+      }
+      else {
+        if (st >= 0x80) {
+          prvStatus = st;
+          j++;
+        }
+        if ((prvStatus & 0xE0) != 0xC0)
+          j++;
+      }
+      if (j > outBuf.size())
+        j = outBuf.size();
+    }
+    unitPos.push_back(i);
+    unitDTime.push_back(dTime);
+    i = j;
+  }
+}
+
+static void splitMIDIDataBanks(std::vector< unsigned char >& outBuf,
+                               bool voiceFormat)
+{
+  size_t  envSize = size_t(outBuf[4]) | (size_t(outBuf[5]) << 8);
+  std::vector< size_t > unitPos;
+  std::vector< unsigned int > unitDTime;
+  getMIDIDataUnits(outBuf, voiceFormat, unitPos, unitDTime);
+  unitPos.push_back(outBuf.size());
+  std::vector< size_t > bankSizes;
+  size_t  bankStart = envSize + 16;
+  for (size_t i = 1; i < unitPos.size(); i++) {
+    if ((unitPos[i] - bankStart) > midiBankSize) {
+      bankSizes.push_back(unitPos[i - 1] - bankStart);
+      bankStart = unitPos[i - 1];
+    }
+  }
+  if (outBuf.size() > bankStart)
+    bankSizes.push_back(outBuf.size() - bankStart);
+  if (bankSizes.size() < 1)
+    errorMessage("no MIDI data to be stored in banks");
+  if (bankSizes.size() > midiMaxBanks)
+    errorMessage("MIDI data is too large (%d banks)", int(bankSizes.size()));
+  std::vector< unsigned char >  bankTable;
+  for (size_t i = 0; i < bankSizes.size(); i++) {
+    bankTable.push_back((unsigned char) (bankSizes[i] & 0xFF));
+    bankTable.push_back((unsigned char) (bankSizes[i] >> 8));
+  }
+  outBuf.insert(outBuf.begin() + (envSize + 16),
+                bankTable.begin(), bankTable.end());
+  outBuf[2] = 0x00;
+  outBuf[3] = 0x00;
+  outBuf[6] = 0x00;
+  outBuf[7] = 0x00;
+  outBuf[10] = (unsigned char) bankSizes.size();
+}
+
+// the blocks written by -diskstream are loaded by the player alternately to
+// the two halves of its 31744 byte file buffer while playing the other half;
+// the size is chosen so that playing any block takes at least
+// diskStreamLeadTime seconds, the time available for loading the next one
+
+static const size_t diskStreamMinBlockSize = 1024;
+static const size_t diskStreamMaxBlockSize = 15872;
+static const double diskStreamLeadTime = 1.0;
+
+// split the units in 'unitPos' (with the end of the data as the last
+// element) to 'nBlocks' blocks of similar size, each storing at most
+// 'maxBytes' bytes; the index of the first unit of each block is stored
+// in 'blockStart', returns false if the units do not fit
+
+static bool packDiskStreamBlocks(std::vector< size_t >& blockStart,
+                                 const std::vector< size_t >& unitPos,
+                                 size_t nBlocks, size_t maxBytes)
+{
+  size_t  nUnits = unitPos.size() - 1;
+  size_t  nBytes = unitPos[nUnits] - unitPos[0];
+  size_t  i = 0;
+  blockStart.clear();
+  for (size_t j = 0; j < nBlocks && i < nUnits; j++) {
+    size_t  startPos = unitPos[i];
+    size_t  endPos = unitPos[0] + ((nBytes * (j + 1)) / nBlocks);
+    blockStart.push_back(i);
+    i++;
+    while (i < nUnits && (unitPos[i + 1] - startPos) <= maxBytes) {
+      // end the block at the unit boundary closest to the ideal position
+      if (unitPos[i] >= endPos ||
+          (unitPos[i + 1] > endPos &&
+           (unitPos[i + 1] - endPos) > (endPos - unitPos[i]))) {
+        break;
+      }
+      i++;
+    }
+    if ((unitPos[i] - startPos) > maxBytes)
+      return false;
+  }
+  return (i >= nUnits);
+}
+
+static void splitDiskStreamBlocks(std::vector< unsigned char >& outBuf,
+                                  bool voiceFormat, double irqFreq)
+{
+  size_t  envSize = size_t(outBuf[4]) | (size_t(outBuf[5]) << 8);
+  std::vector< size_t > unitPos;
+  std::vector< unsigned int > unitDTime;
+  getMIDIDataUnits(outBuf, voiceFormat, unitPos, unitDTime);
+  if (unitPos.size() < 1)
+    errorMessage("no MIDI data to be streamed");
+  unitPos.push_back(outBuf.size());
+  size_t  nUnits = unitDTime.size();
+  size_t  nBytes = outBuf.size() - (envSize + 16);
+  unsigned long leadFrames = (unsigned long) (diskStreamLeadTime * irqFreq
+                                              + 0.999);
+  std::vector< size_t > blockStart;
+  size_t  blockSize = 0;
+  unsigned long minFrames = 0UL;
+  for (size_t n = diskStreamMinBlockSize;
+       n <= diskStreamMaxBlockSize && minFrames < leadFrames; n += 1024) {
+    size_t  nBlocks = (nBytes + (n - 3)) / (n - 2);
+    while (!packDiskStreamBlocks(blockStart, unitPos, nBlocks, n - 2))
+      nBlocks++;
+    blockSize = n;
+    minFrames = 0xFFFFFFFFUL;
+    for (size_t i = 0; i < blockStart.size(); i++) {
+      size_t  endUnit = ((i + 1) < blockStart.size() ?
+                         blockStart[i + 1] : nUnits);
+      unsigned long nFrames = 0UL;
+      for (size_t j = blockStart[i]; j < endUnit; j++)
+        nFrames += unitDTime[j];
+      if (nFrames < minFrames)
+        minFrames = nFrames;
+    }
+  }
+  std::fprintf(stderr, "Stream block size: %lu bytes, %lu blocks, "
+                       "minimum lead time: %.3f s\n",
+               (unsigned long) blockSize, (unsigned long) blockStart.size(),
+               double(minFrames) / irqFreq);
+  if (minFrames < leadFrames) {
+    std::fprintf(stderr, "WARNING: event density is too high for "
+                         "streaming, playback may be delayed\n");
+  }
+  std::vector< unsigned char >  tmpBuf;
+  for (size_t i = 0; i < blockStart.size(); i++) {
+    size_t  startPos = unitPos[blockStart[i]];
+    size_t  endPos = ((i + 1) < blockStart.size() ?
+                      unitPos[blockStart[i + 1]] : outBuf.size());
+    size_t  n = endPos - startPos;
+    tmpBuf.push_back((unsigned char) (n & 0xFF));
+    tmpBuf.push_back((unsigned char) ((n >> 8)
+                                      | ((i + 1) < blockStart.size() ?
+                                         0x00 : 0x80)));
+    tmpBuf.insert(tmpBuf.end(),
+                  outBuf.begin() + startPos, outBuf.begin() + endPos);
+    tmpBuf.resize((i + 1) * blockSize, 0x00);
+  }
+  outBuf.resize(envSize + 16);
+  outBuf.insert(outBuf.end(), tmpBuf.begin(), tmpBuf.end());
+  outBuf[2] = 0x00;
+  outBuf[3] = 0x00;
+  outBuf[6] = 0x00;
+  outBuf[7] = 0x00;
+  outBuf[11] = (unsigned char) (blockSize >> 8);
+}
+
+// MIDI data index (-index), stored after the MIDI data in 'm' files, with
+// the size in bytes 12 and 13 of the header:
+//   0-1:   number of entries
+//   2-3:   number of frames between entries
+//   4-5:   loop end position in the MIDI data (0 = no loop)
+//   6-7:   number of frames from the last event before the loop end to the
+//          loop end
+//   8-:    loop start entry, followed by the entries at every 'frames between
+//          entries' frames, starting from frame 0
+// each entry (104 bytes) stores the state of the player before the events of
+// its frame:
+//   0-1:   position of the first event at or after the frame (not including
+//          its delta time) in the MIDI data
+//   2-3:   number of frames from the entry to that event
+//   4-6:   frame
+//   7:     MIDI running status
+//   8-23:  program of each MIDI channel
+//   24-39: pitch bend of each MIDI channel (8 bits)
+//   40-103: distortion, channel allocation control, pan and volume of each
+//          MIDI channel
+
+struct MIDIIndexState {
+  unsigned char prvStatus;
+  unsigned char program[16];
+  unsigned char pitchBend[16];
+  unsigned char ctrlState[16][4];
+  // --------
+  MIDIIndexState()
+    : prvStatus(0x00)
+  {
+    for (int i = 0; i < 16; i++) {
+      program[i] = 0;
+      pitchBend[i] = 0x80;
+      ctrlState[i][0] = 0x00;
+      ctrlState[i][1] = 0;
+      ctrlState[i][2] = 64;
+      ctrlState[i][3] = 127;
+    }
+  }
+  // update the state with the event at 'buf' (after the delta time)
+  void midiEvent(const unsigned char *buf)
+  {
+    unsigned char st = buf[0];
+    if (st >= 0x80) {
+      prvStatus = st;
+      buf++;
+    }
+    unsigned char c = prvStatus & 0x0F;
+    unsigned char d1 = buf[0];
+    unsigned char d2 = ((prvStatus & 0xE0) != 0xC0 ? buf[1] : 0x00);
+    switch (prvStatus & 0xF0) {
+    case 0xB0:
+      switch (d1) {
+      case 7:
+        ctrlState[c][3] = d2;
+        break;
+      case 10:
+        ctrlState[c][2] = d2;
+        break;
+      case 70:
+      case 77:
+        ctrlState[c][1] = d2;
+        break;
+      case 71:
+      case 76:
+        ctrlState[c][0] = d2;
+        break;
+      case 121:
+        ctrlState[c][0] = 0x00;
+        ctrlState[c][1] = 0;
+        ctrlState[c][2] = 64;
+        ctrlState[c][3] = 127;
+        pitchBend[c] = 0x80;
+        break;
+      }
+      break;
+    case 0xC0:
+      program[c] = d1;
+      break;
+    case 0xE0:
+      pitchBend[c] = (unsigned char) ((((unsigned int) d2 << 7) | d1) >> 6);
+      break;
+    }
+  }
+  void writeEntry(std::vector< unsigned char >& buf, size_t evtPos,
+                  unsigned int dTime, long frame) const
+  {
+    if (dTime > 0x7FFFU)
+      errorMessage("MIDI data index: delta time is out of range");
+    buf.push_back((unsigned char) (evtPos & 0xFF));
+    buf.push_back((unsigned char) (evtPos >> 8));
+    buf.push_back((unsigned char) (dTime & 0xFF));
+    buf.push_back((unsigned char) (dTime >> 8));
+    buf.push_back((unsigned char) (frame & 0xFF));
+    buf.push_back((unsigned char) ((frame >> 8) & 0xFF));
+    buf.push_back((unsigned char) ((frame >> 16) & 0xFF));
+    buf.push_back(prvStatus);
+    buf.insert(buf.end(), &(program[0]), &(program[0]) + 16);
+    buf.insert(buf.end(), &(pitchBend[0]), &(pitchBend[0]) + 16);
+    buf.insert(buf.end(), &(ctrlState[0][0]), &(ctrlState[0][0]) + 64);
+  }
+};
+
+// 'loopStart' and 'loopEnd' are frame numbers, or -1 to loop at the
+// beginning or end of the data; the index is written without a loop if both
+// are negative
+
+static void addMIDIDataIndex(std::vector< unsigned char >& outBuf,
+                             long indexFrames, long loopStart, long loopEnd)
+{
+  size_t  envSize = size_t(outBuf[4]) | (size_t(outBuf[5]) << 8);
+  size_t  dataStart = envSize + 16;
+  std::vector< size_t > unitPos;
+  std::vector< unsigned int > unitDTime;
+  getMIDIDataUnits(outBuf, false, unitPos, unitDTime);
+  if (unitPos.size() < 1)
+    errorMessage("no MIDI data to be indexed");
+  size_t  nUnits = unitPos.size();
+  // frame of each event, and its position after the delta time
+  std::vector< long >   unitFrame(nUnits);
+  std::vector< size_t > evtPos(nUnits);
+  long    f = 0L;
+  for (size_t i = 0; i < nUnits; i++) {
+    f = f + long(unitDTime[i]);
+    unitFrame[i] = f;
+    size_t  j = unitPos[i];
+    while (outBuf[j] >= 0x80 && (j - unitPos[i]) < 2)
+      j++;
+    evtPos[i] = j + 1 - dataStart;
+  }
+  if ((outBuf.size() - dataStart) > 0xFFFFU)
+    errorMessage("MIDI data is too large for the index");
+  if (indexFrames < 1L || indexFrames > 0xFFFFL)
+    errorMessage("invalid MIDI data index interval");
+  bool    loopEnabled = (loopStart >= 0L || loopEnd >= 0L);
+  size_t  loopStartUnit = 0;
+  size_t  loopEndUnit = nUnits;
+  unsigned int  loopEndDTime = 0U;
+  if (loopStart < 0L)
+    loopStart = 0L;
+  while (loopStartUnit < nUnits && unitFrame[loopStartUnit] < loopStart)
+    loopStartUnit++;
+  if (loopEnd >= 0L) {
+    loopEndUnit = 0;
+    while (loopEndUnit < nUnits && unitFrame[loopEndUnit] < loopEnd)
+      loopEndUnit++;
+    if (loopEndUnit > 0) {
+      if ((loopEnd - unitFrame[loopEndUnit - 1]) > 0x7FFFL)
+        errorMessage("loop end is too far after the last event");
+      loopEndDTime = (unsigned int) (loopEnd - unitFrame[loopEndUnit - 1]);
+    }
+  }
+  if (loopEnabled && loopStartUnit >= loopEndUnit)
+    errorMessage("invalid loop points (no events between start and end)");
+  std::vector< unsigned char >  loopEntry;
+  std::vector< unsigned char >  indexBuf;
+  MIDIIndexState  st;
+  size_t  nEntries = 0;
+  size_t  i = 0;
+  do {
+    long    entryFrame = long(nEntries) * indexFrames;
+    for ( ; i < nUnits && unitFrame[i] < entryFrame; i++) {
+      if (i == loopStartUnit) {
+        loopEntry.clear();
+        st.writeEntry(loopEntry, evtPos[i],
+                      (unsigned int) (unitFrame[i] - loopStart), loopStart);
+      }
+      st.midiEvent(&(outBuf.front()) + (dataStart + evtPos[i]));
+    }
+    // no entries after the loop end, since the player stops there, and the
+    // last entry is used when seeking beyond it
+    if (i >= loopEndUnit)
+      break;
+    st.writeEntry(indexBuf, evtPos[i],
+                  (unsigned int) (unitFrame[i] - entryFrame), entryFrame);
+    nEntries++;
+  } while (true);
+  std::vector< unsigned char >  tmpBuf;
+  tmpBuf.push_back((unsigned char) (nEntries & 0xFF));
+  tmpBuf.push_back((unsigned char) (nEntries >> 8));
+  tmpBuf.push_back((unsigned char) (indexFrames & 0xFF));
+  tmpBuf.push_back((unsigned char) (indexFrames >> 8));
+  size_t  loopEndPos = (loopEnabled ?
+                        (loopEndUnit < nUnits ?
+                         unitPos[loopEndUnit] : outBuf.size()) - dataStart
+                        : 0);
+  tmpBuf.push_back((unsigned char) (loopEndPos & 0xFF));
+  tmpBuf.push_back((unsigned char) (loopEndPos >> 8));
+  tmpBuf.push_back((unsigned char) (loopEndDTime & 0xFF));
+  tmpBuf.push_back((unsigned char) (loopEndDTime >> 8));
+  tmpBuf.insert(tmpBuf.end(), loopEntry.begin(), loopEntry.end());
+  tmpBuf.insert(tmpBuf.end(), indexBuf.begin(), indexBuf.end());
+  if (tmpBuf.size() > 0xFFFFU)
+    errorMessage("MIDI data index is too large");
+  outBuf.insert(outBuf.end(), tmpBuf.begin(), tmpBuf.end());
+  outBuf[2] = (unsigned char) ((outBuf.size() - 16) & 0xFF);
+  outBuf[3] = (unsigned char) ((outBuf.size() - 16) >> 8);
+  outBuf[12] = (unsigned char) (tmpBuf.size() & 0xFF);
+  outBuf[13] = (unsigned char) (tmpBuf.size() >> 8);
+}
+
+// Rendered DAVE register data can be stored with a reversible transform
+// that makes it more compressible, or in a format that can be decompressed
+// while playing. In this case the frames are preceded by a 16 byte header:
+//   0:     0x00
+//   1:     'r'
+//   2-4:   number of 16 byte frames
+//   8:     transform type: 0 = none, 1 = each byte is the difference from
+//          the same register in the previous frame (mod 256), 2 = blocks of
+//          frames are stored in column-major order, i.e. all values of
+//          register 0 in the block first, then register 1, etc.
+//   9:     0x02 if the data after the header is compressed, 0x00 otherwise
+//   10-11: number of frames per block for type 2, the last block may be
+//          shorter
+//   12-13: maximum LZ77 match offset in the compressed data (0 = 65536),
+//          type 0 data can be decompressed to a ring buffer of this size
+//          during playback
+
+static const unsigned char renderTransformNone = 0x00;
+static const unsigned char renderTransformDelta = 0x01;
+static const unsigned char renderTransformTranspose = 0x02;
+// ring buffer size of the player (RING_BUF_SIZE in globals.s)
+static const size_t streamWindowSize = 8192;
+// the player loads the whole -stream file including the header to its file
+// buffer (FILE_BUF_SIZE in globals.s)
+static const size_t streamMaxFileSize = 31744;
+
+static void transformDaveData(std::vector< unsigned char >& outBuf,
+                              unsigned char transformType, size_t blockSize)
+{
+  size_t  nFrames = outBuf.size() >> 4;
+  if (nFrames > 0x00FFFFFF)
+    errorMessage("rendered data is too long");
+  if (transformType == renderTransformTranspose &&
+      (blockSize < 1 || blockSize > 0xFFFF)) {
+    errorMessage("invalid transform block size");
+  }
+  std::vector< unsigned char >  tmpBuf(16, 0x00);
+  tmpBuf[1] = 'r';
+  tmpBuf[2] = (unsigned char) (nFrames & 0xFF);
+  tmpBuf[3] = (unsigned char) ((nFrames >> 8) & 0xFF);
+  tmpBuf[4] = (unsigned char) (nFrames >> 16);
+  tmpBuf[8] = transformType;
+  if (transformType == renderTransformTranspose) {
+    tmpBuf[10] = (unsigned char) (blockSize & 0xFF);
+    tmpBuf[11] = (unsigned char) (blockSize >> 8);
+  }
+  tmpBuf.resize(16 + (nFrames << 4));
+  unsigned char *p = &(tmpBuf.front()) + 16;
+  if (transformType == renderTransformNone) {
+    if (nFrames > 0)
+      std::memcpy(p, &(outBuf.front()), nFrames << 4);
+  }
+  else if (transformType == renderTransformDelta) {
+    unsigned char prvRegs[16];
+    std::memset(&(prvRegs[0]), 0x00, 16);
+    for (size_t i = 0; i < (nFrames << 4); i++) {
+      p[i] = (unsigned char) ((outBuf[i] - prvRegs[i & 15]) & 0xFF);
+      prvRegs[i & 15] = outBuf[i];
+    }
+  }
+  else {
+    for (size_t i = 0; i < nFrames; i = i + blockSize) {
+      size_t  n = (blockSize < (nFrames - i) ? blockSize : (nFrames - i));
+      for (size_t j = 0; j < 16; j++) {
+        for (size_t k = 0; k < n; k++)
+          p[(i << 4) + (j * n) + k] = outBuf[((i + k) << 4) + j];
+      }
+    }
+  }
   outBuf.clear();
   outBuf.insert(outBuf.end(), tmpBuf.begin(), tmpBuf.end());
 }
 
+// convert uncompressed data written by transformDaveData() back to
+// 16 byte frames
+
+static void untransformDaveData(std::vector< unsigned char >& outBuf)
+{
+  if (outBuf.size() < 16 || outBuf[0] != 0x00 || outBuf[1] != 'r')
+    errorMessage("invalid rendered data header");
+  if (outBuf[9] != 0x00)
+    errorMessage("rendered data must be decompressed first");
+  size_t  nFrames = size_t(outBuf[2]) | (size_t(outBuf[3]) << 8)
+                    | (size_t(outBuf[4]) << 16);
+  unsigned char transformType = outBuf[8];
+  size_t  blockSize = size_t(outBuf[10]) | (size_t(outBuf[11]) << 8);
+  if (outBuf.size() != (16 + (nFrames << 4)))
+    errorMessage("invalid rendered data size");
+  if (!(transformType == renderTransformNone ||
+        transformType == renderTransformDelta ||
+        (transformType == renderTransformTranspose && blockSize > 0))) {
+    errorMessage("invalid rendered data transform");
+  }
+  std::vector< unsigned char >  tmpBuf(nFrames << 4);
+  const unsigned char *p = &(outBuf.front()) + 16;
+  if (transformType == renderTransformNone) {
+    if (nFrames > 0)
+      std::memcpy(&(tmpBuf.front()), p, nFrames << 4);
+  }
+  else if (transformType == renderTransformDelta) {
+    unsigned char prvRegs[16];
+    std::memset(&(prvRegs[0]), 0x00, 16);
+    for (size_t i = 0; i < (nFrames << 4); i++) {
+      prvRegs[i & 15] = (unsigned char) ((prvRegs[i & 15] + p[i]) & 0xFF);
+      tmpBuf[i] = prvRegs[i & 15];
+    }
+  }
+  else {
+    for (size_t i = 0; i < nFrames; i = i + blockSize) {
+      size_t  n = (blockSize < (nFrames - i) ? blockSize : (nFrames - i));
+      for (size_t j = 0; j < 16; j++) {
+        for (size_t k = 0; k < n; k++)
+          tmpBuf[((i + k) << 4) + j] = p[(i << 4) + (j * n) + k];
+      }
+    }
+  }
+  outBuf.clear();
+  outBuf.insert(outBuf.end(), tmpBuf.begin(), tmpBuf.end());
+}
+
+static void printCompressionStats(size_t nBytes, uint64_t decodeCycles)
+{
+  // the Z80 runs at 4 MHz while decompressing to system RAM
+  std::fprintf(stderr, "Compressed size: %lu bytes, "
+                       "estimated decompression time: %.3f s "
+                       "(%lu Z80 cycles)\n",
+               (unsigned long) nBytes, double(decodeCycles) / 4000000.0,
+               (unsigned long) decodeCycles);
+}
+
+// checksum of the envelope dictionary, stored in byte 14 of the header of
+// files compressed with -envdict; the player calculates it on ENVELOPE.BIN
+// to check that it is the same file that was used as the dictionary
+
+static unsigned char envDictChecksum(const std::vector< unsigned char >& buf)
+{
+  unsigned char crcVal = 0xFF;
+  for (size_t i = 0; i < buf.size(); i++) {
+    unsigned int  tmp = (unsigned int) crcVal ^ (unsigned int) buf[i];
+    tmp = ((tmp << 1) + ((tmp & 0x80U) >> 7) + 0xACU) & 0xFFU;
+    crcVal = (unsigned char) tmp;
+  }
+  return crcVal;
+}
+
+// compressor parameters set on the command line
+
+struct CompressionOptions {
+  int     compressLevel;
+  int     decodeSpeedWeight;
+  int     splitCandidateLimit;
+  int     longMatchFrameSize;
+  int     longMatchMemoryLimit;         // in MB
+  int     matchTableMemoryLimit;        // in MB
+  double  timeBudget;                   // seconds, 0.0 = no limit
+  size_t  maxOffset;                    // 0 = no limit
+  // --------
+  CompressionOptions()
+    : compressLevel(0),
+      decodeSpeedWeight(0),
+      splitCandidateLimit(0),
+      longMatchFrameSize(0),
+      longMatchMemoryLimit(0),
+      matchTableMemoryLimit(0),
+      timeBudget(0.0),
+      maxOffset(0)
+  {
+  }
+};
+
+static double getWallClockTime()
+{
+  return std::chrono::duration< double >(
+             std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// compress 'inBuf' to 'outBuf' with the options in 'opts', using 'dict' as
+// a dictionary if it is not NULL; 'endTime' is the wall clock time at which
+// all compression should be finished (0.0 = no limit), and the statistics
+// are appended to 'report' if it is not NULL; returns the estimated number
+// of Z80 cycles needed for decompression
+
+static uint64_t compressBlock(std::vector< unsigned char >& outBuf,
+                              const std::vector< unsigned char >& inBuf,
+                              const CompressionOptions& opts, double endTime,
+                              const std::vector< unsigned char > *dict,
+                              std::string *report)
+{
+  Ep128Compress::Compressor_M2  compressor(outBuf);
+  compressor.setCompressionLevel(opts.compressLevel);
+  compressor.setDecodeSpeedWeight(opts.decodeSpeedWeight);
+  compressor.setSplitCandidateLimit(opts.splitCandidateLimit);
+  compressor.setLongMatchSearch(opts.longMatchFrameSize,
+                                size_t(opts.longMatchMemoryLimit) << 20);
+  compressor.setMatchTableMemoryLimit(size_t(opts.matchTableMemoryLimit)
+                                      << 20);
+  compressor.setMaxOffset(opts.maxOffset);
+  if (endTime > 0.0) {
+    // the time budget is shared by all data compressed
+    double  t = endTime - getWallClockTime();
+    compressor.setTimeBudget(t > 0.001 ? t : 0.001);
+  }
+  if (dict)
+    compressor.setDictionary(&(dict->front()), dict->size());
+  compressor.compressData(inBuf, 0xFFFFFFFFU, true, true);
+  if (report)
+    compressor.getStatisticsJSON(*report, 2);
+  return compressor.getDecodeCycles();
+}
+
+// if 'envDict' is not NULL, the envelope data is compressed using it as a
+// dictionary, which is expected to be loaded from ENVELOPE.BIN by the player;
+// the MIDI data is always compressed without a dictionary, since it has
+// little in common with the envelopes, and the player decompresses it to the
+// start of the file buffer, where the dictionary is not kept;
+// if 'report' is not NULL, compression statistics are stored in it in JSON
+// format
+
 static void compressOutputData(std::vector< unsigned char >& outBuf,
-                               int compressLevel, bool rawFormat)
+                               const CompressionOptions& opts, bool rawFormat,
+                               const std::vector< unsigned char > *envDict,
+                               std::string *report)
 {
+  double  endTime = 0.0;
+  if (opts.timeBudget > 0.0)
+    endTime = getWallClockTime() + opts.timeBudget;
   std::vector< unsigned char >  tmpBuf;
   if (rawFormat) {
     tmpBuf.insert(tmpBuf.end(), outBuf.begin(), outBuf.end());
     outBuf.clear();
-    Ep128Compress::Compressor_M2  compressor(outBuf);
-    compressor.setCompressionLevel(compressLevel);
-    compressor.compressData(tmpBuf, 0xFFFFFFFFU, true, true);
+    if (report)
+      (*report) = "{\n  \"data\": ";
+    uint64_t  decodeCycles =
+        compressBlock(outBuf, tmpBuf, opts, endTime,
+                      (std::vector< unsigned char > *) 0, report);
+    if (report)
+      (*report) += "\n}\n";
+    printCompressionStats(outBuf.size(), decodeCycles);
     return;
   }
+  uint64_t  decodeCycles = 0UL;
   std::vector< unsigned char >  tmpBuf2;
   size_t  envSize = size_t(outBuf[4]) | (size_t(outBuf[5]) << 8);
   tmpBuf.insert(tmpBuf.end(),
                 outBuf.begin() + 16, outBuf.begin() + 16 + envSize);
-  {
-    Ep128Compress::Compressor_M2  compressor(tmpBuf2);
-    compressor.setCompressionLevel(compressLevel);
-    compressor.compressData(tmpBuf, 0xFFFFFFFFU, true, true);
-  }
+  if (report)
+    (*report) = "{\n  \"envelope\": ";
+  decodeCycles += compressBlock(tmpBuf2, tmpBuf, opts, endTime, envDict,
+                                report);
   tmpBuf.clear();
   tmpBuf.insert(tmpBuf.end(), outBuf.begin() + 16 + envSize, outBuf.end());
   outBuf.resize(16);
   outBuf.insert(outBuf.end(), tmpBuf2.begin(), tmpBuf2.end());
-  outBuf[9] = 0x02;
+  outBuf[9] = (unsigned char) (envDict ? 0x03 : 0x02);
   outBuf[10] = (unsigned char) (tmpBuf2.size() & 0xFF);
   outBuf[11] = (unsigned char) (tmpBuf2.size() >> 8);
-  tmpBuf2.clear();
-  {
-    Ep128Compress::Compressor_M2  compressor(tmpBuf2);
-    compressor.setCompressionLevel(compressLevel);
-    compressor.compressData(tmpBuf, 0xFFFFFFFFU, true, true);
+  if (envDict) {
+    outBuf[12] = (unsigned char) (envDict->size() & 0xFF);
+    outBuf[13] = (unsigned char) (envDict->size() >> 8);
+    outBuf[14] = envDictChecksum(*envDict);
   }
+  tmpBuf2.clear();
+  if (report)
+    (*report) += ",\n  \"midi\": ";
+  decodeCycles += compressBlock(tmpBuf2, tmpBuf, opts, endTime,
+                                (std::vector< unsigned char > *) 0, report);
+  if (report)
+    (*report) += "\n}\n";
   outBuf.insert(outBuf.end(), tmpBuf2.begin(), tmpBuf2.end());
   outBuf[2] = (unsigned char) ((outBuf.size() - 16) & 0xFF);
   outBuf[3] = (unsigned char) ((outBuf.size() - 16) >> 8);
+  printCompressionStats(outBuf.size() - 16, decodeCycles);
 }
 
+#ifndef MIDICONV_NO_MAIN
 int main(int argc, char **argv)
 {
   try {
@@ -1237,6 +2623,12 @@ int main(int argc, char **argv)
                    "Usage: midiconv INFILE.MID OUTFILE.BIN "
                    "ENVELOPE.TXT|ENVELOPE.BIN|-raw [OPTIONS]\n");
       std::fprintf(stderr, "       midiconv ENVELOPE.TXT ENVELOPE.BIN -env\n");
+      std::fprintf(stderr, "       midiconv INFILE.BIN OUTFILE.BIN "
+                           "-untransform\n");
+      std::fprintf(stderr, "       midiconv ENVELOPE.TXT|ENVELOPE.BIN "
+                           "OUTFILE.BIN -bank SONG1.MID [SONG2.MID...] "
+                           "[OPTIONS]\n");
+      std::fprintf(stderr, "       midiconv DAVETBL.H DAVETBL.S -tables\n");
       std::fprintf(stderr, "Options:\n");
       std::fprintf(stderr, "    IRQFREQ (Hz, default = 50.0363257)\n");
       std::fprintf(stderr, "    -optsort\n");
@@ -1244,18 +2636,112 @@ int main(int argc, char **argv)
       std::fprintf(stderr, "    -quantN (quantize IRQ / quarter note, "
                            "N = 0 to 9)\n");
       std::fprintf(stderr, "    -biasN (N = 0 to 99, default = 25)\n");
+      std::fprintf(stderr, "    -maxevN (delay events to limit the number "
+                           "of events per IRQ to N,\n"
+                           "             N = 0 to 99, 0 = no limit, "
+                           "default = 0)\n");
+      std::fprintf(stderr, "    -halfrateN (update slow envelope segments "
+                           "on every second IRQ,\n"
+                           "                N = maximum volume error, "
+                           "0 to 9, default = 0;\n"
+                           "                with N = 0, only identical "
+                           "frames are merged, and the sound\n"
+                           "                is not changed)\n");
+      std::fprintf(stderr, "    -no-halfrate (disable -halfrate)\n");
+      std::fprintf(stderr, "    -chnsN (number of virtual channels used by "
+                           "-render and -voice,\n"
+                           "            N = 4 or 8, default = 8, must match "
+                           "the player)\n");
       std::fprintf(stderr, "    -0..9 (compression level)\n");
+      std::fprintf(stderr, "    -speedN (decompression speed vs. size, "
+                           "N = 0 to 99, default = 0)\n");
+      std::fprintf(stderr, "    -mergeN (compress only the N best block "
+                           "merge candidates,\n"
+                           "             N = 0 to 99, 0 = all, "
+                           "default = 0)\n");
+      std::fprintf(stderr, "    -longN (search matches beyond 64K, "
+                           "N = hash table size in MB,\n"
+                           "            N = 1 to 99, default = 16)\n");
+      std::fprintf(stderr, "    -memN (limit the match table size to N MB, "
+                           "N = 1 to 99)\n");
+      std::fprintf(stderr, "    -time-budget SECONDS (limit the wall clock "
+                           "time of compression,\n"
+                           "                          the result may be "
+                           "larger)\n");
       std::fprintf(stderr, "    -render\n");
+      std::fprintf(stderr, "    -reglog (write rendered data as a log of "
+                           "register changes)\n");
+      std::fprintf(stderr, "    -stream (write compressed rendered data "
+                           "that can be played while\n"
+                           "             decompressing, implies -render; "
+                           "the whole file is loaded,\n"
+                           "             and it must not be larger than "
+                           "31744 bytes)\n");
+      std::fprintf(stderr, "    -voice (write events with the DAVE channels "
+                           "already allocated)\n");
+      std::fprintf(stderr, "    -banked (split MIDI or voice data into "
+                           "16K banks for long songs)\n");
+      std::fprintf(stderr, "    -diskstream (write MIDI or voice data in "
+                           "blocks that are loaded while\n"
+                           "                 playing)\n");
+      std::fprintf(stderr, "    -indexN (add a seek index with an entry "
+                           "every N seconds, N = 1 to 99,\n"
+                           "             default = 10, the loop is set by "
+                           "loopStart and loopEnd\n"
+                           "             markers)\n");
+      std::fprintf(stderr, "    -loop START END (loop between START and "
+                           "END seconds, implies -index)\n");
+      std::fprintf(stderr, "    -delta (store rendered data as differences "
+                           "from the previous frame)\n");
+      std::fprintf(stderr, "    -transposeN (store rendered data in "
+                           "column-major order in blocks of\n"
+                           "                 N * 1024 frames, N = 1 to 63, "
+                           "default = 1)\n");
+      std::fprintf(stderr, "    -envdict (compress envelope data using "
+                           "ENVELOPE.BIN as dictionary)\n");
+      std::fprintf(stderr, "    -envcache DIR (store compiled envelope "
+                           "text files in DIR, the default\n"
+                           "                   is $MIDICONV_ENVCACHE)\n");
+      std::fprintf(stderr, "    -report FILE.JSON (write compression "
+                           "statistics)\n");
       errorMessage("invalid number of arguments");
     }
     double  irqFreq = 17734475.0 / (4.0 * 284.0 * 312.0);
     int     quantizeTPQN = 0;
     int     roundingBias = 64;
+    int     maxFrameEvents = 0;
+    unsigned char nVirtChns = 8;
+    int     indexSeconds = 0;
+    double  loopStartTime = -1.0;
+    double  loopEndTime = -1.0;
+    long    loopStartFrame = -1L;
+    long    loopEndFrame = -1L;
     int     compressLevel = 0;
+    int     decodeSpeedWeight = 0;
+    int     splitCandidateLimit = 0;
+    int     longMatchMemoryLimit = 0;
+    int     matchTableMemoryLimit = 0;
+    double  timeBudget = 0.0;
     bool    optSort = false;
     bool    renumberPgm = false;
     bool    rawFormat = true;
     bool    renderDaveOutput = false;
+    bool    regLogOutput = false;
+    bool    voiceOutput = false;
+    bool    streamOutput = false;
+    bool    bankedOutput = false;
+    bool    diskStreamOutput = false;
+    unsigned char renderTransform = 0x00;
+    size_t  renderTransformBlockSize = 0;
+    bool    envDictEnabled = false;
+    const char  *reportFileName = (char *) 0;
+    bool    songBankOutput = (std::strcmp(argv[3], "-bank") == 0);
+    std::vector< const char * > songFiles;
+    {
+      const char  *s = std::getenv("MIDICONV_ENVCACHE");
+      if (s && s[0] != '\0')
+        Envelopes::cacheDirectory = s;
+    }
     for (int i = 4; i < argc; i++) {
       if (std::strcmp(argv[i], "-optsort") == 0) {
         optSort = true;
@@ -1286,27 +2772,247 @@ int main(int argc, char **argv)
           roundingBias = (roundingBias * 10) + int(argv[i][6] - '0');
         roundingBias = ((roundingBias << 8) + 50) / 100;
       }
+      else if (std::strncmp(argv[i], "-maxev", 6) == 0 &&
+               argv[i][6] >= '0' && argv[i][6] <= '9' &&
+               (argv[i][7] == '\0' ||
+                (argv[i][7] >= '0' && argv[i][7] <= '9' &&
+                 argv[i][8] == '\0'))) {
+        maxFrameEvents = int(argv[i][6] - '0');
+        if (argv[i][7])
+          maxFrameEvents = (maxFrameEvents * 10) + int(argv[i][7] - '0');
+      }
+      else if (std::strncmp(argv[i], "-halfrate", 9) == 0 &&
+               (argv[i][9] == '\0' ||
+                (argv[i][9] >= '0' && argv[i][9] <= '9' &&
+                 argv[i][10] == '\0'))) {
+        Envelopes::halfRateMaxVolDiff = 0;
+        if (argv[i][9])
+          Envelopes::halfRateMaxVolDiff = int(argv[i][9] - '0');
+      }
+      else if (std::strcmp(argv[i], "-no-halfrate") == 0) {
+        Envelopes::halfRateMaxVolDiff = -1;
+      }
+      else if (std::strcmp(argv[i], "-chns4") == 0 ||
+               std::strcmp(argv[i], "-chns8") == 0) {
+        nVirtChns = (unsigned char) (argv[i][5] - '0');
+      }
+      else if (std::strncmp(argv[i], "-speed", 6) == 0 &&
+               argv[i][6] >= '0' && argv[i][6] <= '9' &&
+               (argv[i][7] == '\0' ||
+                (argv[i][7] >= '0' && argv[i][7] <= '9' &&
+                 argv[i][8] == '\0'))) {
+        decodeSpeedWeight = int(argv[i][6] - '0');
+        if (argv[i][7])
+          decodeSpeedWeight = (decodeSpeedWeight * 10) + int(argv[i][7] - '0');
+      }
+      else if (std::strncmp(argv[i], "-merge", 6) == 0 &&
+               argv[i][6] >= '0' && argv[i][6] <= '9' &&
+               (argv[i][7] == '\0' ||
+                (argv[i][7] >= '0' && argv[i][7] <= '9' &&
+                 argv[i][8] == '\0'))) {
+        splitCandidateLimit = int(argv[i][6] - '0');
+        if (argv[i][7]) {
+          splitCandidateLimit =
+              (splitCandidateLimit * 10) + int(argv[i][7] - '0');
+        }
+      }
+      else if (std::strncmp(argv[i], "-long", 5) == 0 &&
+               (argv[i][5] == '\0' ||
+                (argv[i][5] >= '0' && argv[i][5] <= '9' &&
+                 (argv[i][6] == '\0' ||
+                  (argv[i][6] >= '0' && argv[i][6] <= '9' &&
+                   argv[i][7] == '\0'))))) {
+        longMatchMemoryLimit = 16;
+        if (argv[i][5]) {
+          longMatchMemoryLimit = int(argv[i][5] - '0');
+          if (argv[i][6]) {
+            longMatchMemoryLimit =
+                (longMatchMemoryLimit * 10) + int(argv[i][6] - '0');
+          }
+          longMatchMemoryLimit =
+              (longMatchMemoryLimit > 1 ? longMatchMemoryLimit : 1);
+        }
+      }
+      else if (std::strcmp(argv[i], "-no-long") == 0) {
+        longMatchMemoryLimit = 0;
+      }
+      else if (std::strncmp(argv[i], "-index", 6) == 0 &&
+               (argv[i][6] == '\0' ||
+                (argv[i][6] >= '0' && argv[i][6] <= '9' &&
+                 (argv[i][7] == '\0' ||
+                  (argv[i][7] >= '0' && argv[i][7] <= '9' &&
+                   argv[i][8] == '\0'))))) {
+        indexSeconds = 10;
+        if (argv[i][6]) {
+          indexSeconds = int(argv[i][6] - '0');
+          if (argv[i][7])
+            indexSeconds = (indexSeconds * 10) + int(argv[i][7] - '0');
+        }
+      }
+      else if (std::strcmp(argv[i], "-loop") == 0) {
+        if ((i + 2) >= argc)
+          errorMessage("missing argument for -loop");
+        char    *endp = (char *) 0;
+        loopStartTime = std::strtod(argv[i + 1], &endp);
+        if (endp == argv[i + 1] || *endp != '\0' || !(loopStartTime >= 0.0))
+          errorMessage("invalid loop start time: %s", argv[i + 1]);
+        loopEndTime = std::strtod(argv[i + 2], &endp);
+        if (endp == argv[i + 2] || *endp != '\0' ||
+            !(loopEndTime > loopStartTime)) {
+          errorMessage("invalid loop end time: %s", argv[i + 2]);
+        }
+        i = i + 2;
+        if (!indexSeconds)
+          indexSeconds = 10;
+      }
+      else if (std::strcmp(argv[i], "-time-budget") == 0) {
+        if (++i >= argc)
+          errorMessage("missing argument for -time-budget");
+        char    *endp = (char *) 0;
+        timeBudget = std::strtod(argv[i], &endp);
+        if (endp == argv[i] || *endp != '\0' || !(timeBudget > 0.0))
+          errorMessage("invalid time budget: %s", argv[i]);
+      }
+      else if (std::strncmp(argv[i], "-mem", 4) == 0 &&
+               argv[i][4] >= '0' && argv[i][4] <= '9' &&
+               (argv[i][5] == '\0' ||
+                (argv[i][5] >= '0' && argv[i][5] <= '9' &&
+                 argv[i][6] == '\0'))) {
+        matchTableMemoryLimit = int(argv[i][4] - '0');
+        if (argv[i][5]) {
+          matchTableMemoryLimit =
+              (matchTableMemoryLimit * 10) + int(argv[i][5] - '0');
+        }
+      }
       else if (std::strcmp(argv[i], "-render") == 0) {
         renderDaveOutput = true;
       }
       else if (std::strcmp(argv[i], "-no-render") == 0) {
         renderDaveOutput = false;
       }
+      else if (std::strcmp(argv[i], "-reglog") == 0) {
+        regLogOutput = true;
+      }
+      else if (std::strcmp(argv[i], "-no-reglog") == 0) {
+        regLogOutput = false;
+      }
+      else if (std::strcmp(argv[i], "-stream") == 0) {
+        streamOutput = true;
+      }
+      else if (std::strcmp(argv[i], "-no-stream") == 0) {
+        streamOutput = false;
+      }
+      else if (std::strcmp(argv[i], "-voice") == 0) {
+        voiceOutput = true;
+      }
+      else if (std::strcmp(argv[i], "-no-voice") == 0) {
+        voiceOutput = false;
+      }
+      else if (std::strcmp(argv[i], "-banked") == 0) {
+        bankedOutput = true;
+      }
+      else if (std::strcmp(argv[i], "-no-banked") == 0) {
+        bankedOutput = false;
+      }
+      else if (std::strcmp(argv[i], "-diskstream") == 0) {
+        diskStreamOutput = true;
+      }
+      else if (std::strcmp(argv[i], "-no-diskstream") == 0) {
+        diskStreamOutput = false;
+      }
+      else if (std::strcmp(argv[i], "-delta") == 0) {
+        renderTransform = renderTransformDelta;
+      }
+      else if (std::strncmp(argv[i], "-transpose", 10) == 0 &&
+               (argv[i][10] == '\0' ||
+                (argv[i][10] >= '0' && argv[i][10] <= '9' &&
+                 (argv[i][11] == '\0' ||
+                  (argv[i][11] >= '0' && argv[i][11] <= '9' &&
+                   argv[i][12] == '\0'))))) {
+        renderTransform = renderTransformTranspose;
+        renderTransformBlockSize = 1;
+        if (argv[i][10]) {
+          renderTransformBlockSize = size_t(argv[i][10] - '0');
+          if (argv[i][11]) {
+            renderTransformBlockSize =
+                (renderTransformBlockSize * 10) + size_t(argv[i][11] - '0');
+          }
+          if (renderTransformBlockSize < 1 || renderTransformBlockSize > 63)
+            errorMessage("invalid transform block size");
+        }
+        renderTransformBlockSize = renderTransformBlockSize << 10;
+      }
+      else if (std::strcmp(argv[i], "-no-transform") == 0) {
+        renderTransform = 0x00;
+      }
+      else if (std::strcmp(argv[i], "-envdict") == 0) {
+        envDictEnabled = true;
+      }
+      else if (std::strcmp(argv[i], "-no-envdict") == 0) {
+        envDictEnabled = false;
+      }
+      else if (std::strcmp(argv[i], "-report") == 0) {
+        if (++i >= argc)
+          errorMessage("missing file name after -report");
+        reportFileName = argv[i];
+      }
+      else if (std::strcmp(argv[i], "-envcache") == 0) {
+        if (++i >= argc || argv[i][0] == '\0')
+          errorMessage("missing directory name after -envcache");
+        Envelopes::cacheDirectory = argv[i];
+      }
+      else if (std::strcmp(argv[i], "-no-envcache") == 0) {
+        Envelopes::cacheDirectory.clear();
+      }
       else if (argv[i][0] == '-' && argv[i][1] >= '0' && argv[i][1] <= '9' &&
                argv[i][2] == '\0') {
         compressLevel = int(argv[i][1] - '0');
       }
       else {
         char    *endp = (char *) 0;
-        irqFreq = std::strtod(argv[i], &endp);
-        if (!endp || endp == argv[i] || *endp != '\0')
-          errorMessage("invalid option: '%s'", argv[i]);
+        double  f = std::strtod(argv[i], &endp);
+        if (!endp || endp == argv[i] || *endp != '\0') {
+          // with -bank, any argument that is not an option or a number is
+          // the name of a song
+          if (!songBankOutput || argv[i][0] == '-' || argv[i][0] == '\0')
+            errorMessage("invalid option: '%s'", argv[i]);
+          songFiles.push_back(argv[i]);
+          continue;
+        }
+        irqFreq = f;
         if (!(irqFreq >= 10.0 && irqFreq <= 10000.0))
           errorMessage("invalid IRQ frequency");
       }
     }
     MIDIEvent::optimizeNoteEvents = optSort;
     std::vector< unsigned char >  outBuf;
+    if (std::strcmp(argv[3], "-tables") == 0) {
+      writeDaveTables(argv[1], argv[2]);
+      return 0;
+    }
+    if (std::strcmp(argv[3], "-untransform") == 0) {
+      {
+        File    f(argv[1], "rb");
+        f.readBlock(outBuf, f.size());
+      }
+      untransformDaveData(outBuf);
+      File    f(argv[2], "wb");
+      f.writeBlock(outBuf);
+      return 0;
+    }
+    if (songBankOutput) {
+      if (renderDaveOutput || regLogOutput || streamOutput || voiceOutput ||
+          bankedOutput || diskStreamOutput || indexSeconds > 0 ||
+          compressLevel > 0 || envDictEnabled || reportFileName) {
+        errorMessage("-bank cannot be used with -render, -reglog, -stream, "
+                     "-voice, -banked, -diskstream, -index or compression");
+      }
+      getSongBankData(outBuf, argv[1], songFiles, irqFreq, renumberPgm,
+                      roundingBias, quantizeTPQN, maxFrameEvents);
+      File    f(argv[2], "wb");
+      f.writeBlock(outBuf);
+      return 0;
+    }
     if (std::strcmp(argv[3], "-env") == 0) {
       Envelopes env(argv[1]);
       env.saveData(outBuf);
@@ -1319,24 +3025,154 @@ int main(int argc, char **argv)
       MIDIFile  midiFile(argv[1]);
       if (std::strcmp(argv[3], "-raw") == 0) {
         midiFile.getRawData(outBuf, irqFreq, (Envelopes *) 0,
-                            roundingBias, quantizeTPQN);
+                            roundingBias, quantizeTPQN, maxFrameEvents);
       }
       else {
         rawFormat = false;
         midiFile.getAllData(outBuf, argv[3], irqFreq, renumberPgm,
-                            roundingBias, quantizeTPQN);
+                            roundingBias, quantizeTPQN, maxFrameEvents);
+        if (loopStartTime >= 0.0) {
+          loopStartFrame = long(loopStartTime * irqFreq + 0.5);
+          loopEndFrame = long(loopEndTime * irqFreq + 0.5);
+        }
+        else {
+          midiFile.getLoopFrames(loopStartFrame, loopEndFrame, irqFreq,
+                                 roundingBias, quantizeTPQN);
+        }
+      }
+    }
+    if (streamOutput) {
+      if (renderTransform)
+        errorMessage("-stream cannot be used with -delta or -transpose");
+      if (compressLevel < 1)
+        errorMessage("-stream requires a compression level");
+      renderDaveOutput = true;
+    }
+    if (regLogOutput) {
+      if (rawFormat)
+        errorMessage("-reglog requires a MIDI and an envelope file");
+      if (renderDaveOutput || voiceOutput || compressLevel > 0 ||
+          reportFileName) {
+        errorMessage("-reglog cannot be used with -render, -voice "
+                     "or compression");
+      }
+      // the log is written to the file while rendering
+      File    f(argv[2], "wb");
+      DaveRegisterLog regLog(f);
+      renderDaveData(outBuf, &regLog, false, nVirtChns);
+      regLog.finish();
+      return 0;
+    }
+    if (indexSeconds > 0) {
+      if (rawFormat)
+        errorMessage("-index requires a MIDI and an envelope file");
+      if (renderDaveOutput || voiceOutput || bankedOutput || diskStreamOutput ||
+          compressLevel > 0) {
+        errorMessage("-index cannot be used with -render, -voice, -banked, "
+                     "-diskstream or compression");
+      }
+      addMIDIDataIndex(outBuf, long(double(indexSeconds) * irqFreq + 0.5),
+                       loopStartFrame, loopEndFrame);
+    }
+    if (voiceOutput) {
+      if (rawFormat)
+        errorMessage("-voice requires a MIDI and an envelope file");
+      if (renderDaveOutput)
+        errorMessage("-voice cannot be used with -render");
+      renderDaveData(outBuf, (DaveRegisterLog *) 0, true, nVirtChns);
+    }
+    if (bankedOutput) {
+      if (rawFormat)
+        errorMessage("-banked requires a MIDI and an envelope file");
+      if (renderDaveOutput || compressLevel > 0)
+        errorMessage("-banked cannot be used with -render or compression");
+      splitMIDIDataBanks(outBuf, voiceOutput);
+    }
+    if (diskStreamOutput) {
+      if (rawFormat)
+        errorMessage("-diskstream requires a MIDI and an envelope file");
+      if (renderDaveOutput || bankedOutput || compressLevel > 0) {
+        errorMessage("-diskstream cannot be used with -render, -banked "
+                     "or compression");
       }
+      splitDiskStreamBlocks(outBuf, voiceOutput, irqFreq);
     }
     if (renderDaveOutput) {
       if (rawFormat)
         errorMessage("-render requires a MIDI and an envelope file");
       rawFormat = true;
-      renderDaveData(outBuf);
+      renderDaveData(outBuf, (DaveRegisterLog *) 0, false, nVirtChns);
+    }
+    else if (renderTransform) {
+      errorMessage("-delta and -transpose require -render");
+    }
+    if (envDictEnabled && rawFormat)
+      errorMessage("-envdict requires a MIDI and an envelope file");
+    std::string report;
+    // rendered DAVE register data is stored in 16 byte frames, unless it is
+    // transposed
+    CompressionOptions  compressOpts;
+    compressOpts.compressLevel = compressLevel;
+    compressOpts.decodeSpeedWeight = decodeSpeedWeight;
+    compressOpts.splitCandidateLimit = splitCandidateLimit;
+    compressOpts.longMatchMemoryLimit = longMatchMemoryLimit;
+    compressOpts.matchTableMemoryLimit = matchTableMemoryLimit;
+    compressOpts.timeBudget = timeBudget;
+    if (longMatchMemoryLimit > 0) {
+      compressOpts.longMatchFrameSize =
+          ((renderDaveOutput && renderTransform != renderTransformTranspose) ?
+           16 : 1);
+    }
+    std::vector< unsigned char >  renderHeader;
+    if (renderDaveOutput && (renderTransform || streamOutput)) {
+      // the header is not compressed
+      transformDaveData(outBuf, renderTransform, renderTransformBlockSize);
+      renderHeader.insert(renderHeader.end(),
+                          outBuf.begin(), outBuf.begin() + 16);
+      outBuf.erase(outBuf.begin(), outBuf.begin() + 16);
+      if (compressLevel > 0)
+        renderHeader[9] = 0x02;
+      if (streamOutput) {
+        renderHeader[12] = (unsigned char) (streamWindowSize & 0xFF);
+        renderHeader[13] = (unsigned char) (streamWindowSize >> 8);
+      }
+    }
+    if (compressLevel > 0) {
+      if (envDictEnabled) {
+        // the dictionary is the envelope file in the format written by -env
+        std::vector< unsigned char >  envDict;
+        {
+          Envelopes env(argv[3]);
+          env.saveData(envDict);
+        }
+        compressOutputData(outBuf, compressOpts, false, &envDict,
+                           (reportFileName ? &report : (std::string *) 0));
+      }
+      else {
+        if (streamOutput)
+          compressOpts.maxOffset = streamWindowSize;
+        compressOutputData(outBuf, compressOpts, rawFormat,
+                           (std::vector< unsigned char > *) 0,
+                           (reportFileName ? &report : (std::string *) 0));
+      }
+    }
+    else if (reportFileName) {
+      errorMessage("-report requires a compression level");
+    }
+    outBuf.insert(outBuf.begin(), renderHeader.begin(), renderHeader.end());
+    if (streamOutput && outBuf.size() > streamMaxFileSize) {
+      errorMessage("compressed stream is too large (%lu bytes, "
+                   "the player can load at most %lu)",
+                   (unsigned long) outBuf.size(),
+                   (unsigned long) streamMaxFileSize);
     }
-    if (compressLevel > 0)
-      compressOutputData(outBuf, compressLevel, rawFormat);
     File    f(argv[2], "wb");
     f.writeBlock(outBuf);
+    if (reportFileName) {
+      std::vector< unsigned char >  tmpBuf(report.begin(), report.end());
+      File    reportFile(reportFileName, "wb");
+      reportFile.writeBlock(tmpBuf);
+    }
   }
   catch (std::exception& e) {
     std::fprintf(stderr, " *** %s: %s\n", argv[0], e.what());
@@ -1344,4 +3180,5 @@ int main(int argc, char **argv)
   }
   return 0;
 }
+#endif
 
@@ -1,6 +1,13 @@
 
 DISPLAY_ENABLED         equ     1
 PANNED_NOTE_NEW         equ     1
+; if non-zero, the note frequency and pan tables are calculated at run time,
+; which makes the program smaller, but start up slower
+DAVE_INIT_TABLES        equ     0
+; number of virtual DAVE channels (4 or 8), with 4 channels, DAVE channels 0
+; and 1 are not shared by multiple notes, which reduces the polyphony, but
+; also the CPU time used by the player
+DAVE_VIRT_CHNS          equ     8
 
         org     00f0h
         defw    0500h, prgEnd - main, 0, 0, 0, 0, 0, 0
@@ -42,16 +49,23 @@ main:
         call    load_midi_file
         call    z, load_envelopes
         di
+    if DAVE_INIT_TABLES != 0
         ld      hl, msg_creatingTables
         call    status_message
+    endif
         call    daveInit
+    if DAVE_INIT_TABLES != 0
         ld      hl, msg_clear
         call    status_message
+    endif
         call    setPlayerLPT
         call    midi_reset
         call    setIRQHandler
 .l2:    ei
         halt
+        ld      a, (reg_stream_mode)
+        or      a
+        call    nz, decompressToRing
         ld      a, 4
         out     (0b5h), a
         in      a, (0b5h)
@@ -123,6 +137,8 @@ load_midi_file:
 .l3:    ld      de, defaultMIDIFileName
         jr      .l1
 
+; returns DE = end address of the envelope data loaded to midi_pgm_layer2
+
 load_envelopes:
         ld      a, 1
         ld      de, envelopeFileName
@@ -140,7 +156,9 @@ load_envelopes:
         sbc     a, high (8192 - 5)
         jr      nc, .l2
         ld      a, 1
+        push    de
         exos    3
+        pop     de
         ret
 .l1:    ld      hl, errMsg_envNotFound
         jp      error_exit
@@ -296,6 +314,7 @@ resetRoutine:
         include "midi_in.s"
         include "display.s"
         include "decompress_m2_new.s"
+        include "decompress_m2_ring.s"
         include "globals.s"
 
 prgEnd:
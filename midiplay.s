@@ -1,6 +1,13 @@
 
 DISPLAY_ENABLED         equ     0
 PANNED_NOTE_NEW         equ     0
+; if non-zero, the note frequency and pan tables are calculated at run time,
+; which makes the program smaller, but start up slower
+DAVE_INIT_TABLES        equ     0
+; number of virtual DAVE channels (4 or 8), with 4 channels, DAVE channels 0
+; and 1 are not shared by multiple notes, which reduces the polyphony, but
+; also the CPU time used by the player
+DAVE_VIRT_CHNS          equ     8
 
         org     00f0h
         defw    0500h, prgEnd - main, 0, 0, 0, 0, 0, 0
@@ -35,15 +42,22 @@ main:
         call    load_midi_file
         call    z, load_envelopes
         di
+    if DAVE_INIT_TABLES != 0
         ld      hl, msg_creatingTables
         call    status_message
+    endif
         call    daveInit
+    if DAVE_INIT_TABLES != 0
         ld      hl, msg_clear
         call    status_message
+    endif
         call    midi_reset
         call    setIRQHandler
 .l2:    ei
         halt
+        ld      a, (reg_stream_mode)
+        or      a
+        call    nz, decompressToRing
         ld      a, 4
         out     (0b5h), a
         in      a, (0b5h)
@@ -59,7 +73,11 @@ main:
         jr      nz, .l3
         call    midi_stop               ; F4
         jr      .l2
-.l3:    call    midi_file_rewind
+.l3:    in      a, (0b3h)               ; the first bank of banked MIDI data
+        push    af                      ; is mapped to page 3 by the rewind,
+        call    midi_file_rewind        ; the system segment is restored
+        pop     af
+        out     (0b3h), a
         jr      .l2
 
 load_midi_file:
@@ -96,6 +114,8 @@ load_midi_file:
 .l3:    ld      de, defaultMIDIFileName
         jr      .l1
 
+; returns DE = end address of the envelope data loaded to midi_pgm_layer2
+
 load_envelopes:
         ld      a, 1
         ld      de, envelopeFileName
@@ -113,7 +133,9 @@ load_envelopes:
         sbc     a, high (8192 - 5)
         jr      nc, .l2
         ld      a, 1
+        push    de
         exos    3
+        pop     de
         ret
 .l1:    ld      hl, errMsg_envNotFound
         jp      error_exit
@@ -186,9 +208,17 @@ irqRoutine:
         push    bc
         push    de
         push    hl
-        push    ix
+        in      a, (0b3h)
+        push    af
+        ld      a, (midi_bank_segment)
+        or      a
+        jr      z, .l1
+        out     (0b3h), a               ; map the current MIDI data bank
+.l1:    push    ix
         call    dave_play
         pop     ix
+        pop     af
+        out     (0b3h), a
         pop     hl
         pop     de
         pop     bc
@@ -256,6 +286,7 @@ resetRoutine:
         include "daveplay.s"
         include "midi_in.s"
         include "decompress_m2_new.s"
+        include "decompress_m2_ring.s"
         include "globals.s"
 
         assert  $ <= 0c000h